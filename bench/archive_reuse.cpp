@@ -0,0 +1,61 @@
+// Builds many small messages in a large fixed capacity archive, either
+// value-initializing a fresh archive for each message or reusing archives
+// from a pool, and reports messages per second.
+//
+// usage: archive_reuse_bench [messages] [strings_per_message]
+
+#include <nocopy.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+  using archive_t = nocopy::archive32<4 << 20>;
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  std::size_t build(archive_t& archive, std::size_t strings) {
+    for (std::size_t i = 0; i < strings; ++i) {
+      archive.add(std::string{"a tag name"}, [](auto) {}, [](std::error_code e) { fail(e); });
+    }
+    return static_cast<std::size_t>(archive.image().size());
+  }
+
+  template <typename Build>
+  double messages_per_second(std::size_t messages, Build&& build_one) {
+    std::size_t bytes = 0;
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < messages; ++i) bytes += build_one();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    // Keep the work from being optimized away
+    if (bytes == 0) std::cerr << "nothing built" << std::endl;
+    return static_cast<double>(messages) / elapsed.count();
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+  std::size_t strings = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+
+  auto fresh = messages_per_second(messages, [&] {
+    auto archive = std::unique_ptr<archive_t>{new archive_t{}};
+    return build(*archive, strings);
+  });
+
+  nocopy::archive_pool<archive_t> pool;
+  auto pooled = messages_per_second(messages, [&] {
+    auto archive = pool.acquire();
+    return build(*archive, strings);
+  });
+
+  std::cout << "fresh\t" << static_cast<uint64_t>(fresh) << " messages/s" << std::endl
+    << "pooled\t" << static_cast<uint64_t>(pooled) << " messages/s" << std::endl;
+  return 0;
+}
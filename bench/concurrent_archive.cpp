@@ -0,0 +1,125 @@
+// Compares a single archive guarded by a mutex against a concurrent archive,
+// with and without per-thread chunks, for 1 to N writer threads. Each
+// operation adds a small record and a string.
+//
+// usage: concurrent_archive_bench [max_threads] [ops_per_thread]
+
+#include <nocopy.hpp>
+
+#include "thread_counts.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+  constexpr std::size_t bytes_per_op = 64;
+  constexpr std::size_t chunk_size = 64 << 10;
+
+  using clock_type = std::chrono::steady_clock;
+
+  struct record {
+    NOCOPY_FIELD(id, uint64_t);
+    NOCOPY_FIELD(value, double);
+    NOCOPY_FIELD(name, nocopy::concurrent_archive64::range_reference<char const>);
+    using type = nocopy::structpack<id_t, value_t, name_t>;
+  };
+  using record_t = record::type;
+
+  template <typename Worker>
+  double run(std::size_t threads, std::size_t ops, Worker&& worker) {
+    std::vector<std::thread> pool;
+    auto start = clock_type::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&worker, t] { worker(t); });
+    }
+    for (auto& thread : pool) thread.join();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return static_cast<double>(threads * ops) / elapsed.count();
+  }
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  // Writer is an archive or a concurrent archive's writer
+  template <typename Writer>
+  void add_record(Writer& writer, uint64_t id) {
+    static char const name[] = "a record name";
+    auto name_ref = writer.add(
+      name, sizeof(name) - 1
+    , [](auto ref) { return ref; }
+    , [](std::error_code e) -> nocopy::concurrent_archive64::range_reference<char const> { fail(e); }
+    );
+    writer.template alloc<record_t>(
+      [&](auto ref) {
+        auto& r = writer.deref(ref);
+        r[record::id] = id;
+        r[record::value] = static_cast<double>(id) / 2;
+        r[record::name] = name_ref;
+      }
+    , [](std::error_code e) { fail(e); }
+    );
+  }
+
+  double locked_archive(unsigned char* buffer, std::size_t size, std::size_t threads, std::size_t ops) {
+    using archive_t = nocopy::growable_archive64<nocopy::fixed_capacity>;
+    auto archive = archive_t::create(
+      buffer, size, nocopy::fixed_capacity{}
+    , [](archive_t a) { return a; }
+    , [](std::error_code e) -> archive_t { fail(e); }
+    );
+    std::mutex mutex;
+    return run(threads, ops, [&](std::size_t t) {
+      for (std::size_t i = 0; i < ops; ++i) {
+        std::lock_guard<std::mutex> lock{mutex};
+        add_record(archive, t * ops + i);
+      }
+    });
+  }
+
+  double concurrent_archive(
+    unsigned char* buffer, std::size_t size, std::size_t threads, std::size_t ops, std::size_t chunk
+  ) {
+    using archive_t = nocopy::concurrent_archive64;
+    auto archive = archive_t::create(
+      buffer, size
+    , [](archive_t a) { return a; }
+    , [](std::error_code e) -> archive_t { fail(e); }
+    );
+    return run(threads, ops, [&](std::size_t t) {
+      auto writer = archive.make_writer(chunk);
+      for (std::size_t i = 0; i < ops; ++i) {
+        add_record(writer, t * ops + i);
+      }
+    });
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t max_threads = argc > 1
+    ? std::strtoul(argv[1], nullptr, 10)
+    : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 250000;
+
+  auto size = max_threads * (ops * bytes_per_op + chunk_size) + nocopy::concurrent_archive64::header_size;
+  std::vector<uint64_t> storage(size / sizeof(uint64_t) + 1);
+  auto buffer = reinterpret_cast<unsigned char*>(storage.data());
+
+  std::cout << "threads\tmutex (ops/s)\tatomic (ops/s)\tchunked (ops/s)" << std::endl;
+  for (std::size_t threads = 1; threads <= max_threads; threads = bench::next_thread_count(threads, max_threads)) {
+    auto locked = locked_archive(buffer, size, threads, ops);
+    auto atomic = concurrent_archive(buffer, size, threads, ops, 0);
+    auto chunked = concurrent_archive(buffer, size, threads, ops, chunk_size);
+    std::cout
+      << threads << '\t'
+      << static_cast<uint64_t>(locked) << '\t'
+      << static_cast<uint64_t>(atomic) << '\t'
+      << static_cast<uint64_t>(chunked) << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,131 @@
+// Compares a single heap guarded by a mutex against a concurrent heap with one
+// arena per thread, for 1 to N writer threads.
+//
+// usage: concurrent_heap_bench [max_threads] [ops_per_thread]
+
+#include <nocopy.hpp>
+
+#include "thread_counts.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+  constexpr std::size_t heap_size = std::size_t{64} << 20;
+  constexpr std::size_t live_per_thread = 64;
+
+  using clock_type = std::chrono::steady_clock;
+
+  template <typename Malloc, typename Free>
+  void churn(std::size_t ops, unsigned seed, Malloc&& malloc, Free&& free) {
+    std::default_random_engine generator{seed};
+    std::uniform_int_distribution<uint64_t> sizes{16, 256};
+    std::vector<nocopy::heap64::range_reference<uint8_t>> live;
+    live.reserve(live_per_thread);
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < ops; ++i) {
+      if (live.size() < live_per_thread) {
+        live.push_back(malloc(sizes(generator)));
+      } else {
+        free(live[next]);
+        live[next] = malloc(sizes(generator));
+        next = (next + 1) % live_per_thread;
+      }
+    }
+    for (auto ref : live) free(ref);
+  }
+
+  template <typename Worker>
+  double run(std::size_t threads, std::size_t ops, Worker&& worker) {
+    std::vector<std::thread> pool;
+    auto start = clock_type::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&worker, t] { worker(t); });
+    }
+    for (auto& thread : pool) thread.join();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    return static_cast<double>(threads * ops) / elapsed.count();
+  }
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  double locked_heap(unsigned char* buffer, std::size_t threads, std::size_t ops) {
+    auto heap = nocopy::heap64::create(
+      buffer, heap_size
+    , [](nocopy::heap64 h) { return h; }
+    , [](std::error_code e) -> nocopy::heap64 { fail(e); }
+    );
+    std::mutex mutex;
+    return run(threads, ops, [&](std::size_t t) {
+      churn(ops, static_cast<unsigned>(t)
+      , [&](uint64_t size) {
+          std::lock_guard<std::mutex> lock{mutex};
+          return heap.malloc_range<uint8_t>(
+            size
+          , [](auto ref) { return ref; }
+          , [](std::error_code e) -> nocopy::heap64::range_reference<uint8_t> { fail(e); }
+          );
+        }
+      , [&](nocopy::heap64::range_reference<uint8_t> ref) {
+          std::lock_guard<std::mutex> lock{mutex};
+          heap.free(ref);
+        }
+      );
+    });
+  }
+
+  double arena_heap(unsigned char* buffer, std::size_t threads, std::size_t ops) {
+    using cheap = nocopy::concurrent_heap64;
+    auto heap = cheap::create(
+      buffer, heap_size, threads
+    , [](cheap h) { return h; }
+    , [](std::error_code e) -> cheap { fail(e); }
+    );
+    return run(threads, ops, [&](std::size_t t) {
+      auto arena = heap.acquire(
+        [](cheap::arena a) { return a; }
+      , [](std::error_code e) -> cheap::arena { fail(e); }
+      );
+      churn(ops, static_cast<unsigned>(t)
+      , [&](uint64_t size) {
+          return arena.malloc_range<uint8_t>(
+            size
+          , [](auto ref) { return ref; }
+          , [](std::error_code e) -> cheap::range_reference<uint8_t> { fail(e); }
+          );
+        }
+      , [&](cheap::range_reference<uint8_t> ref) { arena.free(ref); }
+      );
+    });
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t max_threads = argc > 1
+    ? std::strtoul(argv[1], nullptr, 10)
+    : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+  std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+  auto buffer = reinterpret_cast<unsigned char*>(storage.data());
+
+  std::cout << "threads\tmutex heap (ops/s)\tarena heap (ops/s)\tspeedup" << std::endl;
+  for (std::size_t threads = 1; threads <= max_threads; threads = bench::next_thread_count(threads, max_threads)) {
+    auto locked = locked_heap(buffer, threads, ops);
+    auto arenas = arena_heap(buffer, threads, ops);
+    std::cout
+      << threads << '\t'
+      << static_cast<uint64_t>(locked) << "\t\t"
+      << static_cast<uint64_t>(arenas) << "\t\t"
+      << arenas / locked << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Writes a file of framed archives, then reads it back with a naive loop
+// (read, decode and handle on one thread) and with the frame pipeline,
+// ordered and with 1 to N workers. Handling a frame sums the values in its
+// archive.
+//
+// usage: frame_pipeline_bench [archives] [values_per_archive] [max_workers]
+
+#include <nocopy.hpp>
+#include <nocopy/frame_pipeline.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+  using archive_t = nocopy::growable_archive32<>;
+  using view_t = nocopy::archive_view32;
+  using values_t = archive_t::range_reference<double>;
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  // Each archive holds one range of values, at the same reference
+  values_t write_file(int fd, std::size_t archives, std::size_t values) {
+    auto archive = archive_t::create(
+      nullptr, 0, nocopy::vector_growth{}, [](archive_t a) { return a; }, [](std::error_code e) -> archive_t { fail(e); }
+    );
+    auto ref = archive.alloc_range<double>(
+      static_cast<uint32_t>(values), [](auto r) { return r; }, [](std::error_code e) -> values_t { fail(e); }
+    );
+    auto image = archive.image();
+    std::vector<unsigned char> framed(nocopy::framed_size(static_cast<std::size_t>(image.size())));
+    for (std::size_t i = 0; i < archives; ++i) {
+      auto v = archive.deref(ref);
+      for (auto& value : v) value = static_cast<double>(i);
+      nocopy::encode_frame(
+        image, nocopy::frame_options{1, false}, framed.data(), framed.size()
+      , [](std::size_t) {}, [](std::error_code e) { fail(e); }
+      );
+      if (::write(fd, framed.data(), framed.size()) != static_cast<ssize_t>(framed.size())) {
+        fail({errno, std::system_category()});
+      }
+    }
+    return ref;
+  }
+
+  double sum(nocopy::frame const& f, values_t const& ref) {
+    return view_t::open(
+      f.payload.data(), static_cast<std::size_t>(f.payload.size())
+    , [&](view_t view) {
+        double total = 0;
+        for (auto value : view.deref(ref)) total += value;
+        return total;
+      }
+    , [](std::error_code e) -> double { fail(e); }
+    );
+  }
+
+  template <typename Read>
+  void report(char const* name, int fd, std::size_t bytes, Read&& read) {
+    ::lseek(fd, 0, SEEK_SET);
+    auto start = clock_type::now();
+    auto total = read();
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    std::cout << name << "\t" << static_cast<double>(bytes) / elapsed.count() / (1 << 20) << " MB/s"
+      << "\t(sum " << total << ")" << std::endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t archives = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+  std::size_t values = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2048;
+  std::size_t max_workers = argc > 3
+    ? std::strtoul(argv[3], nullptr, 10)
+    : std::max(1u, std::thread::hardware_concurrency());
+
+  char path[] = "/tmp/nocopy_pipeline_bench_XXXXXX";
+  int fd = ::mkstemp(path);
+  if (fd < 0) fail({errno, std::system_category()});
+  auto ref = write_file(fd, archives, values);
+  auto bytes = static_cast<std::size_t>(::lseek(fd, 0, SEEK_END));
+
+  report("naive", fd, bytes, [&] {
+    std::vector<uint64_t> chunk(1 << 14);
+    nocopy::frame_decoder decoder;
+    double total = 0;
+    for (;;) {
+      auto count = ::read(fd, chunk.data(), chunk.size() * sizeof(uint64_t));
+      if (count < 0) fail({errno, std::system_category()});
+      if (count == 0) break;
+      decoder.feed(
+        reinterpret_cast<unsigned char const*>(chunk.data()), static_cast<std::size_t>(count)
+      , [&](nocopy::frame const& f) { total += sum(f, ref); }
+      , [](std::error_code e) { fail(e); }
+      );
+    }
+    return total;
+  });
+
+  report("ordered", fd, bytes, [&] {
+    double total = 0;
+    nocopy::read_frames(
+      fd, nocopy::pipeline_options{}
+    , [&](nocopy::frame const& f, uint64_t) { total += sum(f, ref); }
+    , []() {}, [](std::error_code e) { fail(e); }
+    );
+    return total;
+  });
+
+  if (max_workers > 1) {
+    std::string name = "ordered, " + std::to_string(max_workers) + " workers";
+    report(name.c_str(), fd, bytes, [&] {
+      double total = 0;
+      nocopy::pipeline_options options;
+      options.workers = max_workers;
+      nocopy::read_frames(
+        fd, options
+      , [&](nocopy::frame const& f, uint64_t) { total += sum(f, ref); }
+      , []() {}, [](std::error_code e) { fail(e); }
+      );
+      return total;
+    });
+  }
+
+  for (std::size_t workers = 1; workers <= max_workers; workers *= 2) {
+    std::string name = std::to_string(workers) + " workers";
+    report(name.c_str(), fd, bytes, [&] {
+      std::atomic<uint64_t> total{0};
+      nocopy::pipeline_options options;
+      options.workers = workers;
+      options.ordered = false;
+      nocopy::read_frames(
+        fd, options
+      , [&](nocopy::frame const& f, uint64_t) { total += static_cast<uint64_t>(sum(f, ref)); }
+      , []() {}, [](std::error_code e) { fail(e); }
+      );
+      return static_cast<double>(total.load());
+    });
+  }
+
+  ::close(fd);
+  std::remove(path);
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Decodes a stream of small frames fed in fixed-size chunks, with and
+// without checksums, and reports frames per second.
+//
+// usage: framing_bench [frames] [payload_bytes] [chunk_bytes]
+
+#include <nocopy.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  std::vector<uint64_t> make_stream(std::size_t frames, std::size_t payload_bytes, bool checksum) {
+    std::vector<unsigned char> payload(payload_bytes, 0x5a);
+    auto span = gsl::span<unsigned char const>{payload.data(), static_cast<std::ptrdiff_t>(payload.size())};
+    auto frame_size = nocopy::framed_size(payload_bytes);
+    std::vector<uint64_t> stream(frames * frame_size / sizeof(uint64_t));
+    auto bytes = reinterpret_cast<unsigned char*>(stream.data());
+    for (std::size_t i = 0; i < frames; ++i) {
+      nocopy::encode_frame(
+        span, nocopy::frame_options{1, checksum}, bytes + i * frame_size, frame_size
+      , [](std::size_t) {}
+      , [](std::error_code e) { fail(e); }
+      );
+    }
+    return stream;
+  }
+
+  void decode(
+    char const* name, std::vector<uint64_t> const& stream, std::size_t max_length, std::size_t chunk_bytes
+  ) {
+    auto bytes = reinterpret_cast<unsigned char const*>(stream.data());
+    auto size = stream.size() * sizeof(uint64_t);
+    nocopy::frame_decoder decoder{max_length};
+    std::size_t frames = 0;
+    std::size_t payload_bytes = 0;
+    auto start = clock_type::now();
+    for (std::size_t position = 0; position < size; position += chunk_bytes) {
+      decoder.feed(
+        bytes + position, std::min(chunk_bytes, size - position)
+      , [&](nocopy::frame f) { ++frames; payload_bytes += static_cast<std::size_t>(f.payload.size()); }
+      , [](std::error_code e) { fail(e); }
+      );
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    std::cout << name
+      << "\t" << static_cast<uint64_t>(static_cast<double>(frames) / elapsed.count()) << " frames/s"
+      << "\t" << static_cast<double>(size) / elapsed.count() / (1 << 20) << " MB/s"
+      << "\t(" << payload_bytes << " payload bytes)" << std::endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000000;
+  std::size_t payload_bytes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 48;
+  std::size_t chunk_bytes = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 65536;
+
+  decode("plain", make_stream(frames, payload_bytes, false), payload_bytes, chunk_bytes);
+  decode("checksummed", make_stream(frames, payload_bytes, true), payload_bytes, chunk_bytes);
+  return 0;
+}
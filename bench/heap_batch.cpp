@@ -0,0 +1,92 @@
+// Compares malloc_many/free_many against loops of individual malloc/free
+// calls for batches of small structpacks.
+//
+// usage: heap_batch_bench [batch_size] [rounds]
+
+#include <nocopy.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace {
+  struct measurement {
+    NOCOPY_FIELD(delta, float);
+    NOCOPY_FIELD(first, uint32_t);
+    NOCOPY_FIELD(second, uint8_t);
+    NOCOPY_FIELD(coords, NOCOPY_ARRAY(uint8_t, 10));
+    using type = nocopy::structpack<delta_t, first_t, second_t, coords_t>;
+  };
+  using measurement_t = measurement::type;
+  using ref_t = nocopy::heap64::single_reference<measurement_t>;
+
+  constexpr std::size_t heap_size = std::size_t{64} << 20;
+
+  using clock_type = std::chrono::steady_clock;
+
+  [[noreturn]] void fail(std::error_code e) {
+    std::cerr << e.message() << std::endl;
+    std::exit(1);
+  }
+
+  template <typename Malloc, typename Free>
+  void time(char const* name, std::size_t batch, std::size_t rounds, Malloc&& malloc, Free&& free) {
+    clock_type::duration malloc_time{}, free_time{};
+    for (std::size_t r = 0; r < rounds; ++r) {
+      auto start = clock_type::now();
+      malloc();
+      auto middle = clock_type::now();
+      free();
+      auto end = clock_type::now();
+      malloc_time += middle - start;
+      free_time += end - middle;
+    }
+    auto per_op = [&](clock_type::duration d) {
+      return std::chrono::duration<double, std::nano>(d).count() / static_cast<double>(batch * rounds);
+    };
+    std::cout << name << "\tmalloc " << per_op(malloc_time) << " ns/ref\tfree "
+      << per_op(free_time) << " ns/ref" << std::endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t batch = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+  std::size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+  std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+  auto heap = nocopy::heap64::create(
+    reinterpret_cast<unsigned char*>(storage.data()), heap_size
+  , [](nocopy::heap64 h) { return h; }
+  , [](std::error_code e) -> nocopy::heap64 { fail(e); }
+  );
+
+  // Fragment the heap a little so that the free lists are not trivial
+  std::vector<nocopy::heap64::range_reference<uint8_t>> holes;
+  for (uint64_t i = 0; i < 4096; ++i) {
+    heap.malloc_range<uint8_t>(
+      16 + (i * 37) % 512
+    , [&](auto ref) { if (i % 2 == 0) holes.push_back(ref); }
+    , [](std::error_code e) { fail(e); }
+    );
+  }
+  for (auto ref : holes) heap.free(ref);
+
+  std::vector<ref_t> refs(batch, ref_t{});
+  auto span = gsl::span<ref_t>{refs.data(), static_cast<std::ptrdiff_t>(refs.size())};
+
+  time("individual", batch, rounds
+  , [&] {
+      for (auto& ref : refs) {
+        ref = heap.malloc<measurement_t>([](auto r) { return r; }, [](std::error_code e) -> ref_t { fail(e); });
+      }
+    }
+  , [&] { for (auto ref : refs) heap.free(ref); }
+  );
+
+  time("batched", batch, rounds
+  , [&] { heap.malloc_many<measurement_t>(span, [](auto) {}, [](std::error_code e) { fail(e); }); }
+  , [&] { heap.free_many(span); }
+  );
+  return 0;
+}
@@ -0,0 +1,147 @@
+// Replays one synthetic allocation trace against each heap placement policy
+// and reports throughput and the worst fragmentation seen along the way. Then
+// frees many blocks of one size class in random order, which is the worst
+// case for first fit's address-ordered free lists.
+//
+// usage: heap_placement_bench [operations] [heap_megabytes] [seed] [crowded_blocks]
+
+#include <nocopy.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+
+  // A malloc of size bytes, or (when size is zero) a free of the live
+  // allocation at slot
+  struct operation {
+    std::size_t size;
+    std::size_t slot;
+  };
+
+  // Mostly small sizes with a long tail, three mallocs to every free, and
+  // frees of random live allocations
+  std::vector<operation> make_trace(std::size_t count, unsigned seed) {
+    std::default_random_engine generator{seed};
+    std::geometric_distribution<std::size_t> small{1.0 / 48};
+    std::uniform_int_distribution<std::size_t> large{1024, 16384};
+    std::vector<operation> trace;
+    trace.reserve(count);
+    std::size_t live = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      if (live == 0 || generator() % 4 != 0) {
+        auto size = generator() % 32 == 0 ? large(generator) : 1 + small(generator);
+        trace.push_back({size, 0});
+        ++live;
+      } else {
+        trace.push_back({0, generator() % live});
+        --live;
+      }
+    }
+    return trace;
+  }
+
+  template <typename Heap>
+  void replay(char const* name, std::vector<operation> const& trace, std::size_t heap_size) {
+    std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+    auto heap = Heap::create(
+      reinterpret_cast<unsigned char*>(storage.data()), heap_size
+    , [](Heap h) { return h; }
+    , [](std::error_code e) -> Heap { std::cerr << e.message() << std::endl; std::exit(1); }
+    );
+    using ref_t = typename Heap::template range_reference<uint8_t>;
+    std::vector<ref_t> live;
+    live.reserve(trace.size());
+    std::size_t failures = 0;
+    double peak_fragmentation = 0;
+    clock_type::duration elapsed{};
+    auto sample_every = std::max<std::size_t>(trace.size() / 1000, 1);
+
+    for (std::size_t i = 0; i < trace.size(); ++i) {
+      auto& op = trace[i];
+      auto start = clock_type::now();
+      if (op.size != 0) {
+        heap.template malloc_range<uint8_t>(
+          op.size
+        , [&](ref_t ref) { live.push_back(ref); }
+        , [&](std::error_code) { ++failures; }
+        );
+      } else if (!live.empty()) {
+        auto slot = op.slot % live.size();
+        heap.free(live[slot]);
+        live[slot] = live.back();
+        live.pop_back();
+      }
+      elapsed += clock_type::now() - start;
+      if (i % sample_every == 0) {
+        peak_fragmentation = std::max(peak_fragmentation, heap.stats().fragmentation());
+      }
+    }
+
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << name
+      << "\t" << static_cast<double>(trace.size()) / seconds << " ops/s"
+      << "\tpeak fragmentation " << peak_fragmentation
+      << "\tfailed mallocs " << failures << std::endl;
+  }
+
+  // Every other block stays allocated, so the freed blocks can't merge and
+  // all land in one class. Only the frees are timed.
+  template <typename Heap>
+  void crowded_frees(
+    char const* name, std::size_t blocks, std::size_t heap_size, unsigned seed
+  ) {
+    std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+    auto heap = Heap::create(
+      reinterpret_cast<unsigned char*>(storage.data()), heap_size
+    , [](Heap h) { return h; }
+    , [](std::error_code e) -> Heap { std::cerr << e.message() << std::endl; std::exit(1); }
+    );
+    using ref_t = typename Heap::template range_reference<uint8_t>;
+    std::vector<ref_t> freed;
+    freed.reserve(blocks);
+    for (std::size_t i = 0; i < 2 * blocks; ++i) {
+      heap.template malloc_range<uint8_t>(
+        64
+      , [&](ref_t ref) { if (i % 2 == 0) freed.push_back(ref); }
+      , [](std::error_code e) { std::cerr << e.message() << std::endl; std::exit(1); }
+      );
+    }
+    std::shuffle(freed.begin(), freed.end(), std::default_random_engine{seed});
+
+    auto start = clock_type::now();
+    for (auto ref : freed) heap.free(ref);
+    auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    std::cout << name
+      << "\t" << seconds * 1e9 / static_cast<double>(blocks) << " ns/free" << std::endl;
+  }
+
+  template <typename Placement>
+  using heap_with = nocopy::detail::heap<
+    uint64_t, uint64_t, true, nocopy::detail::null_heap_observer, nocopy::detail::full_block_headers
+  , Placement
+  >;
+}
+
+int main(int argc, char** argv) {
+  std::size_t operations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::size_t heap_size = (argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256) << 20;
+  auto seed = argc > 3 ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : 1u;
+  std::size_t crowded_blocks = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 16384;
+
+  auto trace = make_trace(operations, seed);
+  replay<heap_with<nocopy::detail::good_fit>>("good fit", trace, heap_size);
+  replay<heap_with<nocopy::detail::first_fit>>("first fit", trace, heap_size);
+  replay<heap_with<nocopy::detail::best_fit>>("best fit", trace, heap_size);
+
+  std::cout << std::endl << "freeing " << crowded_blocks << " blocks of one size class" << std::endl;
+  crowded_frees<heap_with<nocopy::detail::good_fit>>("good fit", crowded_blocks, heap_size, seed);
+  crowded_frees<heap_with<nocopy::detail::first_fit>>("first fit", crowded_blocks, heap_size, seed);
+  crowded_frees<heap_with<nocopy::detail::best_fit>>("best fit", crowded_blocks, heap_size, seed);
+  return 0;
+}
@@ -0,0 +1,224 @@
+// Replays a recorded heap trace (see nocopy/heap_trace.hpp) against a heap
+// configuration and reports throughput, latency percentiles, and
+// fragmentation over the course of the trace. Operations are timed in
+// batches of 32, so each latency is the mean of one batch.
+//
+// usage: heap_replay <trace> [heap_megabytes] [good|first|best] [full|compact]
+//        heap_replay --record <trace> [operations] [seed]
+//
+// The second form writes a trace of a synthetic workload, recorded from a
+// traced_heap64, for trying the tool out.
+
+#include <nocopy.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+
+  constexpr std::size_t samples = 10;
+  constexpr std::size_t batch_size = 32;
+
+  [[noreturn]] void fail(std::string const& message) {
+    std::cerr << message << std::endl;
+    std::exit(1);
+  }
+
+  std::vector<nocopy::trace_event> load(char const* path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) fail(std::string{"can't open "} + path);
+    std::vector<unsigned char> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    std::vector<nocopy::trace_event> events;
+    nocopy::read_trace(
+      bytes.data(), bytes.size()
+    , [&](nocopy::trace_event e) { events.push_back(e); }
+    , []() {}
+    , [](std::error_code e) { fail(e.message()); }
+    );
+    return events;
+  }
+
+  void record(char const* path, std::size_t operations, unsigned seed) {
+    std::size_t heap_size = std::size_t{64} << 20;
+    std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+    auto heap = nocopy::traced_heap64::create(
+      reinterpret_cast<unsigned char*>(storage.data()), heap_size
+    , [](nocopy::traced_heap64 h) { return h; }
+    , [](std::error_code e) -> nocopy::traced_heap64 { fail(e.message()); }
+    );
+    nocopy::trace_recorder recorder{operations};
+    heap.observer().recorder = &recorder;
+    std::default_random_engine generator{seed};
+    std::geometric_distribution<std::size_t> small{1.0 / 48};
+    std::vector<nocopy::traced_heap64::range_reference<uint8_t>> live;
+    for (std::size_t i = 0; i < operations; ++i) {
+      if (live.empty() || generator() % 4 != 0) {
+        heap.malloc_range<uint8_t>(
+          generator() % 32 == 0 ? 1024 + generator() % 16384 : 1 + small(generator)
+        , [&](auto ref) { live.push_back(ref); }
+        , [](std::error_code) {}
+        );
+      } else {
+        auto slot = generator() % live.size();
+        heap.free(live[slot]);
+        live[slot] = live.back();
+        live.pop_back();
+      }
+    }
+    std::ofstream file{path, std::ios::binary};
+    auto& trace = recorder.trace();
+    file.write(reinterpret_cast<char const*>(trace.data()), static_cast<std::streamsize>(trace.size()));
+    if (!file) fail(std::string{"can't write "} + path);
+  }
+
+  // A trace event with its recorded offset resolved to a slot, so that no
+  // map lookups happen while the replay is timed. A free of an offset that
+  // was never allocated gets no_slot.
+  struct step {
+    bool is_malloc;
+    uint64_t size;
+    std::size_t slot;
+  };
+  constexpr std::size_t no_slot = std::numeric_limits<std::size_t>::max();
+
+  std::vector<step> resolve(std::vector<nocopy::trace_event> const& events, std::size_t& slots) {
+    std::unordered_map<uint64_t, std::size_t> live;
+    std::vector<step> steps;
+    steps.reserve(events.size());
+    slots = 0;
+    for (auto& event : events) {
+      if (event.op == nocopy::trace_op::malloc) {
+        live[event.offset] = slots;
+        steps.push_back({true, event.size, slots++});
+      } else {
+        auto it = live.find(event.offset);
+        if (it == live.end()) {
+          steps.push_back({false, 0, no_slot});
+        } else {
+          steps.push_back({false, 0, it->second});
+          live.erase(it);
+        }
+      }
+    }
+    return steps;
+  }
+
+  template <typename Heap>
+  void replay(std::vector<nocopy::trace_event> const& events, std::size_t heap_size) {
+    std::vector<uint64_t> storage(heap_size / sizeof(uint64_t));
+    auto heap = Heap::create(
+      reinterpret_cast<unsigned char*>(storage.data()), heap_size
+    , [](Heap h) { return h; }
+    , [](std::error_code e) -> Heap { fail(e.message()); }
+    );
+    using ref_t = typename Heap::template range_reference<uint8_t>;
+    std::size_t slots;
+    auto steps = resolve(events, slots);
+    std::vector<ref_t> refs(slots, ref_t{0});
+    std::vector<unsigned char> allocated(slots, 0);
+    // Each latency is the mean time per operation of one batch, since timing
+    // single operations would mostly measure the clock
+    std::vector<double> latencies;
+    latencies.reserve(steps.size() / batch_size + 1);
+    double total = 0;
+    std::size_t failures = 0;
+    auto sample_every = std::max<std::size_t>(steps.size() / samples, 1);
+
+    std::cout << "operations\tfragmentation" << std::endl;
+    // stats() walks a free list, so it is only sampled between segments of
+    // the trace, never while an operation is being timed
+    for (std::size_t begin = 0; begin < steps.size(); begin += sample_every) {
+      auto end = std::min(begin + sample_every, steps.size());
+      for (std::size_t batch = begin; batch < end; batch += batch_size) {
+        auto batch_end = std::min(batch + batch_size, end);
+        auto start = clock_type::now();
+        for (std::size_t i = batch; i < batch_end; ++i) {
+          auto& step = steps[i];
+          if (step.is_malloc) {
+            heap.template malloc_range<uint8_t>(
+              static_cast<typename Heap::offset_t>(step.size)
+            , [&](ref_t ref) {
+                refs[step.slot] = ref;
+                allocated[step.slot] = 1;
+              }
+            , [&](std::error_code) { ++failures; }
+            );
+          } else if (step.slot != no_slot && allocated[step.slot]) {
+            heap.free(refs[step.slot]);
+            allocated[step.slot] = 0;
+          }
+        }
+        std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+        total += elapsed.count();
+        latencies.push_back(elapsed.count() / static_cast<double>(batch_end - batch));
+      }
+      std::cout << end << "\t" << heap.stats().fragmentation() << std::endl;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      if (latencies.empty()) return 0.0;
+      auto index = static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1));
+      return latencies[index];
+    };
+    std::cout << "ops/s " << static_cast<double>(events.size()) / (total * 1e-9)
+      << "\tp50 " << percentile(0.5) << " ns"
+      << "\tp90 " << percentile(0.9) << " ns"
+      << "\tp99 " << percentile(0.99) << " ns"
+      << "\tp99.9 " << percentile(0.999) << " ns"
+      << "\tmax " << percentile(1) << " ns"
+      << "\tfailed mallocs " << failures << std::endl;
+  }
+
+  template <typename HeaderLayout, typename Placement>
+  using heap_with = nocopy::detail::heap<
+    uint64_t, uint64_t, true, nocopy::detail::null_heap_observer, HeaderLayout, Placement
+  >;
+
+  template <typename HeaderLayout>
+  void replay_with(std::string const& placement, std::vector<nocopy::trace_event> const& events, std::size_t heap_size) {
+    if (placement == "good") {
+      replay<heap_with<HeaderLayout, nocopy::detail::good_fit>>(events, heap_size);
+    } else if (placement == "first") {
+      replay<heap_with<HeaderLayout, nocopy::detail::first_fit>>(events, heap_size);
+    } else if (placement == "best") {
+      replay<heap_with<HeaderLayout, nocopy::detail::best_fit>>(events, heap_size);
+    } else {
+      fail("unknown placement policy " + placement);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) fail("usage: heap_replay <trace> [heap_megabytes] [good|first|best] [full|compact]");
+  if (std::string{argv[1]} == "--record") {
+    if (argc < 3) fail("usage: heap_replay --record <trace> [operations] [seed]");
+    std::size_t operations = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000000;
+    auto seed = argc > 4 ? static_cast<unsigned>(std::strtoul(argv[4], nullptr, 10)) : 1u;
+    record(argv[2], operations, seed);
+    return 0;
+  }
+
+  auto events = load(argv[1]);
+  std::size_t heap_size = (argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256) << 20;
+  std::string placement = argc > 3 ? argv[3] : "good";
+  std::string headers = argc > 4 ? argv[4] : "full";
+  if (headers == "full") {
+    replay_with<nocopy::detail::full_block_headers>(placement, events, heap_size);
+  } else if (headers == "compact") {
+    replay_with<nocopy::detail::compact_block_headers>(placement, events, heap_size);
+  } else {
+    fail("unknown header layout " + headers);
+  }
+  return 0;
+}
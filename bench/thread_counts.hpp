@@ -0,0 +1,15 @@
+#ifndef UUID_CAD0874F_A2AE_40A9_90F1_97A30F6CB9D4
+#define UUID_CAD0874F_A2AE_40A9_90F1_97A30F6CB9D4
+
+#include <algorithm>
+#include <cstddef>
+
+namespace bench {
+  // Doubles the thread count, then runs max_threads exactly once. Returns a
+  // count past max_threads when every count has run.
+  inline std::size_t next_thread_count(std::size_t threads, std::size_t max_threads) {
+    return threads == max_threads ? max_threads + 1 : std::min(threads * 2, max_threads);
+  }
+}
+
+#endif
@@ -0,0 +1,96 @@
+// Builds a large archive of records holding strings and ranges, then reports
+// the throughput of verifying it against a memcpy of the same image.
+//
+// usage: verify_bench [records] [iterations]
+
+#include <nocopy.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+  using clock_type = std::chrono::steady_clock;
+  using builder_t = nocopy::growable_archive64<>;
+  using view_t = nocopy::archive_view64;
+
+  struct sample {
+    NOCOPY_FIELD(stamp, uint64_t);
+    NOCOPY_FIELD(value, double);
+    using type = nocopy::structpack<stamp_t, value_t>;
+  };
+  using sample_t = sample::type;
+
+  struct record {
+    NOCOPY_FIELD(name, builder_t::range_reference<char const>);
+    NOCOPY_FIELD(samples, builder_t::range_reference<sample_t>);
+    NOCOPY_FIELD(count, uint64_t);
+    NOCOPY_FIELD(ratio, double);
+    NOCOPY_FIELD(reading, NOCOPY_ONEOF(count_t, ratio_t));
+    using type = nocopy::structpack<name_t, samples_t, reading_t>;
+  };
+  using record_t = record::type;
+
+  // Error callback for steps that should not fail
+  template <typename T>
+  struct fail {
+    T operator()(std::error_code e) const {
+      std::cerr << e.message() << std::endl;
+      std::exit(1);
+    }
+  };
+
+  template <typename Callback>
+  double megabytes_per_second(std::size_t bytes, std::size_t iterations, Callback&& callback) {
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < iterations; ++i) callback();
+    auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    return static_cast<double>(bytes * iterations) / seconds / (1 << 20);
+  }
+}
+
+int main(int argc, char** argv) {
+  std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10;
+
+  auto builder = builder_t::create(
+    nullptr, 0, nocopy::vector_growth{}, [](builder_t b) { return b; }, fail<builder_t>{}
+  );
+  auto root = builder.alloc_range<record_t>(
+    records, [](auto ref) { return ref; }, fail<builder_t::range_reference<record_t>>{}
+  );
+  for (std::size_t i = 0; i < records; ++i) {
+    auto name = builder.add(
+      "record " + std::to_string(i), [](auto ref) { return ref; }
+    , fail<builder_t::range_reference<char const>>{}
+    );
+    auto samples = builder.alloc_range<sample_t>(
+      i % 8, [](auto ref) { return ref; }, fail<builder_t::range_reference<sample_t>>{}
+    );
+    auto& r = builder.deref(root)[i];
+    r[record::name] = name;
+    r[record::samples] = samples;
+    if (i % 2 == 0) r[record::reading][record::count] = i;
+    else r[record::reading][record::ratio] = 1.0 / static_cast<double>(i);
+  }
+
+  auto image = builder.image();
+  auto size = static_cast<std::size_t>(image.size());
+  auto view = view_t::open(image.data(), size, [](view_t v) { return v; }, fail<view_t>{});
+  std::vector<uint64_t> copy(size / sizeof(uint64_t) + 1);
+
+  auto copy_rate = megabytes_per_second(size, iterations, [&] {
+    std::memcpy(copy.data(), image.data(), size);
+  });
+  auto verify_rate = megabytes_per_second(size, iterations, [&] {
+    nocopy::verify(view, root, [] {}, fail<void>{});
+  });
+
+  std::cout << "archive\t" << (size >> 20) << " MB" << std::endl
+    << "memcpy\t" << copy_rate << " MB/s" << std::endl
+    << "verify\t" << verify_rate << " MB/s" << std::endl;
+  return 0;
+}
@@ -2,12 +2,24 @@
 #define UUID_B6D3A61F_F9B9_4F5D_8899_349259B6DFE4
 
 #include <nocopy/archive.hpp>
+#include <nocopy/archive_pool.hpp>
+#include <nocopy/archive_view.hpp>
 #include <nocopy/box.hpp>
+#include <nocopy/concurrent_archive.hpp>
+#include <nocopy/concurrent_heap.hpp>
+#include <nocopy/delta.hpp>
 #include <nocopy/structpack.hpp>
 #include <nocopy/field.hpp>
+#include <nocopy/framing.hpp>
+#include <nocopy/growable_archive.hpp>
 #include <nocopy/heap.hpp>
+#include <nocopy/heap_trace.hpp>
+#include <nocopy/interner.hpp>
+#include <nocopy/merge.hpp>
 #include <nocopy/oneof.hpp>
 #include <nocopy/schema.hpp>
+#include <nocopy/streaming_archive.hpp>
+#include <nocopy/verify.hpp>
 #include <nocopy/version_range.hpp>
 
 #endif
@@ -4,6 +4,7 @@
 #include <nocopy/fwd/archive.hpp>
 
 #include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/archive_header.hpp>
 #include <nocopy/detail/lambda_overload.hpp>
 #include <nocopy/detail/narrow_cast.hpp>
 #include <nocopy/detail/reference.hpp>
@@ -18,13 +19,22 @@ END_IGNORE_WARNINGS_FROM_DEPENDENCIES
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <string>
+#include <type_traits>
 
 namespace nocopy {
   namespace detail {
     template <typename Offset, Offset Capacity>
     class archive {
       NOCOPY_FIELD(buffer, NOCOPY_ARRAY(unsigned char, Capacity));
-      NOCOPY_FIELD(cursor, Offset);
+      // Always 64 bits, so that the buffer after it is aligned for any type.
+      // It is laid out first, and since cursors are stored little-endian, it
+      // doubles as the header of an archive image.
+      NOCOPY_FIELD(cursor_field, uint64_t);
+
+      using header = archive_header<Offset>;
+      using header_t = typename header::type;
 
       using reference = detail::reference<Offset>;
 
@@ -32,7 +42,10 @@ namespace nocopy {
       using generic_reference = typename reference::template generic<T, is_single>;
 
     public:
-      using delegate_type = structpack<buffer_t, cursor_t>;
+      using delegate_type = structpack<buffer_t, cursor_field_t>;
+
+      static constexpr std::size_t header_size = header::size;
+      static_assert(header_size == sizeof(uint64_t), "the cursor must be the image header");
 
       archive(archive const&) = delete;
 
@@ -43,7 +56,7 @@ namespace nocopy {
       using range_reference = typename reference::template range<T>;
 
       template <typename T, typename ...Callbacks>
-      auto alloc(Callbacks... callbacks) const {
+      auto alloc(Callbacks... callbacks) {
         auto callback = detail::make_overload(std::move(callbacks)...);
         return alloc_helper<T>(
           1
@@ -55,44 +68,44 @@ namespace nocopy {
       }
 
       template <typename T, typename ...Callbacks>
-      auto alloc_range(Offset count, Callbacks... callbacks) const {
+      auto alloc_range(Offset count, Callbacks... callbacks) {
         auto callback = detail::make_overload(std::move(callbacks)...);
         return alloc_helper<T>(
           count
-        , [&](Offset offset, Offset count) {
-            return callback(reference::template create_range<T>(offset, count));
+        , [&](Offset offset, Offset allocated) {
+            return callback(reference::template create_range<T>(offset, allocated));
           }
         , callback
         );
       }
 
       template <typename T, typename ...Callbacks>
-      auto add(T const& t, Callbacks... callbacks) const {
+      auto add(T const& t, Callbacks... callbacks) {
         auto callback = detail::make_overload(std::move(callbacks)...);
         return alloc<T>(
-          [=](auto& ref) {
+          [=](auto ref) {
             this->deref(ref) = t;
             return callback(ref);
           }
-        , callback
+        , [&callback](std::error_code e) { return callback(e); }
         );
       }
 
       template <typename T, typename ...Callbacks>
-      auto add(gsl::span<T> data, Callbacks... callbacks) const {
+      auto add(gsl::span<T> in, Callbacks... callbacks) {
         auto callback = detail::make_overload(std::move(callbacks)...);
-        return alloc_range<T>(
-          data.length()
-        , [=](auto& ref) {
-            std::copy(data.cbegin(), data.cend(), this->deref(ref).begin());
+        return alloc_range<std::remove_const_t<T>>(
+          detail::narrow_cast<Offset>(in.length())
+        , [=](auto ref) {
+            std::copy(in.cbegin(), in.cend(), this->deref(ref).begin());
             return callback(ref);
           }
-        , callback
+        , [&callback](std::error_code e) { return callback(e); }
         );
       }
 
       template <typename ...Callbacks>
-      auto add(char const* str, std::size_t len, Callbacks... callbacks) const {
+      auto add(char const* str, std::size_t len, Callbacks... callbacks) {
         using span = gsl::span<char const>;
         static_assert(sizeof(Offset) <= sizeof(typename span::index_type)
         , "offset type is too large");
@@ -100,20 +113,22 @@ namespace nocopy {
         auto callback = detail::make_overload(std::move(callbacks)...);
         // narrow_cast is necessary because gsl::span uses a signed index type
         auto in = span{str, detail::narrow_cast<typename span::index_type>(len)};
-        return alloc_range<char const>(
-          len + 1
-        , [=](auto& ref) {
-            auto& data = this->deref(ref);
-            std::copy(in.cbegin(), in.cend(), data.begin());
-            data[len] = '\0';
-            return callback(ref);
+        return alloc_range<char>(
+          detail::narrow_cast<Offset>(len + 1)
+        , [=](auto ref) {
+            auto chars = this->deref(ref);
+            std::copy(in.cbegin(), in.cend(), chars.begin());
+            chars[static_cast<typename span::index_type>(len)] = '\0';
+            return callback(reference::template create_range<char const>(
+              static_cast<Offset>(ref), detail::narrow_cast<Offset>(len + 1)
+            ));
           }
-        , callback
+        , [&callback](std::error_code e) { return callback(e); }
         );
       }
 
       template <typename ...Callbacks>
-      auto add(std::string const& str, Callbacks... callbacks) const {
+      auto add(std::string const& str, Callbacks... callbacks) {
         return this->add(str.c_str(), str.length(), callbacks...);
       }
 
@@ -122,36 +137,90 @@ namespace nocopy {
         auto offset = static_cast<Offset>(ref);
         return ref.deref(data[buffer][offset]);
       }
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
+        auto offset = static_cast<Offset>(ref);
+        return ref.deref(data[buffer][offset]);
+      }
 
       char const* get_string(range_reference<char const> const& ref) const noexcept {
         return this->deref(ref).data();
       }
 
+      // The used part of the archive as an image: the header followed by
+      // [0, cursor) of data. Send or store this rather than the whole
+      // archive, which includes every unused byte.
+      gsl::span<unsigned char const> image() const noexcept {
+        using index_type = typename gsl::span<unsigned char const>::index_type;
+        auto bytes = reinterpret_cast<unsigned char const*>(&data);
+        assert(&data[buffer][0] == bytes + header_size);
+        return {bytes, static_cast<index_type>(header_size + cursor())};
+      }
+
+      // Replaces the contents of the archive with an image, which may be
+      // shorter than the archive and need not be aligned. Data left over from
+      // before is zeroed, so the archive can be reused.
+      template <typename ...Callbacks>
+      auto load(unsigned char const* image, std::size_t size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if (size < header_size) {
+          return callback(make_error_code(error::bad_archive));
+        }
+        alignas(header_t) unsigned char raw[sizeof(header_t)];
+        std::memcpy(raw, image, sizeof(raw));
+        std::size_t end = reinterpret_cast<header_t const&>(raw)[header::cursor];
+        if (end > Capacity || size - header_size < end) {
+          return callback(make_error_code(error::bad_archive));
+        }
+        std::size_t used = data[cursor_field];
+        std::memcpy(&data[buffer][0], image + header_size, end);
+        if (used > end) {
+          std::memset(&data[buffer][end], 0, used - end);
+        }
+        data[cursor_field] = end;
+        return callback();
+      }
+
+      // Empties the archive for reuse. Only the bytes used so far are zeroed,
+      // so the cost scales with the contents rather than the capacity.
+      void reset() noexcept {
+        std::size_t used = data[cursor_field];
+        if (used != 0) {
+          std::memset(&data[buffer][0], 0, used);
+        }
+        data[cursor_field] = 0;
+      }
+
+      Offset cursor() const noexcept {
+        uint64_t end = data[cursor_field];
+        return detail::narrow_cast<Offset>(end);
+      }
+
       delegate_type data;
 
     private:
       template <typename T, typename Success, typename Error>
       auto alloc_helper(std::size_t count, Success&& success_callback, Error&& error_callback) noexcept {
         detail::assert_valid_type<T>();
-        Offset addr = detail::align_to(data[cursor], detail::alignment_for<T>());
+        Offset addr = detail::align_to(data[cursor_field], detail::alignment_for<T>());
         auto size = sizeof(T) * count;
-        if (Capacity - addr < size) {
+        if (addr > Capacity || Capacity - addr < size) {
           return error_callback(make_error_code(error::out_of_space));
         } else {
-          data[cursor] = addr + size;
+          data[cursor_field] = addr + size;
           return success_callback(addr, count);
         }
       }
     };
   }
-//#ifdef UINT32_MAX
-//  template <uint32_t Capacity>
-//  using archive32 = detail::archive_impl<uint32_t, Capacity>;
-//#endif
-//#ifdef UINT64_MAX
-//  template <uint64_t Capacity>
-//  using archive64 = detail::archive_impl<uint64_t, Capacity>;
-//#endif
+#ifdef UINT32_MAX
+  template <uint32_t Capacity>
+  using archive32 = detail::archive<uint32_t, Capacity>;
+#endif
+#ifdef UINT64_MAX
+  template <uint64_t Capacity>
+  using archive64 = detail::archive<uint64_t, Capacity>;
+#endif
 }
 
 #endif
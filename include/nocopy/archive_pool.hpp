@@ -0,0 +1,83 @@
+#ifndef UUID_C7A41E09_5B3D_4F86_A2C8_6E90D1B4F35A
+#define UUID_C7A41E09_5B3D_4F86_A2C8_6E90D1B4F35A
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nocopy {
+  // Recycles fixed capacity archives, so that building a message does not
+  // value-initialize (and so zero) a whole archive every time. An archive
+  // acquired from the pool is empty and zeroed, and it returns to the pool
+  // when its handle is destroyed, where it is reset. Resetting zeroes only the
+  // bytes that were used. The pool may be shared between threads, and it must
+  // outlive its handles.
+  template <typename Archive>
+  class archive_pool final {
+    class recycler final {
+    public:
+      explicit recycler(archive_pool* pool = nullptr) noexcept : pool_{pool} {}
+
+      void operator()(Archive* archive) const noexcept {
+        pool_->release(std::unique_ptr<Archive>{archive});
+      }
+
+    private:
+      archive_pool* pool_;
+    };
+
+  public:
+    using handle = std::unique_ptr<Archive, recycler>;
+
+    // At most max_idle archives are kept, and any more are freed
+    explicit archive_pool(std::size_t max_idle = std::numeric_limits<std::size_t>::max())
+      : max_idle_{max_idle} {}
+
+    archive_pool(archive_pool const&) = delete;
+    archive_pool& operator=(archive_pool const&) = delete;
+
+    handle acquire() {
+      std::unique_ptr<Archive> archive;
+      {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!idle_.empty()) {
+          archive = std::move(idle_.back());
+          idle_.pop_back();
+        }
+      }
+      if (!archive) {
+        archive.reset(new Archive{});
+        // Make room for it to come back, so that releasing never allocates
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++created_;
+        idle_.reserve(std::min(created_, max_idle_));
+      }
+      return handle{archive.release(), recycler{this}};
+    }
+
+    // The number of archives waiting to be reused
+    std::size_t idle() const {
+      std::lock_guard<std::mutex> lock{mutex_};
+      return idle_.size();
+    }
+
+  private:
+    void release(std::unique_ptr<Archive> archive) noexcept {
+      archive->reset();
+      std::lock_guard<std::mutex> lock{mutex_};
+      if (idle_.size() < max_idle_) {
+        idle_.push_back(std::move(archive));
+      }
+    }
+
+    std::size_t max_idle_;
+    std::size_t created_ = 0;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Archive>> idle_;
+  };
+}
+
+#endif
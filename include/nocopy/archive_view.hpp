@@ -0,0 +1,130 @@
+#ifndef UUID_D5F3BD06_BABD_4EE6_8725_90B15C33C395
+#define UUID_D5F3BD06_BABD_4EE6_8725_90B15C33C395
+
+#include <nocopy/fwd/archive.hpp>
+
+#include <nocopy/detail/archive_header.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+#include <nocopy/errors.hpp>
+
+#include <cstdint>
+
+namespace nocopy {
+  namespace detail {
+    // Read-only access to an archive image in memory the view does not own
+    // (e.g., a buffer received over the network, or a file mapping). Opening
+    // a view only checks the header, so it costs the same for any size.
+    //
+    // deref trusts the reference it is given, as it does for the other
+    // archives. For untrusted images, checked_deref and checked_get_string
+    // check each reference when it is used.
+    template <typename Offset>
+    class archive_view final {
+      using header = archive_header<Offset>;
+      using header_t = typename header::type;
+
+      using reference = detail::reference<Offset>;
+
+      template <typename T, bool is_single>
+      using generic_reference = typename reference::template generic<T, is_single>;
+
+    public:
+      using offset_t = Offset; // for client code
+
+      template <typename T>
+      using single_reference = typename reference::template single<T>;
+
+      template <typename T>
+      using range_reference = typename reference::template range<T>;
+
+      // The image must be aligned to archive_header::max_alignment and
+      // outlive the view. size may extend past the image. Images carry no
+      // magic number or version, so only the cursor is checked, and foreign
+      // data whose first word is small enough is accepted as an archive.
+      template <typename ...Callbacks>
+      static auto open(unsigned char const* image, std::size_t size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if ((reinterpret_cast<std::uintptr_t>(image) & (header::max_alignment - 1)) != 0) {
+          return callback(make_error_code(error::archive_not_aligned));
+        }
+        if (size < header::size) {
+          return callback(make_error_code(error::bad_archive));
+        }
+        Offset cursor = reinterpret_cast<header_t const&>(*image)[header::cursor];
+        if (size - header::size < cursor) {
+          return callback(make_error_code(error::bad_archive));
+        }
+        return callback(archive_view{image + header::size, cursor});
+      }
+
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused> const& ref) const noexcept {
+        return ref.deref(data_[static_cast<Offset>(ref)]);
+      }
+
+      char const* get_string(range_reference<char const> const& ref) const noexcept {
+        return this->deref(ref).data();
+      }
+
+      // Whether ref is aligned for its type and lies within [0, cursor)
+      template <typename T, bool is_single>
+      bool contains(generic_reference<T, is_single> const& ref) const noexcept {
+        Offset offset = static_cast<Offset>(ref);
+        std::size_t count = count_of(ref);
+        return offset % detail::alignment_for<T>() == 0
+          && offset <= cursor_
+          && count <= (cursor_ - offset) / sizeof(T);
+      }
+
+      template <typename T, bool Unused, typename ...Callbacks>
+      auto checked_deref(generic_reference<T, Unused> const& ref, Callbacks... callbacks) const {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if (!contains(ref)) {
+          return callback(make_error_code(error::bad_reference));
+        }
+        return callback(this->deref(ref));
+      }
+
+      // Also checks that the string is terminated within its range
+      template <typename ...Callbacks>
+      auto checked_get_string(range_reference<char const> const& ref, Callbacks... callbacks) const {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if (!contains(ref) || count_of(ref) == 0
+            || data_[static_cast<Offset>(ref) + count_of(ref) - 1] != '\0') {
+          return callback(make_error_code(error::bad_reference));
+        }
+        return callback(get_string(ref));
+      }
+
+      Offset cursor() const noexcept { return cursor_; }
+
+      // The start of the archive's data, which offsets are relative to
+      unsigned char const* data() const noexcept { return data_; }
+
+    private:
+      archive_view(unsigned char const* data, Offset cursor) noexcept
+        : data_{data}, cursor_{cursor} {}
+
+      template <typename T>
+      static Offset count_of(single_reference<T> const&) noexcept { return 1; }
+      template <typename T>
+      static Offset count_of(range_reference<T> const& ref) noexcept {
+        return ref[reference::count_field];
+      }
+
+      unsigned char const* data_;
+      Offset cursor_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using archive_view32 = detail::archive_view<uint32_t>;
+#endif
+#ifdef UINT64_MAX
+  using archive_view64 = detail::archive_view<uint64_t>;
+#endif
+}
+
+#endif
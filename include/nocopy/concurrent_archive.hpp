@@ -0,0 +1,287 @@
+#ifndef UUID_6A0F3D8E_94B2_4C71_B5E3_2F8D17C4A960
+#define UUID_6A0F3D8E_94B2_4C71_B5E3_2F8D17C4A960
+
+#include <nocopy/fwd/archive.hpp>
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/archive_header.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+#include <nocopy/errors.hpp>
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace nocopy {
+  namespace detail {
+    // An archive in a fixed buffer that many threads build at once. Each
+    // thread gets a writer, which allocates from a chunk of the buffer
+    // reserved with a compare-and-swap on the shared cursor, so allocations
+    // within a chunk are not synchronized at all. Allocations too large for a
+    // chunk are reserved on their own, and a chunk size of zero reserves
+    // every allocation on its own.
+    //
+    // The buffer holds the same image as the other archives: a header with
+    // the cursor, then [0, cursor) of data. Unused chunk tails are left
+    // zeroed, like alignment padding.
+    template <typename Offset>
+    class concurrent_archive final {
+      using header = archive_header<Offset>;
+      using header_t = typename header::type;
+
+      using reference = detail::reference<Offset>;
+
+      template <typename T, bool is_single>
+      using generic_reference = typename reference::template generic<T, is_single>;
+
+      static constexpr auto word_size = sizeof(uint64_t);
+
+      struct shared_state {
+        shared_state(unsigned char* b, std::size_t c) noexcept : buffer{b}, capacity{c} {}
+
+        unsigned char* data() noexcept { return buffer + header::size; }
+
+        // Claims bytes (a multiple of the word size) at the end of the data
+        // and zeroes them. Since the cursor only moves by whole words, the
+        // claimed region is aligned for any type.
+        bool reserve(std::size_t bytes, std::size_t& start) noexcept {
+          auto current = cursor.load(std::memory_order_relaxed);
+          do {
+            if (capacity - current < bytes) return false;
+          } while (!cursor.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+          start = current;
+          std::memset(data() + start, 0, bytes);
+          return true;
+        }
+
+        unsigned char* buffer;
+        std::size_t capacity;
+        std::atomic<std::size_t> cursor{0};
+      };
+
+    public:
+      using offset_t = Offset; // for client code
+
+      static constexpr std::size_t max_alignment = header::max_alignment;
+      static constexpr std::size_t header_size = header::size;
+
+      template <typename T>
+      using single_reference = typename reference::template single<T>;
+
+      template <typename T>
+      using range_reference = typename reference::template range<T>;
+
+      // Allocates for one thread at a time. A writer must not outlive its
+      // archive.
+      class writer final {
+      public:
+        writer(writer&&) = default;
+        writer& operator=(writer&&) = default;
+
+        template <typename T, typename ...Callbacks>
+        auto alloc(Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return alloc_helper<T>(
+            1
+          , [&](Offset offset, Offset) {
+              return callback(reference::template create_single<T>(offset));
+            }
+          , callback
+          );
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto alloc_range(Offset count, Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return alloc_helper<T>(
+            count
+          , [&](Offset offset, Offset allocated) {
+              return callback(reference::template create_range<T>(offset, allocated));
+            }
+          , callback
+          );
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto add(T const& t, Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return alloc<T>(
+            [&](auto ref) {
+              this->deref(ref) = t;
+              return callback(ref);
+            }
+          , [&callback](std::error_code e) { return callback(e); }
+          );
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto add(gsl::span<T> in, Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return alloc_range<std::remove_const_t<T>>(
+            detail::narrow_cast<Offset>(in.length())
+          , [&](auto ref) {
+              std::copy(in.cbegin(), in.cend(), this->deref(ref).begin());
+              return callback(ref);
+            }
+          , [&callback](std::error_code e) { return callback(e); }
+          );
+        }
+
+        template <typename ...Callbacks>
+        auto add(char const* str, std::size_t len, Callbacks... callbacks) {
+          assert(str != nullptr);
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return alloc_range<char>(
+            detail::narrow_cast<Offset>(len + 1)
+          , [&](auto ref) {
+              // The terminator is already there, since allocations are zeroed
+              std::memcpy(state_->data() + static_cast<Offset>(ref), str, len);
+              return callback(reference::template create_range<char const>(
+                static_cast<Offset>(ref), detail::narrow_cast<Offset>(len + 1)
+              ));
+            }
+          , [&callback](std::error_code e) { return callback(e); }
+          );
+        }
+
+        template <typename ...Callbacks>
+        auto add(std::string const& str, Callbacks... callbacks) {
+          return this->add(str.c_str(), str.length(), callbacks...);
+        }
+
+        template <typename T, bool Unused>
+        decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
+          return ref.deref(state_->data()[static_cast<Offset>(ref)]);
+        }
+
+      private:
+        writer(shared_state& state, std::size_t chunk_size) noexcept
+          : state_{&state}, chunk_size_{detail::align_to(chunk_size, word_size)} {}
+
+        // Allocations larger than this bypass the chunk, so that refilling
+        // wastes at most a quarter of a chunk
+        std::size_t direct_threshold() const noexcept { return chunk_size_ / 4; }
+
+        template <typename T, typename Success, typename Error>
+        auto alloc_helper(std::size_t count, Success&& success_callback, Error&& error_callback) {
+          detail::assert_valid_type<T>();
+          if (count > state_->capacity / sizeof(T)) {
+            return error_callback(make_error_code(error::out_of_space));
+          }
+          auto size = sizeof(T) * count;
+          auto addr = detail::align_to(position_, detail::alignment_for<T>());
+          if (addr > end_ || end_ - addr < size) {
+            std::size_t start;
+            if (size > direct_threshold() || !state_->reserve(chunk_size_, start)) {
+              if (!state_->reserve(detail::align_to(size, word_size), start)) {
+                return error_callback(make_error_code(error::out_of_space));
+              }
+              return success_callback(detail::narrow_cast<Offset>(start), detail::narrow_cast<Offset>(count));
+            }
+            position_ = addr = start;
+            end_ = start + chunk_size_;
+          }
+          position_ = addr + size;
+          return success_callback(detail::narrow_cast<Offset>(addr), detail::narrow_cast<Offset>(count));
+        }
+
+        shared_state* state_;
+        std::size_t chunk_size_;
+        std::size_t position_ = 0;
+        std::size_t end_ = 0;
+
+        friend class concurrent_archive;
+      };
+
+      concurrent_archive(concurrent_archive&&) = default;
+      concurrent_archive& operator=(concurrent_archive&&) = default;
+
+      // Starts an empty archive in buffer, which must be aligned to
+      // max_alignment. The buffer does not need to be zeroed.
+      template <typename ...Callbacks>
+      static auto create(unsigned char* buffer, std::size_t size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if ((reinterpret_cast<std::uintptr_t>(buffer) & (max_alignment - 1)) != 0) {
+          return callback(make_error_code(error::archive_not_aligned));
+        } else if (size < header_size) {
+          return callback(make_error_code(error::out_of_space));
+        }
+        // Header bytes past the cursor are exported too, so none are left
+        // uninitialized
+        std::memset(buffer, 0, header_size);
+        new (buffer) header_t{};
+        std::size_t max_offset = std::numeric_limits<Offset>::max();
+        auto capacity = detail::align_backward(std::min(size - header_size, max_offset), word_size);
+        return callback(concurrent_archive{buffer, capacity});
+      }
+
+      // Safe to call from any thread. chunk_size is the number of bytes
+      // reserved from the archive at a time.
+      writer make_writer(std::size_t chunk_size) noexcept {
+        return writer{*state_, chunk_size};
+      }
+
+      // Safe from any thread, as long as the referenced data has been written
+      // by a writer whose writes happen before the call
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused> const& ref) const noexcept {
+        return ref.deref(state_->data()[static_cast<Offset>(ref)]);
+      }
+
+      char const* get_string(range_reference<char const> const& ref) const noexcept {
+        return this->deref(ref).data();
+      }
+
+      // Records the cursor in the header and returns the finished archive.
+      // All writes must happen before the call.
+      gsl::span<unsigned char const> image() noexcept {
+        using index_type = typename gsl::span<unsigned char const>::index_type;
+        auto end = state_->cursor.load(std::memory_order_relaxed);
+        reinterpret_cast<header_t&>(*state_->buffer)[header::cursor] = detail::narrow_cast<Offset>(end);
+        return {state_->buffer, static_cast<index_type>(header_size + end)};
+      }
+
+      // Empties the archive for reuse. Writers made before the call must not
+      // be used afterward. Nothing is zeroed here, since reserved regions are
+      // zeroed by the writers that reserve them.
+      void reset() noexcept {
+        state_->cursor.store(0, std::memory_order_relaxed);
+      }
+
+      Offset cursor() const noexcept {
+        return detail::narrow_cast<Offset>(state_->cursor.load(std::memory_order_relaxed));
+      }
+
+      std::size_t capacity() const noexcept { return state_->capacity; }
+
+    private:
+      concurrent_archive(unsigned char* buffer, std::size_t capacity)
+        : state_{new shared_state{buffer, capacity}} {}
+
+      std::unique_ptr<shared_state> state_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using concurrent_archive32 = detail::concurrent_archive<uint32_t>;
+#endif
+#ifdef UINT64_MAX
+  using concurrent_archive64 = detail::concurrent_archive<uint64_t>;
+#endif
+}
+
+#endif
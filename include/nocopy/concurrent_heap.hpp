@@ -0,0 +1,333 @@
+#ifndef UUID_2E96B0D7_51C3_4A8F_B7E4_0F6D29C83A15
+#define UUID_2E96B0D7_51C3_4A8F_B7E4_0F6D29C83A15
+
+#include <nocopy/fwd/concurrent_heap.hpp>
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/heap.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace nocopy {
+  namespace detail {
+    // A heap whose buffer is split into independent arenas, one per writer
+    // thread. Each arena is an ordinary heap (with its own free list index in
+    // the buffer), but references are offsets into the whole buffer, so
+    // readers deref them exactly as they would for a single heap.
+    //
+    // A writer acquires an arena, after which its mallocs and frees take no
+    // locks. Any thread may free any reference: frees of blocks owned by
+    // another arena are pushed onto that arena's lock-free stack and released
+    // by its owner on the owner's next call. Call flush before serializing the
+    // buffer so that these deferred frees reach the free lists.
+    template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+    class concurrent_heap final {
+      using heap_type = heap<Offset, AlignmentType, AssumeSameSizedByte>;
+      static constexpr auto alignment = sizeof(AlignmentType);
+      static constexpr std::size_t byte_multiplier = AssumeSameSizedByte ? 1 : CHAR_BIT;
+
+      struct arena_table {
+        NOCOPY_FIELD(arena_count, Offset);
+        NOCOPY_FIELD(arena_size, Offset);
+        using type = structpack<arena_count_t, arena_size_t>;
+      };
+      using arena_table_t = typename arena_table::type;
+      static constexpr std::size_t table_size = detail::align_to(sizeof(arena_table_t), alignment);
+
+      using reference = detail::reference<Offset>;
+
+      template <typename T, bool is_single>
+      using generic_reference = typename reference::template generic<T, is_single>;
+
+      // Process-local, so it is never part of the serialized buffer. Each
+      // state gets a cache line to itself, so arenas don't share one.
+      struct alignas(64) arena_state {
+        std::atomic<bool> owned{false};
+        std::atomic<Offset> deferred_frees{0};
+      };
+      static_assert(std::is_trivially_destructible<arena_state>::value, "");
+
+      // Before C++17, new doesn't honor alignments beyond max_align_t, so the
+      // states are placed in a buffer with room to align them
+      class arena_states final {
+      public:
+        explicit arena_states(std::size_t count)
+          : storage_{new unsigned char[(count + 1) * sizeof(arena_state)]} {
+          void* start = storage_.get();
+          auto space = (count + 1) * sizeof(arena_state);
+          start = std::align(alignof(arena_state), count * sizeof(arena_state), start, space);
+          states_ = static_cast<arena_state*>(start);
+          for (std::size_t i = 0; i < count; ++i) new (states_ + i) arena_state{};
+        }
+
+        arena_state& operator[](std::size_t index) noexcept { return states_[index]; }
+
+      private:
+        std::unique_ptr<unsigned char[]> storage_;
+        arena_state* states_;
+      };
+
+      struct shared_state {
+        unsigned char* buffer;
+        std::size_t arena_bytes;
+        std::vector<heap_type> arenas;
+        arena_states states;
+      };
+
+    public:
+      using offset_t = Offset; // for client code
+
+      template <typename T>
+      using single_reference = typename reference::template single<T>;
+
+      template <typename T>
+      using range_reference = typename reference::template range<T>;
+
+      // Exclusive access to one arena. Releases the arena when destroyed.
+      class arena final {
+      public:
+        arena(arena&& other) noexcept : state_{other.state_}, index_{other.index_} {
+          other.state_ = nullptr;
+        }
+        arena& operator=(arena&&) = delete;
+        ~arena() {
+          if (state_ != nullptr) {
+            state_->states[index_].owned.store(false, std::memory_order_release);
+          }
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto malloc(Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          reclaim();
+          auto base = base_offset(*state_, index_);
+          return local_heap().template malloc<T>(
+            [&](auto ref) { return callback(reference::rebase(ref, base)); }
+          , [&](std::error_code e) { return callback(e); }
+          );
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto malloc_range(Offset count, Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          reclaim();
+          auto base = base_offset(*state_, index_);
+          return local_heap().template malloc_range<T>(
+            count
+          , [&](auto ref) { return callback(reference::rebase(ref, base)); }
+          , [&](std::error_code e) { return callback(e); }
+          );
+        }
+
+        template <typename T, bool Unused>
+        void free(generic_reference<T, Unused> ref) noexcept {
+          auto offset = static_cast<Offset>(ref);
+          auto owner = owner_of(*state_, offset);
+          if (owner == index_) {
+            local_heap().free_offset(detail::narrow_cast<Offset>(offset - base_offset(*state_, owner)));
+          } else {
+            defer_free(*state_, owner, offset);
+          }
+        }
+
+        std::size_t index() const noexcept { return index_; }
+
+      private:
+        arena(shared_state& state, std::size_t index) : state_{&state}, index_{index} {}
+
+        heap_type& local_heap() { return state_->arenas[index_]; }
+
+        void reclaim() {
+          auto& deferred = state_->states[index_].deferred_frees;
+          if (deferred.load(std::memory_order_relaxed) != 0) {
+            release_deferred(*state_, index_);
+          }
+        }
+
+        shared_state* state_;
+        std::size_t index_;
+
+        friend class concurrent_heap;
+      };
+
+      concurrent_heap(concurrent_heap&&) = default;
+      concurrent_heap& operator=(concurrent_heap&&) = default;
+
+      // Size is either in bytes or bits depending on AssumeSameSizedByte
+      template <typename ...Callbacks>
+      static auto create(
+        unsigned char* buffer, std::size_t size, std::size_t arena_count, Callbacks... callbacks
+      ) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto bytes = size / byte_multiplier;
+        if ((reinterpret_cast<std::uintptr_t>(buffer) & (alignment - 1)) != 0) {
+          return callback(make_error_code(error::heap_not_aligned));
+        } else if (arena_count == 0 || bytes < table_size) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        auto arena_bytes = detail::align_backward((bytes - table_size) / arena_count, alignment);
+        if (std::numeric_limits<Offset>::max() / byte_multiplier < table_size + arena_bytes * arena_count) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        auto& table = reinterpret_cast<arena_table_t&>(*buffer);
+        new (&table) arena_table_t{};
+        table[arena_table::arena_count] = detail::narrow_cast<Offset>(arena_count);
+        table[arena_table::arena_size] = detail::narrow_cast<Offset>(arena_bytes);
+        return open(true, buffer, arena_count, arena_bytes, callback);
+      }
+
+      template <typename ...Callbacks>
+      static auto load(unsigned char* buffer, std::size_t size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto bytes = size / byte_multiplier;
+        if (bytes < table_size) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        auto& table = reinterpret_cast<arena_table_t const&>(*buffer);
+        std::size_t arena_count = table[arena_table::arena_count];
+        std::size_t arena_bytes = table[arena_table::arena_size];
+        if (arena_count == 0 || (bytes - table_size) / arena_count < arena_bytes) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        return open(false, buffer, arena_count, arena_bytes, callback);
+      }
+
+      // Claims an unowned arena for the calling thread
+      template <typename ...Callbacks>
+      auto acquire(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto count = state_->arenas.size();
+        for (std::size_t i = 0; i < count; ++i) {
+          auto& owned = state_->states[i].owned;
+          bool expected = false;
+          if (!owned.load(std::memory_order_relaxed)
+              && owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return callback(arena{*state_, i});
+          }
+        }
+        return callback(make_error_code(error::arena_unavailable));
+      }
+
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused> const& ref) const noexcept {
+        auto offset = static_cast<Offset>(ref);
+        return ref.deref(state_->buffer[offset]);
+      }
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
+        auto offset = static_cast<Offset>(ref);
+        return ref.deref(state_->buffer[offset]);
+      }
+
+      // Lock-free, and callable from any thread. The block is released by its
+      // arena's owner (or by flush).
+      template <typename T, bool Unused>
+      void free(generic_reference<T, Unused> ref) noexcept {
+        auto offset = static_cast<Offset>(ref);
+        defer_free(*state_, owner_of(*state_, offset), offset);
+      }
+
+      // Releases every deferred free. No arena may be in use by another thread.
+      void flush() {
+        for (std::size_t i = 0; i < state_->arenas.size(); ++i) {
+          release_deferred(*state_, i);
+        }
+      }
+
+      std::size_t arena_count() const noexcept { return state_->arenas.size(); }
+
+      // Direct access to an arena's heap (e.g., for each_block). Not
+      // synchronized with the arena's owner.
+      heap_type const& arena_heap(std::size_t index) const { return state_->arenas[index]; }
+
+      // The offset of an arena's heap within the buffer
+      Offset arena_offset(std::size_t index) const { return base_offset(*state_, index); }
+
+    private:
+      template <typename Callback>
+      static auto open(
+        bool do_init, unsigned char* buffer, std::size_t arena_count, std::size_t arena_bytes
+      , Callback& callback
+      ) -> decltype(callback(std::declval<concurrent_heap>())) {
+        auto state = std::unique_ptr<shared_state>{new shared_state{
+          buffer, arena_bytes, {}, arena_states(arena_count)
+        }};
+        state->arenas.reserve(arena_count);
+        for (std::size_t i = 0; i < arena_count; ++i) {
+          std::error_code error;
+          auto on_heap = [&](heap_type h) { state->arenas.push_back(h); };
+          auto on_error = [&](std::error_code e) { error = e; };
+          auto arena_buffer = buffer + table_size + i * arena_bytes;
+          auto arena_size = arena_bytes * byte_multiplier;
+          if (do_init) {
+            heap_type::create(arena_buffer, arena_size, on_heap, on_error);
+          } else {
+            heap_type::load(arena_buffer, arena_size, on_heap, on_error);
+          }
+          if (error) return callback(error);
+        }
+        return callback(concurrent_heap{std::move(state)});
+      }
+
+      static Offset base_offset(shared_state const& state, std::size_t index) {
+        return detail::narrow_cast<Offset>(
+          byte_multiplier * (table_size + index * state.arena_bytes)
+        );
+      }
+
+      static std::size_t owner_of(shared_state const& state, Offset offset) {
+        auto index = (offset / byte_multiplier - table_size) / state.arena_bytes;
+        assert(index < state.arenas.size());
+        return index;
+      }
+
+      // Treiber stack linked through the blocks' unused free list fields.
+      // Links are arena-relative offsets, and 0 ends the stack.
+      static void defer_free(shared_state& state, std::size_t index, Offset offset) {
+        auto local = detail::narrow_cast<Offset>(offset - base_offset(state, index));
+        auto& arena_heap = state.arenas[index];
+        auto& head = state.states[index].deferred_frees;
+        auto next = head.load(std::memory_order_relaxed);
+        do {
+          arena_heap.set_deferred_link(local, next);
+        } while (!head.compare_exchange_weak(
+          next, local, std::memory_order_release, std::memory_order_relaxed
+        ));
+      }
+
+      static void release_deferred(shared_state& state, std::size_t index) {
+        auto& arena_heap = state.arenas[index];
+        auto local = state.states[index].deferred_frees.exchange(0, std::memory_order_acquire);
+        while (local != 0) {
+          auto next = arena_heap.deferred_link(local);
+          arena_heap.free_offset(local);
+          local = next;
+        }
+      }
+
+      explicit concurrent_heap(std::unique_ptr<shared_state> state) : state_{std::move(state)} {}
+
+      std::unique_ptr<shared_state> state_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using concurrent_heap32 = detail::concurrent_heap<uint32_t, uint32_t, true>;
+#endif
+#ifdef UINT64_MAX
+  using concurrent_heap64 = detail::concurrent_heap<uint64_t, uint64_t, true>;
+#endif
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef UUID_3613A4FA_40B9_46EE_B751_935B943CE06C
+#define UUID_3613A4FA_40B9_46EE_B751_935B943CE06C
+
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/size_class.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/heap.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace nocopy {
+  // Records which pages of a buffer have been written since it was last
+  // cleared. The heap marks pages from noexcept paths such as free, so mark
+  // never allocates. Call reserve with the buffer's size before attaching the
+  // tracker, and again before the heap grows. Writes past the reserved size
+  // are not lost: everything from that size on is then reported as dirty.
+  class dirty_tracker final {
+  public:
+    // page_size must be a power of two
+    explicit dirty_tracker(std::size_t page_size = 512)
+      : page_log2_{detail::highest_set_bit(page_size)} {
+      assert(page_size != 0 && (page_size & (page_size - 1)) == 0);
+    }
+
+    // Sizes the bitmap for a buffer of size bytes
+    void reserve(std::size_t size) {
+      if (size == 0) return;
+      auto words = ((size - 1) >> page_log2_) / word_bits + 1;
+      if (words_.size() < words) words_.resize(words, 0);
+    }
+
+    void mark(std::size_t offset, std::size_t length) noexcept {
+      if (length == 0) return;
+      auto first = offset >> page_log2_;
+      auto last = (offset + length - 1) >> page_log2_;
+      auto pages = words_.size() * word_bits;
+      if (pages <= last) {
+        overflowed_ = true;
+        if (pages <= first) return;
+        last = pages - 1;
+      }
+      for (auto word = first / word_bits; word <= last / word_bits; ++word) {
+        auto low = word == first / word_bits ? first % word_bits : 0;
+        auto high = word == last / word_bits ? last % word_bits : word_bits - 1;
+        auto mask = ~word_t{0} >> (word_bits - 1 - high + low) << low;
+        words_[word] |= mask;
+      }
+    }
+
+    void clear() noexcept {
+      std::fill(words_.begin(), words_.end(), word_t{0});
+      overflowed_ = false;
+    }
+
+    bool empty() const noexcept {
+      return !overflowed_
+        && std::all_of(words_.begin(), words_.end(), [](word_t w) { return w == 0; });
+    }
+
+    std::size_t page_size() const noexcept { return std::size_t{1} << page_log2_; }
+
+    // Calls callback(offset, length) for each maximal run of dirty pages.
+    // After a write past the reserved size, the last run extends to the end
+    // of the address space.
+    template <typename Callback>
+    void each_run(Callback&& callback) const {
+      std::size_t run_start = 0;
+      bool in_run = false;
+      for (std::size_t word = 0; word < words_.size(); ++word) {
+        auto bits = words_[word];
+        // Skip whole words that continue the current state
+        if (bits == (in_run ? ~word_t{0} : word_t{0})) continue;
+        for (std::size_t bit = 0; bit < word_bits; ++bit) {
+          bool dirty = (bits >> bit) & 1;
+          if (dirty == in_run) continue;
+          auto page = word * word_bits + bit;
+          if (dirty) {
+            run_start = page;
+          } else {
+            callback(run_start << page_log2_, (page - run_start) << page_log2_);
+          }
+          in_run = dirty;
+        }
+      }
+      auto end = words_.size() * word_bits;
+      if (overflowed_) {
+        if (!in_run) run_start = end;
+        auto start = run_start << page_log2_;
+        callback(start, std::numeric_limits<std::size_t>::max() - start);
+      } else if (in_run) {
+        callback(run_start << page_log2_, (end - run_start) << page_log2_);
+      }
+    }
+
+  private:
+    using word_t = std::uint64_t;
+    static constexpr std::size_t word_bits = 64;
+
+    std::size_t page_log2_;
+    std::vector<word_t> words_;
+    bool overflowed_ = false;
+  };
+
+  namespace detail {
+    // A heap observer that marks written ranges in a dirty_tracker (if one
+    // has been set)
+    struct dirty_observer {
+      void on_write(std::size_t offset, std::size_t length) noexcept {
+        if (tracker != nullptr) tracker->mark(offset, length);
+      }
+      void on_malloc(std::size_t, std::size_t) noexcept {}
+      void on_free(std::size_t) noexcept {}
+
+      dirty_tracker* tracker = nullptr;
+    };
+
+    struct delta_run {
+      NOCOPY_FIELD(offset, uint64_t);
+      NOCOPY_FIELD(length, uint64_t);
+      using type = structpack<offset_t, length_t>;
+    };
+    using delta_run_t = typename delta_run::type;
+  }
+
+  // Heaps that report their writes to a dirty_tracker. Reserve the tracker
+  // for the heap's size, then attach it with heap.observer().tracker =
+  // &tracker. Writes made through the result of a
+  // deref are only seen when the deref happens after the last export, so
+  // deref again rather than holding on to the result across exports.
+#ifdef UINT32_MAX
+  using tracked_heap32 = detail::heap<uint32_t, uint32_t, true, detail::dirty_observer>;
+#endif
+#ifdef UINT64_MAX
+  using tracked_heap64 = detail::heap<uint64_t, uint64_t, true, detail::dirty_observer>;
+#endif
+
+  // Appends the dirty ranges of buffer (size bytes) to delta as a sequence of
+  // (offset, length) headers each followed by its bytes, and clears tracker
+  inline void export_delta(
+    unsigned char const* buffer, std::size_t size, dirty_tracker& tracker
+  , std::vector<unsigned char>& delta
+  ) {
+    tracker.each_run([&](std::size_t offset, std::size_t length) {
+      if (size <= offset) return;
+      length = std::min(length, size - offset);
+      auto position = delta.size();
+      delta.resize(position + sizeof(detail::delta_run_t) + length);
+      detail::delta_run_t run{};
+      run[detail::delta_run::offset] = offset;
+      run[detail::delta_run::length] = length;
+      std::memcpy(&delta[position], &run, sizeof(run));
+      std::memcpy(&delta[position + sizeof(detail::delta_run_t)], buffer + offset, length);
+    });
+    tracker.clear();
+  }
+
+  // Copies each run of a delta into buffer (size bytes). The delta is checked
+  // in full before anything is written, so a malformed delta leaves buffer
+  // untouched.
+  template <typename ...Callbacks>
+  auto apply_delta(
+    unsigned char* buffer, std::size_t size
+  , unsigned char const* delta, std::size_t delta_size
+  , Callbacks... callbacks
+  ) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    auto each_run = [&](auto&& on_run) {
+      std::size_t position = 0;
+      while (position < delta_size) {
+        if (delta_size - position < sizeof(detail::delta_run_t)) return false;
+        alignas(detail::delta_run_t) unsigned char raw[sizeof(detail::delta_run_t)];
+        std::memcpy(raw, delta + position, sizeof(raw));
+        auto& run = reinterpret_cast<detail::delta_run_t const&>(raw);
+        uint64_t offset = run[detail::delta_run::offset];
+        uint64_t length = run[detail::delta_run::length];
+        position += sizeof(detail::delta_run_t);
+        if (offset > size || length > size - offset || length > delta_size - position) {
+          return false;
+        }
+        on_run(static_cast<std::size_t>(offset), delta + position, static_cast<std::size_t>(length));
+        position += static_cast<std::size_t>(length);
+      }
+      return true;
+    };
+    if (!each_run([](std::size_t, unsigned char const*, std::size_t) {})) {
+      return callback(make_error_code(error::bad_delta));
+    }
+    each_run([buffer](std::size_t offset, unsigned char const* bytes, std::size_t length) {
+      std::memcpy(buffer + offset, bytes, length);
+    });
+    return callback();
+  }
+}
+
+#endif
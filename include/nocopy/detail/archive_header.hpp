@@ -0,0 +1,25 @@
+#ifndef UUID_D22F79D5_8C87_4F58_8192_5D56250002B3
+#define UUID_D22F79D5_8C87_4F58_8192_5D56250002B3
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <cstdint>
+
+namespace nocopy { namespace detail {
+  // The start of an archive image. The data ([0, cursor)) follows at size,
+  // and archive offsets are relative to it. There is no magic number or
+  // version, since a fixed archive's cursor is its header.
+  template <typename Offset>
+  struct archive_header {
+    NOCOPY_FIELD(cursor, Offset);
+    using type = structpack<cursor_t>;
+
+    // No supported type needs more than this
+    static constexpr std::size_t max_alignment = sizeof(uint64_t);
+    static constexpr std::size_t size = detail::align_to(sizeof(type), max_alignment);
+  };
+}}
+
+#endif
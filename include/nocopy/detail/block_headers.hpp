@@ -0,0 +1,15 @@
+#ifndef UUID_3DEFFAC5_1B44_487A_9409_5CC1487397A8
+#define UUID_3DEFFAC5_1B44_487A_9409_5CC1487397A8
+
+#include <nocopy/fwd/heap.hpp>
+
+namespace nocopy { namespace detail {
+  // Heap block header layouts. Full headers hold the free list links, so
+  // every block pays for them. Compact headers hold only the block's size and
+  // the offset of the block before it, and free blocks keep their links in
+  // their payload instead, so no block is smaller than two offsets.
+  struct full_block_headers {};
+  struct compact_block_headers {};
+}}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef UUID_5F2A9C47_E0B8_4D13_96A1_B7C3E8D2F064
+#define UUID_5F2A9C47_E0B8_4D13_96A1_B7C3E8D2F064
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace nocopy { namespace detail {
+  // CRC-32C (Castagnoli), computed a byte at a time from a table
+  class crc32c final {
+    using table_type = std::array<uint32_t, 256>;
+
+    static table_type make_table() noexcept {
+      table_type table;
+      for (uint32_t i = 0; i < table.size(); ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+          crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        table[i] = crc;
+      }
+      return table;
+    }
+
+  public:
+    static uint32_t compute(unsigned char const* bytes, std::size_t length) noexcept {
+      static table_type const table = make_table();
+      uint32_t crc = ~uint32_t{0};
+      for (std::size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+      }
+      return ~crc;
+    }
+  };
+}}
+
+#endif
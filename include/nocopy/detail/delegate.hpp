@@ -1,6 +1,8 @@
 #ifndef UUID_A6E51180_138B_4B44_9FC7_C8BDD9F96A93
 #define UUID_A6E51180_138B_4B44_9FC7_C8BDD9F96A93
 
+#include <type_traits>
+
 namespace nocopy { namespace detail {
   template <typename T>
   struct check_exists { using type = void; };
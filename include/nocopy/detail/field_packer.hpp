@@ -15,6 +15,8 @@ BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
 #include <boost/hana/zip_shortest.hpp>
 END_IGNORE_WARNINGS_FROM_DEPENDENCIES
 
+#include <limits>
+
 namespace nocopy { namespace detail {
   namespace hana = boost::hana;
 
@@ -0,0 +1,221 @@
+#ifndef UUID_475F5285_FA5D_4C5B_AFBF_8AE0CC423D2A
+#define UUID_475F5285_FA5D_4C5B_AFBF_8AE0CC423D2A
+
+#include <nocopy/detail/delegate.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/fwd/oneof.hpp>
+#include <nocopy/fwd/structpack.hpp>
+
+#include <array>
+#include <cstddef>
+#include <system_error>
+#include <type_traits>
+
+namespace nocopy { namespace detail {
+  // How a walk treats a value, by its type (as returned by a field accessor)
+  enum class walk_kind { leaf, reference, structpack, oneof, array, delegate };
+
+  template <typename T, typename = void>
+  struct is_reference_type : std::false_type {};
+  template <typename T>
+  struct is_reference_type<T, typename check_exists<typename T::target_type>::type> : std::true_type {};
+
+  template <typename T, typename = void>
+  struct has_delegate : std::false_type {};
+  template <typename T>
+  struct has_delegate<T, typename check_exists<typename T::delegate_type>::type> : std::true_type {};
+
+  template <typename T>
+  struct is_std_array : std::false_type {};
+  template <typename T, std::size_t N>
+  struct is_std_array<std::array<T, N>> : std::true_type {};
+
+  template <typename T>
+  constexpr walk_kind kind_of() {
+    return is_reference_type<T>::value ? walk_kind::reference
+      : is_structpack<T>::value ? walk_kind::structpack
+      : is_oneof<T>::value ? walk_kind::oneof
+      : is_std_array<T>::value ? walk_kind::array
+      : has_delegate<T>::value ? walk_kind::delegate
+      : walk_kind::leaf;
+  }
+
+  template <typename T, walk_kind Kind = kind_of<T>()>
+  struct needs_walk;
+
+  template <typename ...Ts>
+  constexpr bool any_needs_walk() {
+    bool result = false;
+    using expand_type = bool[];
+    (void)expand_type{false, (result = result || needs_walk<Ts>::value)...};
+    return result;
+  }
+
+  // Whether a value of type T may hold references or oneof tags, so that a
+  // walk has to look inside it. Ranges of other types are skipped entirely.
+  template <typename T>
+  struct needs_walk<T, walk_kind::leaf> : std::false_type {};
+  template <typename T>
+  struct needs_walk<T, walk_kind::reference> : std::true_type {};
+  template <typename T>
+  struct needs_walk<T, walk_kind::oneof> : std::true_type {};
+  template <typename ...Fields>
+  struct needs_walk<structpack<Fields...>, walk_kind::structpack>
+    : std::integral_constant<bool, any_needs_walk<typename field_traits<Fields>::return_type...>()> {};
+  template <typename T, std::size_t N>
+  struct needs_walk<std::array<T, N>, walk_kind::array> : needs_walk<T> {};
+  template <typename T>
+  struct needs_walk<T, walk_kind::delegate> : needs_walk<typename T::delegate_type> {};
+
+  // Walks the graph of values reachable from a reference into an archive's
+  // data ([0, cursor)), following references depth first. Every reference is
+  // checked (bounds and alignment) before it is followed, and every oneof tag
+  // before it is dispatched on, so the data may be untrusted. A non-empty
+  // range of char const must also end with a terminator, as a string does.
+  // Nesting is bounded by max_depth. Nothing is allocated.
+  //
+  // Ranges are not marked as visited, so a range reached along several paths
+  // is walked once per path. To keep the work linear in the size of the data,
+  // the bytes of every range walked into are charged against a budget of
+  // cursor bytes, which a graph without shared ranges never exceeds. Running
+  // out fails the walk with error::graph_too_large.
+  //
+  // visitor.on_reference(ref) is called for each reference found inside the
+  // data (not for the root), before it is followed. It returns a
+  // std::error_code, and an error stops the walk.
+  template <typename Offset, typename Visitor>
+  class graph_walker final {
+    using reference = detail::reference<Offset>;
+
+  public:
+    graph_walker(unsigned char const* data, Offset cursor, std::size_t max_depth, Visitor& visitor) noexcept
+      : data_{data}, cursor_{cursor}, max_depth_{max_depth}, budget_{cursor}, visitor_{visitor} {}
+
+    template <typename Ref>
+    std::error_code walk_root(Ref const& ref) {
+      return follow(ref, 0);
+    }
+
+    // Whether ref is aligned for its type and lies within [0, cursor)
+    template <typename Ref>
+    bool contains(Ref const& ref) const noexcept {
+      using T = typename Ref::target_type;
+      Offset offset = static_cast<Offset>(ref);
+      std::size_t count = count_of(ref);
+      return offset % detail::alignment_for<T>() == 0
+        && offset <= cursor_
+        && count <= (cursor_ - offset) / sizeof(T);
+    }
+
+  private:
+    template <typename Ref>
+    static Offset count_of(Ref const& ref) noexcept {
+      return count_helper(ref, std::integral_constant<bool, Ref::single>{});
+    }
+    template <typename Ref>
+    static Offset count_helper(Ref const&, std::true_type) noexcept { return 1; }
+    template <typename Ref>
+    static Offset count_helper(Ref const& ref, std::false_type) noexcept {
+      return ref[reference::count_field];
+    }
+
+    template <typename Ref>
+    std::error_code follow(Ref const& ref, std::size_t depth) {
+      using T = typename Ref::target_type;
+      if (!contains(ref) || !terminated(ref, std::is_same<T, char const>{})) {
+        return make_error_code(error::bad_reference);
+      }
+      if (!needs_walk<std::remove_const_t<T>>::value) return {};
+      if (depth == max_depth_) return make_error_code(error::graph_too_deep);
+      auto count = count_of(ref);
+      // contains has checked that count * sizeof(T) is within the cursor
+      auto bytes = static_cast<Offset>(count * sizeof(T));
+      if (bytes > budget_) return make_error_code(error::graph_too_large);
+      budget_ -= bytes;
+      auto target = reinterpret_cast<std::remove_const_t<T> const*>(data_ + static_cast<Offset>(ref));
+      for (Offset i = 0; i < count; ++i) {
+        if (auto e = walk(target[i], depth + 1)) return e;
+      }
+      return {};
+    }
+
+    template <typename Ref>
+    static bool terminated(Ref const&, std::false_type) noexcept { return true; }
+    template <typename Ref>
+    bool terminated(Ref const& ref, std::true_type) const noexcept {
+      auto count = count_of(ref);
+      return count == 0 || data_[static_cast<Offset>(ref) + count - 1] == '\0';
+    }
+
+    template <typename T>
+    std::error_code walk(T const& value, std::size_t depth) {
+      return walk_helper(value, depth, std::integral_constant<walk_kind, kind_of<T>()>{});
+    }
+
+    template <typename T>
+    std::error_code walk_helper(T const&, std::size_t, std::integral_constant<walk_kind, walk_kind::leaf>) {
+      return {};
+    }
+
+    template <typename T>
+    std::error_code walk_helper(
+      T const& ref, std::size_t depth, std::integral_constant<walk_kind, walk_kind::reference>
+    ) {
+      if (auto e = visitor_.on_reference(ref)) return e;
+      return follow(ref, depth);
+    }
+
+    template <typename ...Fields>
+    std::error_code walk_helper(
+      structpack<Fields...> const& s, std::size_t depth
+    , std::integral_constant<walk_kind, walk_kind::structpack>
+    ) {
+      std::error_code result;
+      using expand_type = int[];
+      (void)expand_type{0, (result = result ? result : walk_field(s[Fields{}], depth), 0)...};
+      return result;
+    }
+
+    template <typename T>
+    std::error_code walk_field(T const& value, std::size_t depth) {
+      if (!needs_walk<T>::value) return {};
+      return walk(value, depth);
+    }
+
+    template <typename T>
+    std::error_code walk_helper(
+      T const& o, std::size_t depth, std::integral_constant<walk_kind, walk_kind::oneof>
+    ) {
+      if (o.index() >= T::type_count()) return make_error_code(error::bad_oneof_tag);
+      return o.visit([&](auto, auto const& payload) { return this->walk_field(payload, depth); });
+    }
+
+    template <typename T>
+    std::error_code walk_helper(
+      T const& elements, std::size_t depth, std::integral_constant<walk_kind, walk_kind::array>
+    ) {
+      if (!needs_walk<T>::value) return {};
+      for (auto const& element : elements) {
+        if (auto e = walk(element, depth)) return e;
+      }
+      return {};
+    }
+
+    template <typename T>
+    std::error_code walk_helper(
+      T const& value, std::size_t depth, std::integral_constant<walk_kind, walk_kind::delegate>
+    ) {
+      return walk(reinterpret_cast<typename T::delegate_type const&>(value), depth);
+    }
+
+    unsigned char const* data_;
+    Offset cursor_;
+    std::size_t max_depth_;
+    Offset budget_;
+    Visitor& visitor_;
+  };
+}}
+
+#endif
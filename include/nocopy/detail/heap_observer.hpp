@@ -0,0 +1,22 @@
+#ifndef UUID_25B93DC1_6843_40A7_8400_3DDF4F4C8945
+#define UUID_25B93DC1_6843_40A7_8400_3DDF4F4C8945
+
+#include <nocopy/fwd/heap.hpp>
+
+#include <cstddef>
+
+namespace nocopy { namespace detail {
+  // The default heap observer, which ignores everything. An observer's
+  // on_write is passed the byte offset and length of each range of the buffer
+  // the heap writes to, including blocks handed out by a non-const deref.
+  // on_malloc is passed the byte offset and requested size of each
+  // allocation, and on_free the byte offset of each freed allocation. A block
+  // moved by compact is reported as a free followed by a malloc.
+  struct null_heap_observer {
+    void on_write(std::size_t, std::size_t) noexcept {}
+    void on_malloc(std::size_t, std::size_t) noexcept {}
+    void on_free(std::size_t) noexcept {}
+  };
+}}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef UUID_AA9FDD71_5F9D_4874_B5E2_888E951DB878
 #define UUID_AA9FDD71_5F9D_4874_B5E2_888E951DB878
 
+#include <utility>
+
 namespace nocopy { namespace detail {
   template <typename Lambda, typename ...Lambdas>
   struct lambda_overload : Lambda, lambda_overload<Lambdas...> {
@@ -46,6 +46,18 @@ namespace nocopy { namespace detail {
       return decltype(biggest)::type::alignment;
     }
 
+    struct size_ordering {
+      template <typename X, typename Y>
+      constexpr auto operator()(X, Y) const {
+        constexpr bool result = X::type::size < Y::type::size;
+        return hana::bool_c<result>;
+      }
+    };
+    static constexpr auto payload_size() {
+      constexpr auto biggest = hana::maximum(allowed_types(), size_ordering{});
+      return decltype(biggest)::type::size;
+    }
+
   public:
     template <typename T>
     static constexpr bool is_allowed() {
@@ -75,7 +87,7 @@ namespace nocopy { namespace detail {
     }
 
     static constexpr auto size() {
-      return align_to(payload_offset() + payload_alignment(), alignment());
+      return align_to(payload_offset() + payload_size(), alignment());
     }
   };
 }}
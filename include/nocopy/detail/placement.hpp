@@ -0,0 +1,18 @@
+#ifndef UUID_9ED7F283_3A4E_4A17_836F_2BB2998DB94E
+#define UUID_9ED7F283_3A4E_4A17_836F_2BB2998DB94E
+
+#include <nocopy/fwd/heap.hpp>
+
+namespace nocopy { namespace detail {
+  // Heap placement policies. Good fit takes the head of the first size class
+  // whose blocks all satisfy the request, so it rarely walks a list. First
+  // fit takes the lowest fitting address in the whole heap, comparing the
+  // first fitting block of every class that could hold the request. Each
+  // class's free list is kept in address order, which walks the list on every
+  // free. Best fit walks the request's class for the smallest fitting block.
+  struct good_fit {};
+  struct first_fit {};
+  struct best_fit {};
+}}
+
+#endif
@@ -2,10 +2,12 @@
 #define UUID_8C407DD4_C61B_497E_B9A4_26FB85D27BFC
 
 #include <nocopy/fwd/archive.hpp>
+#include <nocopy/fwd/concurrent_heap.hpp>
 #include <nocopy/fwd/heap.hpp>
 
 #include <nocopy/structpack.hpp>
 #include <nocopy/field.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
 
 #include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
 BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
@@ -13,6 +15,12 @@ BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
 END_IGNORE_WARNINGS_FROM_DEPENDENCIES
 
 namespace nocopy { namespace detail {
+  template <typename Offset, typename Visitor>
+  class graph_walker;
+
+  template <typename Offset>
+  class relocator;
+
   template <typename Offset>
   class reference {
     NOCOPY_FIELD(offset_field, Offset);
@@ -26,6 +34,9 @@ namespace nocopy { namespace detail {
       static void construct(reference_impl&) {}
       static void destruct(reference_impl&) {}
 
+      using target_type = T;
+      static constexpr bool single = true;
+
       using delegate_type = structpack<offset_field_t>;
       explicit operator Offset() const { return data[offset_field]; }
       constexpr T const& deref(unsigned char const& b) const {
@@ -49,6 +60,9 @@ namespace nocopy { namespace detail {
       static void construct(reference_impl&) {}
       static void destruct(reference_impl&) {}
 
+      using target_type = T;
+      static constexpr bool single = false;
+
       using delegate_type = structpack<offset_field_t, count_field_t>;
       explicit operator Offset() const { return data[offset_field]; }
       auto deref(unsigned char const& b) const {
@@ -96,10 +110,33 @@ namespace nocopy { namespace detail {
       return ref;
     }
 
-    template <typename, typename, bool>
+    // Offsets wrap, so passing the negated base converts back
+    template <typename T, bool is_single>
+    static generic<T, is_single> rebase(generic<T, is_single> ref, Offset base) {
+      ref[offset_field] = detail::narrow_cast<Offset>(static_cast<Offset>(ref) + base);
+      return ref;
+    }
+
+    template <typename, typename, bool, typename, typename, typename>
     friend class ::nocopy::detail::heap;
+    template <typename, typename, bool>
+    friend class ::nocopy::detail::concurrent_heap;
     template <typename O, O>
-    friend class ::nocopy::archive;
+    friend class ::nocopy::detail::archive;
+    template <typename, typename>
+    friend class ::nocopy::detail::growable_archive;
+    template <typename, typename>
+    friend class ::nocopy::detail::streaming_archive;
+    template <typename>
+    friend class ::nocopy::detail::archive_view;
+    template <typename>
+    friend class ::nocopy::detail::concurrent_archive;
+    template <typename>
+    friend class ::nocopy::detail::interner;
+    template <typename, typename>
+    friend class ::nocopy::detail::graph_walker;
+    template <typename>
+    friend class ::nocopy::detail::relocator;
   };
 }}
 
@@ -0,0 +1,90 @@
+#ifndef UUID_5B0E7C2A_9D41_4F3B_A6E8_1C72D4F90B36
+#define UUID_5B0E7C2A_9D41_4F3B_A6E8_1C72D4F90B36
+
+#include <nocopy/detail/narrow_cast.hpp>
+
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+
+namespace nocopy { namespace detail {
+  template <typename T>
+  inline std::size_t lowest_set_bit(T value) {
+    static_assert(std::is_unsigned<T>::value, "bit scans are for unsigned types");
+    static_assert(sizeof(T) <= sizeof(unsigned long long), "");
+    assert(value != 0);
+  #if defined(__GNUC__) || defined(__clang__)
+    return static_cast<std::size_t>(__builtin_ctzll(value));
+  #else
+    std::size_t result = 0;
+    while ((value & T{1}) == 0) { value >>= 1; ++result; }
+    return result;
+  #endif
+  }
+
+  template <typename T>
+  inline std::size_t highest_set_bit(T value) {
+    static_assert(std::is_unsigned<T>::value, "bit scans are for unsigned types");
+    static_assert(sizeof(T) <= sizeof(unsigned long long), "");
+    assert(value != 0);
+  #if defined(__GNUC__) || defined(__clang__)
+    constexpr std::size_t top = sizeof(unsigned long long) * CHAR_BIT - 1;
+    return top - static_cast<std::size_t>(__builtin_clzll(value));
+  #else
+    std::size_t result = 0;
+    while (value >>= 1) ++result;
+    return result;
+  #endif
+  }
+
+  // Returns the bits of value at or above position (0 if position is out of range)
+  template <typename T>
+  inline T bits_from(T value, std::size_t position) {
+    return position < sizeof(T) * CHAR_BIT ? detail::narrow_cast<T>(value & (~T{0} << position)) : T{0};
+  }
+
+  // Two-level segregated fit size classes (as in TLSF). Sizes are measured in
+  // granules. The first level splits sizes by powers of two, and the second
+  // level splits each power of two into SecondLevelCount linear classes.
+  // Granule counts below SecondLevelCount map directly onto the first class.
+  template <typename Offset, std::size_t SecondLevelLog2>
+  struct size_class {
+    static constexpr std::size_t second_level_log2 = SecondLevelLog2;
+    static constexpr std::size_t second_level_count = std::size_t{1} << SecondLevelLog2;
+
+    std::size_t first;
+    std::size_t second;
+
+    // The class in which a free block of this size is stored
+    static size_class for_block(Offset granules) {
+      if (granules < second_level_count) {
+        return {0, static_cast<std::size_t>(granules)};
+      }
+      auto msb = highest_set_bit(granules);
+      auto second = static_cast<std::size_t>(granules >> (msb - second_level_log2));
+      return {msb - second_level_log2 + 1, second - second_level_count};
+    }
+
+    // The smallest class whose blocks are all guaranteed to hold this size
+    static size_class for_request(Offset granules) {
+      if (granules >= second_level_count) {
+        auto msb = highest_set_bit(granules);
+        auto round = (Offset{1} << (msb - second_level_log2)) - 1;
+        if (std::numeric_limits<Offset>::max() - granules >= round) {
+          granules += round;
+        }
+      }
+      return for_block(granules);
+    }
+
+    // The number of first level classes required to index a heap that holds at
+    // most this many granules
+    static std::size_t first_level_count(Offset max_granules) {
+      return for_block(max_granules).first + 1;
+    }
+  };
+}}
+
+#endif
@@ -11,6 +11,7 @@
 #include <array>
 #include <climits>
 #include <cstdint>
+#include <limits>
 #include <type_traits>
 
 namespace nocopy {
@@ -1,11 +1,28 @@
 #ifndef UUID_3F2DD145_3BE0_4A6B_A997_2EE430E02B2F
 #define UUID_3F2DD145_3BE0_4A6B_A997_2EE430E02B2F
 
+#include <string>
+#include <system_error>
+
 namespace nocopy {
   enum class error {
     heap_not_aligned
   , bad_heap_size
   , out_of_space
+  , arena_unavailable
+  , bad_delta
+  , heap_layout_mismatch
+  , bad_trace
+  , archive_not_aligned
+  , bad_archive
+  , bad_reference
+  , bad_oneof_tag
+  , graph_too_deep
+  , bad_frame
+  , frame_checksum_mismatch
+  , graph_too_large
+  , heap_pinned
+  , aligned_block
   };
 
   class error_category : public std::error_category
@@ -25,6 +42,34 @@ namespace nocopy {
         return "Bad heap size";
       case error::out_of_space:
         return "Heap full";
+      case error::arena_unavailable:
+        return "No arena available";
+      case error::bad_delta:
+        return "Malformed delta";
+      case error::heap_layout_mismatch:
+        return "Heap layout mismatch";
+      case error::bad_trace:
+        return "Malformed trace";
+      case error::archive_not_aligned:
+        return "Archive not aligned";
+      case error::bad_archive:
+        return "Malformed archive";
+      case error::bad_reference:
+        return "Reference out of bounds";
+      case error::bad_oneof_tag:
+        return "Invalid oneof tag";
+      case error::graph_too_deep:
+        return "Reference graph too deep";
+      case error::bad_frame:
+        return "Malformed frame";
+      case error::frame_checksum_mismatch:
+        return "Frame checksum mismatch";
+      case error::graph_too_large:
+        return "Reference graph too large";
+      case error::heap_pinned:
+        return "Heap has blocks that cannot move";
+      case error::aligned_block:
+        return "Aligned block cannot move";
       }
     }
   #pragma GCC diagnostic pop
@@ -0,0 +1,55 @@
+#ifndef UUID_E35747C5_8AD0_4651_8129_96A32445E263
+#define UUID_E35747C5_8AD0_4651_8129_96A32445E263
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace nocopy {
+  // Streaming archive sink for a file descriptor (POSIX only). The image
+  // starts at the descriptor's offset when the sink is created, and the
+  // descriptor must be seekable so that the header can be patched. The sink
+  // does not own the descriptor.
+  class fd_sink final {
+  public:
+    explicit fd_sink(int fd) noexcept : fd_{fd}, start_{::lseek(fd, 0, SEEK_CUR)} {}
+
+    std::error_code write(unsigned char const* bytes, std::size_t length) noexcept {
+      while (length != 0) {
+        auto written = ::write(fd_, bytes, length);
+        if (written < 0) {
+          if (errno == EINTR) continue;
+          return {errno, std::system_category()};
+        }
+        bytes += written;
+        length -= static_cast<std::size_t>(written);
+      }
+      return {};
+    }
+
+    std::error_code patch(std::size_t offset, unsigned char const* bytes, std::size_t length) noexcept {
+      if (start_ < 0) return {ESPIPE, std::system_category()};
+      auto position = start_ + static_cast<off_t>(offset);
+      while (length != 0) {
+        auto written = ::pwrite(fd_, bytes, length, position);
+        if (written < 0) {
+          if (errno == EINTR) continue;
+          return {errno, std::system_category()};
+        }
+        bytes += written;
+        position += written;
+        length -= static_cast<std::size_t>(written);
+      }
+      return {};
+    }
+
+  private:
+    int fd_;
+    off_t start_;
+  };
+}
+
+#endif
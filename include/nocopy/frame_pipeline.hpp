@@ -0,0 +1,271 @@
+#ifndef UUID_E1B57D2C_8F36_4A0B_9C74_3D6A0F8E25B1
+#define UUID_E1B57D2C_8F36_4A0B_9C74_3D6A0F8E25B1
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/framing.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace nocopy {
+  struct pipeline_options {
+    // Bytes per read-ahead buffer (rounded up to frame_alignment). Frames
+    // larger than this are rejected.
+    std::size_t buffer_size = std::size_t{1} << 20;
+    // Buffers in the ring, at least two. Reading stops while every buffer
+    // holds frames that have not been handled yet, which bounds memory use.
+    std::size_t buffer_count = 8;
+    // Threads checking frames and calling the handler
+    std::size_t workers = 1;
+    // Whether the handler is called for one frame at a time, in stream order.
+    // Workers still check frames in parallel, but take turns in the handler.
+    bool ordered = true;
+  };
+
+  namespace detail {
+    // The stages of read_frames. The calling thread reads ahead into a ring
+    // of aligned buffers, and publishes the complete frames after each read,
+    // so frames from a pipe or socket are handled as they arrive. Worker
+    // threads check and handle the frames. A frame that straddles buffers is
+    // copied to the start of the next one, so frames never leave the ring and
+    // every buffer starts at a frame (which keeps payloads aligned). A buffer
+    // returns to the ring once the reader is done with it and all of its
+    // frames have been handled.
+    class frame_pipeline final {
+      static constexpr auto none = std::numeric_limits<std::size_t>::max();
+
+      struct work_item {
+        std::size_t buffer;
+        std::size_t offset;
+        parsed_frame_header header;
+        uint64_t sequence;
+      };
+
+    public:
+      explicit frame_pipeline(pipeline_options const& options)
+        : buffer_size_{detail::align_to(options.buffer_size, frame_alignment)}
+        , worker_count_{options.workers}
+        , ordered_{options.ordered}
+        , buffers_(options.buffer_count, std::vector<uint64_t>(buffer_size_ / sizeof(uint64_t)))
+        , pending_(options.buffer_count, 0)
+        , carry_(buffer_size_ / sizeof(uint64_t)) {
+        for (std::size_t i = 0; i < buffers_.size(); ++i) free_.push_back(i);
+      }
+
+      template <typename Handler>
+      std::error_code run(int fd, Handler& handler) {
+        std::vector<std::thread> workers;
+        for (std::size_t i = 0; i < worker_count_; ++i) {
+          workers.emplace_back([&] { this->work(handler); });
+        }
+        read_all(fd);
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          done_reading_ = true;
+        }
+        work_ready_.notify_all();
+        for (auto& worker : workers) worker.join();
+        return error_;
+      }
+
+    private:
+      unsigned char* data(std::size_t buffer) noexcept {
+        return reinterpret_cast<unsigned char*>(buffers_[buffer].data());
+      }
+
+      void read_all(int fd) {
+        std::size_t carried = 0;
+        uint64_t sequence = 0;
+        std::vector<work_item> batch;
+        for (;;) {
+          auto buffer = acquire();
+          if (buffer == none) return;
+          auto bytes = data(buffer);
+          std::memcpy(bytes, carry_.data(), carried);
+          auto filled = carried;
+          std::size_t position = 0;
+          bool end_of_stream = false;
+          while (filled < buffer_size_) {
+            auto count = ::read(fd, bytes + filled, buffer_size_ - filled);
+            if (count < 0) {
+              if (errno == EINTR) continue;
+              fail({errno, std::system_category()});
+              return;
+            } else if (count == 0) {
+              end_of_stream = true;
+              break;
+            }
+            filled += static_cast<std::size_t>(count);
+
+            batch.clear();
+            while (filled - position >= frame_header_size) {
+              parsed_frame_header header;
+              if (auto e = parse_frame_header(bytes + position, buffer_size_ - frame_header_size, header)) {
+                fail(e);
+                return;
+              }
+              if (filled - position < header.total) break;
+              batch.push_back({buffer, position, header, sequence++});
+              position += header.total;
+            }
+            publish(batch);
+          }
+          carried = filled - position;
+          std::memcpy(carry_.data(), bytes + position, carried);
+          release(buffer);
+
+          if (end_of_stream) {
+            // A partial frame at the end means the stream was truncated
+            if (carried != 0) fail(make_error_code(error::bad_frame));
+            return;
+          }
+        }
+      }
+
+      // Takes a free buffer, which the reader holds until it releases it
+      std::size_t acquire() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        buffer_freed_.wait(lock, [&] { return !free_.empty() || stopped_; });
+        if (stopped_) return none;
+        auto buffer = free_.back();
+        free_.pop_back();
+        pending_[buffer] = 1;
+        return buffer;
+      }
+
+      void publish(std::vector<work_item> const& batch) {
+        if (batch.empty()) return;
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          pending_[batch.front().buffer] += batch.size();
+          queue_.insert(queue_.end(), batch.begin(), batch.end());
+        }
+        work_ready_.notify_all();
+      }
+
+      void release(std::size_t buffer) {
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          if (--pending_[buffer] != 0) return;
+          free_.push_back(buffer);
+        }
+        buffer_freed_.notify_one();
+      }
+
+      // Records the first error and stops every stage
+      void fail(std::error_code e) {
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          if (!error_) error_ = e;
+          stopped_ = true;
+        }
+        buffer_freed_.notify_all();
+        work_ready_.notify_all();
+        turn_.notify_all();
+      }
+
+      // In ordered mode, waits until every earlier frame has been handled
+      bool begin_turn(uint64_t sequence) {
+        std::unique_lock<std::mutex> lock{mutex_};
+        turn_.wait(lock, [&] { return next_sequence_ == sequence || stopped_; });
+        return !stopped_;
+      }
+
+      void end_turn() {
+        {
+          std::lock_guard<std::mutex> lock{mutex_};
+          ++next_sequence_;
+        }
+        turn_.notify_all();
+      }
+
+      template <typename Handler>
+      void work(Handler& handler) {
+        for (;;) {
+          work_item item;
+          {
+            std::unique_lock<std::mutex> lock{mutex_};
+            work_ready_.wait(lock, [&] { return !queue_.empty() || done_reading_ || stopped_; });
+            if (stopped_ || queue_.empty()) return;
+            item = queue_.front();
+            queue_.pop_front();
+          }
+          // Frames are taken in stream order, so by the time a worker waits
+          // for its turn, every earlier frame has been taken by a worker too
+          detail::open_frame(
+            data(item.buffer) + item.offset, item.header
+          , [&](frame const& f) {
+              if (!ordered_) {
+                handler(f, item.sequence);
+              } else if (begin_turn(item.sequence)) {
+                handler(f, item.sequence);
+                end_turn();
+              }
+            }
+          , [&](std::error_code e) { fail(e); }
+          );
+          release(item.buffer);
+        }
+      }
+
+      std::size_t buffer_size_;
+      std::size_t worker_count_;
+      bool ordered_;
+      std::vector<std::vector<uint64_t>> buffers_;
+      std::vector<std::size_t> pending_;
+      std::vector<uint64_t> carry_;
+
+      std::mutex mutex_;
+      std::condition_variable buffer_freed_;
+      std::condition_variable work_ready_;
+      std::condition_variable turn_;
+      std::vector<std::size_t> free_;
+      std::deque<work_item> queue_;
+      uint64_t next_sequence_ = 0;
+      bool done_reading_ = false;
+      bool stopped_ = false;
+      std::error_code error_;
+    };
+  }
+
+  // Reads a stream of frames from a file descriptor until it ends (POSIX
+  // only), calling handler(frame, sequence) for each one, where sequence is
+  // the frame's position in the stream. Reading runs ahead on the calling
+  // thread while workers check and handle frames, and frames are handled as
+  // soon as they have been read, so fd may be a pipe or a socket. Unless
+  // options.ordered is set, the handler is called from several threads at
+  // once, in any order.
+  // Payloads are aligned views of the read-ahead buffers, valid only during
+  // the call, so framed archives can be viewed in place.
+  //
+  // Calls callback() once the stream has been handled, or callback(error)
+  // when reading fails or a frame is malformed, in which case frames after
+  // the error may or may not have been handled.
+  template <typename Handler, typename ...Callbacks>
+  auto read_frames(int fd, pipeline_options const& options, Handler handler, Callbacks... callbacks) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    if (options.buffer_count < 2 || options.buffer_size < frame_header_size || options.workers == 0) {
+      return callback(std::make_error_code(std::errc::invalid_argument));
+    }
+    detail::frame_pipeline pipeline{options};
+    if (auto e = pipeline.run(fd, handler)) {
+      return callback(e);
+    }
+    return callback();
+  }
+}
+
+#endif
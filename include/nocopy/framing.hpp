@@ -0,0 +1,286 @@
+#ifndef UUID_A83D61F4_2E7B_4C59_B0D6_91F4C5E2A37B
+#define UUID_A83D61F4_2E7B_4C59_B0D6_91F4C5E2A37B
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/crc32c.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <vector>
+
+namespace nocopy {
+  namespace detail {
+    // Precedes each frame's payload. The payload is followed by zero padding
+    // up to frame_alignment, so frames (and payloads) that start aligned in a
+    // stream stay aligned.
+    struct frame_header {
+      NOCOPY_FIELD(magic, uint32_t);
+      NOCOPY_FIELD(length, uint32_t);
+      NOCOPY_FIELD(checksum, uint32_t);
+      NOCOPY_FIELD(schema_version, uint16_t);
+      NOCOPY_FIELD(flags, uint16_t);
+      using type = structpack<magic_t, length_t, checksum_t, schema_version_t, flags_t>;
+
+      static constexpr uint32_t magic_value = 0x5246434E; // "NCFR"
+      static constexpr uint16_t has_checksum = 1;
+    };
+
+    struct parsed_frame_header {
+      std::size_t length;
+      std::size_t total;
+      uint32_t checksum;
+      uint16_t schema_version;
+      bool has_checksum;
+    };
+  }
+
+  constexpr std::size_t frame_header_size = sizeof(detail::frame_header::type);
+  // The longest payload a frame_decoder accepts unless it is given a limit
+  constexpr std::size_t default_max_frame_length = std::size_t{1} << 20;
+  constexpr std::size_t frame_alignment = sizeof(uint64_t);
+  static_assert(frame_header_size % frame_alignment == 0, "frame payloads must stay aligned");
+
+  struct frame_options {
+    uint16_t schema_version;
+    bool checksum;
+  };
+
+  // A complete frame, as passed to a frame_decoder's callback
+  struct frame {
+    uint16_t schema_version;
+    gsl::span<unsigned char const> payload;
+  };
+
+  // The number of bytes a payload takes up once framed
+  inline std::size_t framed_size(std::size_t payload_length) noexcept {
+    return frame_header_size + detail::align_to(payload_length, frame_alignment);
+  }
+
+  // The padding to write after a payload
+  inline gsl::span<unsigned char const> frame_padding(std::size_t payload_length) noexcept {
+    static unsigned char const zeros[frame_alignment] = {};
+    using index_type = gsl::span<unsigned char const>::index_type;
+    auto padding = detail::align_to(payload_length, frame_alignment) - payload_length;
+    return {zeros, static_cast<index_type>(padding)};
+  }
+
+  namespace detail {
+    // Reads a frame header from possibly unaligned bytes
+    inline std::error_code parse_frame_header(
+      unsigned char const* bytes, std::size_t max_length, parsed_frame_header& result
+    ) noexcept {
+      using header = frame_header;
+      alignas(header::type) unsigned char raw[sizeof(header::type)];
+      std::memcpy(raw, bytes, sizeof(raw));
+      auto& h = reinterpret_cast<header::type const&>(raw);
+      uint16_t flags = h[header::flags];
+      result.length = h[header::length];
+      if (h[header::magic] != header::magic_value
+          || (flags & ~header::has_checksum) != 0
+          || result.length > max_length) {
+        return make_error_code(error::bad_frame);
+      }
+      result.total = framed_size(result.length);
+      result.checksum = h[header::checksum];
+      result.schema_version = h[header::schema_version];
+      result.has_checksum = (flags & header::has_checksum) != 0;
+      return {};
+    }
+
+    // Checks the payload of a complete frame starting at start, and passes
+    // the frame to the callback
+    template <typename ...Callbacks>
+    auto open_frame(unsigned char const* start, parsed_frame_header const& h, Callbacks... callbacks) {
+      auto callback = detail::make_overload(std::move(callbacks)...);
+      auto payload = start + frame_header_size;
+      if (h.has_checksum && detail::crc32c::compute(payload, h.length) != h.checksum) {
+        return callback(make_error_code(error::frame_checksum_mismatch));
+      }
+      using index_type = gsl::span<unsigned char const>::index_type;
+      return callback(frame{h.schema_version, {payload, static_cast<index_type>(h.length)}});
+    }
+  }
+
+  // Writes the header for payload to out, which must hold frame_header_size
+  // bytes. To frame without copying, write the header, the payload and
+  // frame_padding(payload length) with a gather write.
+  template <typename ...Callbacks>
+  auto write_frame_header(
+    unsigned char* out, gsl::span<unsigned char const> payload, frame_options options
+  , Callbacks... callbacks
+  ) {
+    using header = detail::frame_header;
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    auto length = static_cast<std::size_t>(payload.size());
+    if (length > std::numeric_limits<uint32_t>::max()) {
+      return callback(make_error_code(error::bad_frame));
+    }
+    alignas(header::type) unsigned char raw[sizeof(header::type)];
+    auto& h = *new (raw) header::type{};
+    h[header::magic] = header::magic_value;
+    h[header::length] = detail::narrow_cast<uint32_t>(length);
+    h[header::schema_version] = options.schema_version;
+    if (options.checksum) {
+      h[header::flags] = header::has_checksum;
+      h[header::checksum] = detail::crc32c::compute(payload.data(), length);
+    }
+    std::memcpy(out, raw, sizeof(raw));
+    return callback();
+  }
+
+  // Frames a copy of payload into out, passing the number of bytes written
+  // (framed_size of the payload's length) to the callback
+  template <typename ...Callbacks>
+  auto encode_frame(
+    gsl::span<unsigned char const> payload, frame_options options, unsigned char* out, std::size_t size
+  , Callbacks... callbacks
+  ) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    auto length = static_cast<std::size_t>(payload.size());
+    auto total = framed_size(length);
+    if (size < total) {
+      return callback(make_error_code(error::out_of_space));
+    }
+    return write_frame_header(
+      out, payload, options
+    , [&]() {
+        std::memcpy(out + frame_header_size, payload.data(), length);
+        auto padding = frame_padding(length);
+        std::memcpy(out + frame_header_size + length, padding.data(), static_cast<std::size_t>(padding.size()));
+        return callback(total);
+      }
+    , [&callback](std::error_code e) { return callback(e); }
+    );
+  }
+
+  // Splits a byte stream into frames. Chunks of the stream are passed to
+  // feed in order, in whatever sizes they arrive, and the callback is called
+  // with each complete frame. A frame that lies within one chunk is passed
+  // as a view of that chunk, valid only during the callback. Only a frame
+  // that straddles chunks is copied, into a buffer that is reused (so once it
+  // has grown to the largest frame, decoding does not allocate). That buffer
+  // grows only as a frame's bytes arrive, so a forged header costs nothing
+  // until its payload is actually sent.
+  //
+  // Payloads are aligned to frame_alignment when every chunk is aligned and
+  // starts at a multiple of frame_alignment in the stream (which holds when
+  // chunks are read into aligned buffers in multiples of frame_alignment).
+  //
+  // After a malformed frame, which includes a frame longer than max_length
+  // (default_max_frame_length, 1 MiB, unless given), every call to feed
+  // reports the error until reset is called.
+  class frame_decoder final {
+  public:
+    explicit frame_decoder(std::size_t max_length = default_max_frame_length)
+      : max_length_{max_length} {}
+
+    template <typename ...Callbacks>
+    void feed(unsigned char const* bytes, std::size_t length, Callbacks... callbacks) {
+      auto callback = detail::make_overload(std::move(callbacks)...);
+      if (error_) {
+        callback(error_);
+        return;
+      }
+      std::size_t position = 0;
+      if (pending_ != 0) {
+        position = fill_pending(bytes, length);
+        if (error_) {
+          callback(error_);
+          return;
+        }
+        if (pending_ < frame_header_size || pending_ < pending_header_.total) return;
+        pending_ = 0;
+        if (!deliver(pending_data(), pending_header_, callback)) return;
+      }
+      while (length - position >= frame_header_size) {
+        detail::parsed_frame_header h;
+        if (!parse(bytes + position, h)) {
+          callback(error_);
+          return;
+        }
+        if (length - position < h.total) break;
+        if (!deliver(bytes + position, h, callback)) return;
+        position += h.total;
+      }
+      if (position != length) {
+        fill_pending(bytes + position, length - position);
+        if (error_) callback(error_);
+      }
+    }
+
+    // The number of bytes held of a frame that is not yet complete
+    std::size_t buffered() const noexcept { return pending_; }
+
+    // Discards any partial frame and error, to start on a new stream
+    void reset() noexcept {
+      pending_ = 0;
+      error_ = {};
+    }
+
+  private:
+    unsigned char* pending_data() noexcept { return reinterpret_cast<unsigned char*>(storage_.data()); }
+
+    bool parse(unsigned char const* bytes, detail::parsed_frame_header& result) {
+      error_ = detail::parse_frame_header(bytes, max_length_, result);
+      return !error_;
+    }
+
+    // Copies as much of the next frame as is available, and returns the
+    // number of bytes consumed
+    std::size_t fill_pending(unsigned char const* bytes, std::size_t length) {
+      std::size_t consumed = 0;
+      if (pending_ < frame_header_size) {
+        consumed = std::min(frame_header_size - pending_, length);
+        reserve(frame_header_size, frame_header_size);
+        std::memcpy(pending_data() + pending_, bytes, consumed);
+        pending_ += consumed;
+        if (pending_ < frame_header_size) return consumed;
+        if (!parse(pending_data(), pending_header_)) return consumed;
+      }
+      auto n = std::min(pending_header_.total - pending_, length - consumed);
+      reserve(pending_ + n, pending_header_.total);
+      std::memcpy(pending_data() + pending_, bytes + consumed, n);
+      pending_ += n;
+      return consumed + n;
+    }
+
+    // Makes room for size bytes, doubling the buffer but never growing it
+    // past limit (a multiple of frame_alignment)
+    void reserve(std::size_t size, std::size_t limit) {
+      auto capacity = storage_.size() * sizeof(uint64_t);
+      if (size <= capacity) return;
+      auto bytes = std::min(std::max(detail::align_to(size, frame_alignment), 2 * capacity), limit);
+      storage_.resize(bytes / sizeof(uint64_t));
+    }
+
+    template <typename Callback>
+    bool deliver(unsigned char const* start, detail::parsed_frame_header const& h, Callback& callback) {
+      return detail::open_frame(
+        start, h
+      , [&](frame const& f) { callback(f); return true; }
+      , [&](std::error_code e) { error_ = e; callback(e); return false; }
+      );
+    }
+
+    std::size_t max_length_;
+    std::vector<uint64_t> storage_;
+    std::size_t pending_ = 0;
+    detail::parsed_frame_header pending_header_{};
+    std::error_code error_;
+  };
+}
+
+#endif
@@ -2,8 +2,27 @@
 #define UUID_0586F3C1_33CB_4764_825C_DB235DCC035F
 
 namespace nocopy {
-  template <typename Offset, Offset Capacity>
-  class archive;
+  class vector_growth;
+
+  namespace detail {
+    template <typename Offset, Offset Capacity>
+    class archive;
+
+    template <typename Offset, typename Grow>
+    class growable_archive;
+
+    template <typename Offset, typename Sink>
+    class streaming_archive;
+
+    template <typename Offset>
+    class archive_view;
+
+    template <typename Offset>
+    class concurrent_archive;
+
+    template <typename Offset>
+    class interner;
+  }
 }
 
 #endif
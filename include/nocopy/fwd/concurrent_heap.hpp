@@ -0,0 +1,9 @@
+#ifndef UUID_C4A1F3E2_7B58_4D06_9E2C_83F5B6D10A47
+#define UUID_C4A1F3E2_7B58_4D06_9E2C_83F5B6D10A47
+
+namespace nocopy { namespace detail {
+  template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+  class concurrent_heap;
+}}
+
+#endif
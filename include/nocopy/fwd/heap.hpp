@@ -2,7 +2,18 @@
 #define UUID_8EEB2EA8_D063_45EE_976E_BA30BD72C159
 
 namespace nocopy { namespace detail {
-  template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+  struct null_heap_observer;
+  struct full_block_headers;
+  struct compact_block_headers;
+  struct good_fit;
+  struct first_fit;
+  struct best_fit;
+
+  template <
+    typename Offset, typename AlignmentType, bool AssumeSameSizedByte
+  , typename Observer = null_heap_observer, typename HeaderLayout = full_block_headers
+  , typename Placement = good_fit
+  >
   class heap;
 }}
 
@@ -0,0 +1,9 @@
+#ifndef UUID_9F74FCE5_BF00_4BDF_A50F_E43B2AB7D15E
+#define UUID_9F74FCE5_BF00_4BDF_A50F_E43B2AB7D15E
+
+namespace nocopy { namespace detail {
+  template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+  class mapped_heap;
+}}
+
+#endif
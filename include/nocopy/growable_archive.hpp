@@ -0,0 +1,297 @@
+#ifndef UUID_24B3E5AF_4057_4C64_ABC0_034DC28BEEB7
+#define UUID_24B3E5AF_4057_4C64_ABC0_034DC28BEEB7
+
+#include <nocopy/fwd/archive.hpp>
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/archive_header.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace nocopy {
+  // Growth policy for a growable archive that never grows
+  struct fixed_capacity {
+    std::size_t operator()(unsigned char*&, std::size_t, std::size_t, std::size_t) const noexcept {
+      return 0;
+    }
+  };
+
+  // Growth policy that moves the archive into memory it owns (at least
+  // doubling it each time). The caller's initial buffer is only copied from.
+  class vector_growth final {
+  public:
+    std::size_t operator()(
+      unsigned char*& buffer, std::size_t used, std::size_t size, std::size_t min_size
+    ) {
+      auto new_size = detail::align_to(std::max(min_size, 2 * size), sizeof(uint64_t));
+      auto owned = !storage_.empty() && buffer == data();
+      if (owned) {
+        storage_.resize(new_size / sizeof(uint64_t));
+      } else {
+        storage_.assign(new_size / sizeof(uint64_t), 0);
+        if (used != 0) std::memcpy(data(), buffer, used);
+      }
+      buffer = data();
+      return new_size;
+    }
+
+  private:
+    unsigned char* data() noexcept { return reinterpret_cast<unsigned char*>(storage_.data()); }
+
+    std::vector<uint64_t> storage_;
+  };
+
+  namespace detail {
+    // An archive whose capacity is set at runtime. It starts in a buffer
+    // supplied by the caller, and when that fills up, Grow is called as
+    // grow(buffer, used, size, min_size). Grow either points buffer at a new
+    // buffer holding the first used bytes of the old one and returns its size
+    // (at least min_size), or returns 0 to fail the allocation.
+    //
+    // The buffer always holds a contiguous image: a header with the cursor,
+    // then [0, cursor) of data. Offsets are relative to the data, so they do
+    // not change when the buffer moves.
+    template <typename Offset, typename Grow>
+    class growable_archive final {
+      using header = archive_header<Offset>;
+      using header_t = typename header::type;
+
+      using reference = detail::reference<Offset>;
+
+      template <typename T, bool is_single>
+      using generic_reference = typename reference::template generic<T, is_single>;
+
+    public:
+      using offset_t = Offset; // for client code
+
+      static constexpr std::size_t max_alignment = header::max_alignment;
+      static constexpr std::size_t header_size = header::size;
+
+      template <typename T>
+      using single_reference = typename reference::template single<T>;
+
+      template <typename T>
+      using range_reference = typename reference::template range<T>;
+
+      growable_archive(growable_archive&&) = default;
+      growable_archive& operator=(growable_archive&&) = default;
+
+      // Starts an empty archive in buffer, which must be aligned to
+      // max_alignment. The buffer may be too small (or null) if grow can
+      // provide a larger one.
+      template <typename ...Callbacks>
+      static auto create(unsigned char* buffer, std::size_t size, Grow grow, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if ((reinterpret_cast<std::uintptr_t>(buffer) & (max_alignment - 1)) != 0) {
+          return callback(make_error_code(error::archive_not_aligned));
+        }
+        growable_archive result{buffer, size, std::move(grow)};
+        if (size < header_size && !result.reserve(header_size, 0)) {
+          return callback(make_error_code(error::out_of_space));
+        }
+        // Header bytes past the cursor are exported too, so none are left
+        // uninitialized
+        std::memset(result.buffer_, 0, header_size);
+        new (result.buffer_) header_t{};
+        return callback(std::move(result));
+      }
+
+      // Continues an archive from an image. size is the size of buffer, which
+      // may extend past the image.
+      template <typename ...Callbacks>
+      static auto load(unsigned char* buffer, std::size_t size, Grow grow, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if ((reinterpret_cast<std::uintptr_t>(buffer) & (max_alignment - 1)) != 0) {
+          return callback(make_error_code(error::archive_not_aligned));
+        }
+        if (size < header_size
+            || size - header_size < reinterpret_cast<header_t const&>(*buffer)[header::cursor]) {
+          return callback(make_error_code(error::bad_archive));
+        }
+        return callback(growable_archive{buffer, size, std::move(grow)});
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto alloc(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_helper<T>(
+          1
+        , [&](Offset offset, Offset) {
+            return callback(reference::template create_single<T>(offset));
+          }
+        , callback
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto alloc_range(Offset count, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_helper<T>(
+          count
+        , [&](Offset offset, Offset allocated) {
+            return callback(reference::template create_range<T>(offset, allocated));
+          }
+        , callback
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto add(T const& t, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc<T>(
+          [&](auto ref) {
+            this->deref(ref) = t;
+            return callback(ref);
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto add(gsl::span<T> in, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_range<std::remove_const_t<T>>(
+          detail::narrow_cast<Offset>(in.length())
+        , [&](auto ref) {
+            std::copy(in.cbegin(), in.cend(), this->deref(ref).begin());
+            return callback(ref);
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename ...Callbacks>
+      auto add(char const* str, std::size_t len, Callbacks... callbacks) {
+        assert(str != nullptr);
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_range<char>(
+          detail::narrow_cast<Offset>(len + 1)
+        , [&](auto ref) {
+            // The terminator is already there, since allocations are zeroed
+            std::memcpy(&data()[static_cast<Offset>(ref)], str, len);
+            return callback(reference::template create_range<char const>(
+              static_cast<Offset>(ref), detail::narrow_cast<Offset>(len + 1)
+            ));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename ...Callbacks>
+      auto add(std::string const& str, Callbacks... callbacks) {
+        return this->add(str.c_str(), str.length(), callbacks...);
+      }
+
+      // Note that pointers into the archive are invalidated when it grows
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused> const& ref) const noexcept {
+        return ref.deref(data()[static_cast<Offset>(ref)]);
+      }
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
+        return ref.deref(data()[static_cast<Offset>(ref)]);
+      }
+
+      char const* get_string(range_reference<char const> const& ref) const noexcept {
+        return this->deref(ref).data();
+      }
+
+      // The finished archive: the header followed by [0, cursor) of data
+      gsl::span<unsigned char const> image() const noexcept {
+        using index_type = typename gsl::span<unsigned char const>::index_type;
+        return {buffer_, static_cast<index_type>(header_size + cursor())};
+      }
+
+      // Empties the archive for reuse, keeping its buffer. Nothing is zeroed
+      // here, since allocations are zeroed as they are made.
+      void reset() noexcept {
+        reinterpret_cast<header_t&>(*buffer_)[header::cursor] = 0;
+      }
+
+      // Discards everything allocated after a cursor() returned earlier, so
+      // references into the discarded data must not be used again
+      void truncate(Offset cursor_value) noexcept {
+        assert(cursor_value <= cursor());
+        reinterpret_cast<header_t&>(*buffer_)[header::cursor] = cursor_value;
+      }
+
+      Offset cursor() const noexcept {
+        return reinterpret_cast<header_t const&>(*buffer_)[header::cursor];
+      }
+
+      std::size_t capacity() const noexcept { return size_ - header_size; }
+
+      Grow& growth() noexcept { return grow_; }
+
+    private:
+      growable_archive(unsigned char* buffer, std::size_t size, Grow grow)
+        : buffer_{buffer}, size_{size}, grow_(std::move(grow)) {}
+
+      unsigned char* data() noexcept { return buffer_ + header_size; }
+      unsigned char const* data() const noexcept { return buffer_ + header_size; }
+
+      bool reserve(std::size_t min_size, std::size_t used) {
+        auto new_size = grow_(buffer_, used, size_, min_size);
+        if (new_size < min_size) return false;
+        assert((reinterpret_cast<std::uintptr_t>(buffer_) & (max_alignment - 1)) == 0);
+        size_ = new_size;
+        return true;
+      }
+
+      // Allocations (and the alignment padding before them) are zeroed, since
+      // nocopy types expect to start out value-initialized
+      template <typename T, typename Success, typename Error>
+      auto alloc_helper(std::size_t count, Success&& success_callback, Error&& error_callback) {
+        detail::assert_valid_type<T>();
+        std::size_t cursor_value = cursor();
+        auto addr = detail::align_to(cursor_value, detail::alignment_for<T>());
+        auto size = sizeof(T) * count;
+        std::size_t max_offset = std::numeric_limits<Offset>::max();
+        if (addr > max_offset || max_offset - addr < size) {
+          return error_callback(make_error_code(error::out_of_space));
+        }
+        auto end = addr + size;
+        if (capacity() < end && !reserve(header_size + end, header_size + cursor_value)) {
+          return error_callback(make_error_code(error::out_of_space));
+        }
+        std::memset(data() + cursor_value, 0, end - cursor_value);
+        reinterpret_cast<header_t&>(*buffer_)[header::cursor] = detail::narrow_cast<Offset>(end);
+        return success_callback(detail::narrow_cast<Offset>(addr), detail::narrow_cast<Offset>(count));
+      }
+
+      unsigned char* buffer_;
+      std::size_t size_;
+      Grow grow_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  template <typename Grow = vector_growth>
+  using growable_archive32 = detail::growable_archive<uint32_t, Grow>;
+#endif
+#ifdef UINT64_MAX
+  template <typename Grow = vector_growth>
+  using growable_archive64 = detail::growable_archive<uint64_t, Grow>;
+#endif
+}
+
+#endif
@@ -4,25 +4,38 @@
 #include <nocopy/fwd/heap.hpp>
 
 #include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/block_headers.hpp>
+#include <nocopy/detail/heap_observer.hpp>
 #include <nocopy/detail/lambda_overload.hpp>
 #include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/placement.hpp>
 #include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/size_class.hpp>
 #include <nocopy/detail/traits.hpp>
 #include <nocopy/box.hpp>
 #include <nocopy/structpack.hpp>
 #include <nocopy/field.hpp>
 #include <nocopy/errors.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstring>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace nocopy {
   namespace detail {
-    template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+    template <
+      typename Offset, typename AlignmentType, bool AssumeSameSizedByte
+    , typename Observer, typename HeaderLayout, typename Placement
+    >
     class heap final {
       static constexpr auto alignment = sizeof(AlignmentType);
       static constexpr std::size_t byte_multiplier = AssumeSameSizedByte ? 1 : CHAR_BIT;
+      static constexpr std::size_t granularity = byte_multiplier * alignment;
 
       static_assert(std::is_unsigned<Offset>::value, "Offset type must be signed");
       static_assert(
@@ -32,22 +45,84 @@ namespace nocopy {
       static_assert(sizeof(Offset) <= sizeof(std::size_t), "");
       static_assert(sizeof(Offset) <= alignment, "Offset must be smaller than alignment");
 
+      static_assert(
+        std::is_same<HeaderLayout, full_block_headers>::value
+        || std::is_same<HeaderLayout, compact_block_headers>::value
+      , "HeaderLayout must be full_block_headers or compact_block_headers"
+      );
+      static constexpr bool compact_headers = std::is_same<HeaderLayout, compact_block_headers>::value;
+
+      static_assert(
+        std::is_same<Placement, good_fit>::value || std::is_same<Placement, first_fit>::value
+        || std::is_same<Placement, best_fit>::value
+      , "Placement must be good_fit, first_fit, or best_fit"
+      );
+      static constexpr bool address_ordered = std::is_same<Placement, first_fit>::value;
+
       struct block_header {
         NOCOPY_FIELD(size, Offset);
         NOCOPY_FIELD(prev, Offset);
         NOCOPY_FIELD(next_free, Offset);
         NOCOPY_FIELD(prev_free, Offset);
-        using type = structpack<size_t, prev_t, next_free_t, prev_free_t>;
+        using full_type = structpack<size_t, prev_t, next_free_t, prev_free_t>;
+        using compact_type = structpack<size_t, prev_t>;
+        using links_type = structpack<next_free_t, prev_free_t>;
+        using type = std::conditional_t<compact_headers, compact_type, full_type>;
       };
       using block_header_t = typename block_header::type;
       static constexpr Offset block_header_size = detail::narrow_cast<Offset>(
         byte_multiplier * detail::align_to(sizeof(block_header_t), alignment)
       );
 
-      static constexpr Offset list_head_offset = 0;
-      static constexpr Offset first_block_offset = block_header_size;
+      // A free block's list links are part of its header, or with compact
+      // headers, the start of its payload (so every block must have room)
+      using links_t = std::conditional_t<
+        compact_headers, typename block_header::links_type, block_header_t
+      >;
+      static constexpr Offset links_offset = compact_headers ? block_header_size : 0;
+      static constexpr Offset min_block_size = compact_headers
+        ? detail::narrow_cast<Offset>(byte_multiplier * detail::align_to(sizeof(links_t), alignment))
+        : 0;
 
-      static constexpr Offset initial_bookkeeping = 3 * block_header_size;
+      // Free blocks are kept in segregated lists indexed by size class. The
+      // index lives at the start of the buffer, followed by a guard header
+      // that keeps the first block from merging backward. An offset of 0
+      // terminates a free list, since no block can live there.
+      using size_class = detail::size_class<Offset, 3>;
+      static constexpr std::size_t second_level_count = size_class::second_level_count;
+      static constexpr std::size_t examined_buckets = 8;
+
+      // Running statistics live in the index too, so they survive a load
+      struct free_index {
+        NOCOPY_FIELD(first_level_map, Offset);
+        NOCOPY_FIELD(first_level_count, Offset);
+        NOCOPY_FIELD(header_layout, Offset);
+        NOCOPY_FIELD(free_bytes, Offset);
+        NOCOPY_FIELD(free_blocks, Offset);
+        NOCOPY_FIELD(allocated_blocks, Offset);
+        NOCOPY_FIELD(malloc_count, Offset);
+        NOCOPY_FIELD(free_count, Offset);
+        NOCOPY_FIELD(realloc_count, Offset);
+        NOCOPY_FIELD(examined, NOCOPY_ARRAY(Offset, examined_buckets));
+        NOCOPY_FIELD(pinned_blocks, Offset); // slabs, whose blocks compact must not move
+        NOCOPY_FIELD(sub_arenas, Offset); // open sub_arenas, which also pin the heap
+        using type = structpack<
+          first_level_map_t, first_level_count_t, header_layout_t, free_bytes_t, free_blocks_t
+        , allocated_blocks_t, malloc_count_t, free_count_t, realloc_count_t, examined_t
+        , pinned_blocks_t, sub_arenas_t
+        >;
+      };
+      using free_index_t = typename free_index::type;
+
+      struct free_class {
+        NOCOPY_FIELD(second_level_map, Offset);
+        NOCOPY_FIELD(heads, NOCOPY_ARRAY(Offset, second_level_count));
+        using type = structpack<second_level_map_t, heads_t>;
+      };
+      using free_class_t = typename free_class::type;
+
+      static constexpr Offset free_list_end = 0;
+      static constexpr Offset header_layout_tag = compact_headers ? 1 : 0;
 
       using reference = detail::reference<Offset>;
 
@@ -62,14 +137,332 @@ namespace nocopy {
       template <typename T>
       using range_reference = typename reference::template range<T>;
 
+      // A snapshot of the heap's counters. Sizes are in the same units as
+      // offsets and exclude block headers.
+      struct statistics {
+        Offset capacity; // the free size of an empty heap
+        Offset allocated_bytes;
+        Offset free_bytes;
+        Offset allocated_blocks;
+        Offset free_blocks;
+        Offset largest_free_block;
+        Offset malloc_count;
+        Offset free_count;
+        // realloc_range calls, which count as neither mallocs nor frees even
+        // when they move the range
+        Offset realloc_count;
+        // How many free blocks each malloc examined. Bucket 0 counts mallocs
+        // that found no candidate at all, and bucket i counts those that
+        // examined at most 2^(i-1) blocks. The last bucket is unbounded.
+        std::array<Offset, examined_buckets> examined;
+
+        // 0 when all free space is in one block, approaching 1 as it splinters
+        double fragmentation() const noexcept {
+          if (free_bytes == 0) return 0;
+          return 1 - static_cast<double>(largest_free_block) / free_bytes;
+        }
+
+        // Passes every statistic to callback as a (name, value) pair, e.g., for
+        // export to a metrics system
+        template <typename Callback>
+        void each(Callback&& callback) const {
+          static char const* const examined_names[examined_buckets] = {
+            "examined_none", "examined_1", "examined_2", "examined_4"
+          , "examined_8", "examined_16", "examined_32", "examined_more"
+          };
+          callback("capacity", static_cast<double>(capacity));
+          callback("allocated_bytes", static_cast<double>(allocated_bytes));
+          callback("free_bytes", static_cast<double>(free_bytes));
+          callback("allocated_blocks", static_cast<double>(allocated_blocks));
+          callback("free_blocks", static_cast<double>(free_blocks));
+          callback("largest_free_block", static_cast<double>(largest_free_block));
+          callback("malloc_count", static_cast<double>(malloc_count));
+          callback("free_count", static_cast<double>(free_count));
+          callback("realloc_count", static_cast<double>(realloc_count));
+          callback("fragmentation", fragmentation());
+          for (std::size_t i = 0; i < examined_buckets; ++i) {
+            callback(examined_names[i], static_cast<double>(examined[i]));
+          }
+        }
+      };
+
+      // Maps the offsets of blocks moved by compact to their new offsets.
+      // Offsets that were not moved map to themselves.
+      class relocation_map final {
+      public:
+        Offset operator()(Offset offset) const {
+          auto it = std::lower_bound(
+            moves_.begin(), moves_.end(), offset
+          , [](std::pair<Offset, Offset> const& move, Offset o) { return move.first < o; }
+          );
+          return it != moves_.end() && it->first == offset ? it->second : offset;
+        }
+
+        template <typename T, bool Unused>
+        generic_reference<T, Unused> operator()(generic_reference<T, Unused> const& ref) const {
+          auto offset = static_cast<Offset>(ref);
+          return reference::rebase(ref, detail::narrow_cast<Offset>((*this)(offset) - offset));
+        }
+
+        // Rewrites the given reference fields of a structpack in place
+        template <typename StructPack, typename ...Fields>
+        void relocate(StructPack& object, Fields... fields) const {
+          using expand_type = int[];
+          (void)expand_type{0, (object[fields] = (*this)(object[fields]), 0)...};
+        }
+
+        bool empty() const noexcept { return moves_.empty(); }
+        std::size_t size() const noexcept { return moves_.size(); }
+
+        // (old offset, new offset) pairs, sorted by old offset
+        auto begin() const noexcept { return moves_.cbegin(); }
+        auto end() const noexcept { return moves_.cend(); }
+
+      private:
+        std::vector<std::pair<Offset, Offset>> moves_;
+
+        friend class heap;
+      };
+
+      // Bump allocation from a single heap block. Its allocations are ordinary
+      // references into the heap, but they have no headers, so they must not be
+      // passed to free. Instead, they are all released at once (along with the
+      // block) when the sub_arena is released or destroyed, or released back
+      // to a checkpoint with rollback. The heap must outlive the sub_arena.
+      // Its block pins the heap: compact fails until it has been released.
+      // Open sub_arenas are counted in the buffer, so every copy of the heap
+      // sees the pin. An image saved (or left behind by a crash) while one
+      // was open stays pinned after it is loaded, until forget_sub_arenas is
+      // called.
+      class sub_arena final {
+      public:
+        struct checkpoint { Offset cursor; };
+
+        sub_arena(sub_arena&& other) noexcept
+          : heap_{other.heap_}, offset_{other.offset_}, capacity_{other.capacity_}
+          , cursor_{other.cursor_} {
+          other.heap_ = nullptr;
+        }
+        sub_arena& operator=(sub_arena&&) = delete;
+        ~sub_arena() { release(); }
+
+        template <typename T, typename ...Callbacks>
+        auto malloc(Callbacks... callbacks) {
+          detail::assert_valid_type<T>();
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return bump(sizeof(T), [&callback](Offset offset) {
+            return callback(reference::template create_single<T>(offset));
+          }, callback);
+        }
+
+        template <typename T, typename ...Callbacks>
+        auto malloc_range(Offset count, Callbacks... callbacks) {
+          detail::assert_valid_type<T>();
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          return bump(sizeof(T) * count, [&callback, count](Offset offset) {
+            return callback(reference::template create_range<T>(offset, count));
+          }, callback);
+        }
+
+        checkpoint mark() const noexcept { return {cursor_}; }
+
+        // Releases everything allocated since the checkpoint was taken
+        void rollback(checkpoint c) noexcept {
+          assert(c.cursor <= cursor_);
+          cursor_ = c.cursor;
+        }
+
+        void reset() noexcept { cursor_ = 0; }
+
+        // Returns the block to the heap
+        void release() noexcept {
+          if (heap_ == nullptr) return;
+          auto& index = heap_->get_index();
+          assert(index[free_index::sub_arenas] != 0);
+          index[free_index::sub_arenas] = index[free_index::sub_arenas] - 1;
+          heap_->free_offset(offset_);
+          heap_ = nullptr;
+        }
+
+        Offset capacity() const noexcept { return capacity_; }
+        Offset used() const noexcept { return cursor_; }
+
+      private:
+        sub_arena(heap& h, Offset offset, Offset capacity)
+          : heap_{&h}, offset_{offset}, capacity_{capacity}, cursor_{0} {}
+
+        template <typename Success, typename Callback>
+        auto bump(std::size_t requested_size, Success&& success, Callback& callback) {
+          assert(heap_ != nullptr);
+          auto size = byte_multiplier * detail::align_to(requested_size, alignment);
+          if (capacity_ - cursor_ < size) {
+            return callback(make_error_code(error::out_of_space));
+          }
+          auto offset = offset_ + cursor_;
+          cursor_ = detail::narrow_cast<Offset>(cursor_ + size);
+          return success(offset);
+        }
+
+        heap* heap_;
+        Offset offset_;
+        Offset capacity_;
+        Offset cursor_;
+
+        friend class heap;
+      };
+
+      // Fixed-size cells of T carved from chunks of heap blocks, for O(1)
+      // malloc and free without per-object headers. Freed cells are linked
+      // through their first bytes, and chunks are taken from the heap as
+      // needed. All state is in the buffer, so a slab can be reopened from its
+      // offset (see open_slab) after the heap is loaded elsewhere. Cells must
+      // only be freed through their slab, and destroy returns every chunk to
+      // the heap. A slab is a handle, and the heap must outlive it. The slab's
+      // header and chunks hold offsets into the heap, so a slab pins the heap
+      // until it is destroyed: compact fails in the meantime.
+      template <typename T>
+      class slab final {
+        struct slab_header {
+          NOCOPY_FIELD(free_head, Offset);
+          NOCOPY_FIELD(chunk_head, Offset);
+          NOCOPY_FIELD(bump, Offset); // the next never-used cell in the newest chunk
+          NOCOPY_FIELD(bump_end, Offset);
+          NOCOPY_FIELD(cells_per_chunk, Offset);
+          using type = structpack<free_head_t, chunk_head_t, bump_t, bump_end_t, cells_per_chunk_t>;
+        };
+        using slab_header_t = typename slab_header::type;
+
+        struct link {
+          NOCOPY_FIELD(next, Offset);
+          using type = structpack<next_t>;
+        };
+        using link_t = typename link::type;
+
+        static constexpr Offset cell_size = detail::narrow_cast<Offset>(
+          byte_multiplier * detail::align_to(std::max(sizeof(T), sizeof(link_t)), alignment)
+        );
+        static constexpr Offset chunk_header_size = detail::narrow_cast<Offset>(
+          byte_multiplier * detail::align_to(sizeof(link_t), alignment)
+        );
+        static constexpr Offset list_end = 0;
+
+      public:
+        template <typename ...Callbacks>
+        auto malloc(Callbacks... callbacks) {
+          auto callback = detail::make_overload(std::move(callbacks)...);
+          auto& header = heap_->template object_at<slab_header_t>(offset_);
+          Offset cell = header[slab_header::free_head];
+          if (cell != list_end) {
+            header[slab_header::free_head] = next_of(cell);
+          } else {
+            if (header[slab_header::bump] == header[slab_header::bump_end] && !add_chunk(header)) {
+              return callback(make_error_code(error::out_of_space));
+            }
+            cell = header[slab_header::bump];
+            header[slab_header::bump] = cell + cell_size;
+          }
+          return callback(reference::template create_single<T>(cell));
+        }
+
+        void free(single_reference<T> ref) noexcept {
+          auto& header = heap_->template object_at<slab_header_t>(offset_);
+          auto cell = static_cast<Offset>(ref);
+          heap_->template object_at<link_t>(cell)[link::next] = header[slab_header::free_head];
+          header[slab_header::free_head] = cell;
+        }
+
+        // Frees every chunk and the slab itself
+        void destroy() noexcept {
+          Offset chunk = heap_->template object_at<slab_header_t>(offset_)[slab_header::chunk_head];
+          while (chunk != list_end) {
+            auto next = next_of(chunk);
+            heap_->free_offset(chunk);
+            chunk = next;
+          }
+          heap_->unpin();
+          heap_->free_offset(offset_);
+        }
+
+        // Store this to reopen the slab later
+        Offset offset() const noexcept { return offset_; }
+
+      private:
+        slab(heap& h, Offset offset) : heap_{&h}, offset_{offset} {}
+
+        Offset next_of(Offset offset) const {
+          return static_cast<heap const&>(*heap_).template object_at<link_t>(offset)[link::next];
+        }
+
+        bool add_chunk(slab_header_t& header) {
+          Offset cells = header[slab_header::cells_per_chunk];
+          return heap_->malloc_helper(
+            (chunk_header_size + std::size_t{cells} * cell_size) / byte_multiplier
+          , [&](Offset chunk) {
+              auto& chunk_link = *new (&heap_->template object_at<link_t>(chunk)) link_t{};
+              chunk_link[link::next] = header[slab_header::chunk_head];
+              header[slab_header::chunk_head] = chunk;
+              header[slab_header::bump] = chunk + chunk_header_size;
+              header[slab_header::bump_end] = chunk + chunk_header_size + cells * cell_size;
+              return true;
+            }
+          , [](std::error_code) { return false; }
+          );
+        }
+
+        heap* heap_;
+        Offset offset_;
+
+        friend class heap;
+      };
+
       template <typename ...Args>
       static auto create(Args... args) noexcept {
-        return create_helper(true, args...);
+        return create_helper(true, 0, args...);
+      }
+
+      // Like create, but sizes the free list index for a heap that may later
+      // grow to max_size (in the same units as size)
+      template <typename ...Callbacks>
+      static auto create_growable(
+        unsigned char* buffer, std::size_t size, std::size_t max_size, Callbacks... callbacks
+      ) noexcept {
+        return create_helper(true, max_size, buffer, size, callbacks...);
+      }
+
+      // Whether create_growable would accept size and max_size, so a caller can
+      // check them before preparing a buffer
+      static bool accepts_size(std::size_t size, std::size_t max_size) noexcept {
+        auto aligned_size = detail::align_backward(size / byte_multiplier, alignment);
+        auto aligned_max_size = std::max(
+          aligned_size, detail::align_backward(max_size / byte_multiplier, alignment)
+        );
+        return !is_heap_too_big(aligned_max_size) && is_heap_big_enough(
+          detail::narrow_cast<Offset>(aligned_size * byte_multiplier)
+        , first_level_count_for(detail::narrow_cast<Offset>(aligned_max_size * byte_multiplier))
+        );
       }
 
       template <typename ...Args>
       static auto load(Args... args) noexcept {
-        return create_helper(false, args...);
+        return create_helper(false, 0, args...);
+      }
+
+      // Extends the heap to size, adding the new space to the free list. The
+      // buffer must hold the heap's current contents, but may have moved.
+      // Blocks above the size the index was created for are kept in its last
+      // class, so see create_growable.
+      template <typename ...Callbacks>
+      auto grow(unsigned char* buffer, std::size_t size, Callbacks... callbacks) noexcept {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto aligned_size = detail::align_backward(size / byte_multiplier, alignment);
+        if (!is_aligned(buffer)) {
+          return callback(make_error_code(error::heap_not_aligned));
+        } else if (is_heap_too_big(aligned_size) || aligned_size * byte_multiplier < size_) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        buffer_ = buffer;
+        extend(detail::narrow_cast<Offset>(aligned_size * byte_multiplier));
+        return callback();
       }
 
       template <typename T, bool Unused>
@@ -77,9 +470,13 @@ namespace nocopy {
         auto offset = static_cast<Offset>(ref);
         return ref.deref(buffer_[offset]);
       }
+      // The referenced object is reported to the observer, since it may be
+      // written through the result. (References from sub arenas and slabs are
+      // not at the start of a block, so the block's header is not consulted.)
       template <typename T, bool Unused>
       decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
         auto offset = static_cast<Offset>(ref);
+        touch(offset, bytes_of(ref));
         return ref.deref(buffer_[offset]);
       }
 
@@ -109,19 +506,277 @@ namespace nocopy {
         );
       }
 
+      // Like malloc and malloc_range, but the returned offset is a multiple of
+      // alignment_bytes (a power of two), so the object is aligned when the
+      // buffer itself is. Space skipped to align the block is returned to the
+      // free list. The block is flagged in its header so that it never moves:
+      // compact leaves it in place, and realloc_range only resizes it in place.
+      template <typename T, typename ...Callbacks>
+      auto malloc_aligned(std::size_t alignment_bytes, Callbacks... callbacks) {
+        detail::assert_valid_type<T>();
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return malloc_aligned_helper(
+          sizeof(T), alignment_bytes
+        , [&callback](Offset offset) {
+            return callback(reference::template create_single<T>(offset));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto malloc_range_aligned(std::size_t alignment_bytes, Offset count, Callbacks... callbacks) {
+        detail::assert_valid_type<T>();
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return malloc_aligned_helper(
+          sizeof(T) * count, alignment_bytes
+        , [&callback, count](Offset offset) {
+            return callback(reference::template create_range<T>(offset, count));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      // Creates a slab that takes cells_per_chunk cells from the heap at a time
+      template <typename T, typename ...Callbacks>
+      auto make_slab(Offset cells_per_chunk, Callbacks... callbacks) {
+        detail::assert_valid_type<T>();
+        assert(cells_per_chunk != 0);
+        using header_t = typename slab<T>::slab_header_t;
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return malloc_helper(
+          sizeof(header_t)
+        , [this, &callback, cells_per_chunk](Offset offset) {
+            auto& header = *new (&object_at<header_t>(offset)) header_t{};
+            header[slab<T>::slab_header::cells_per_chunk] = cells_per_chunk;
+            pin();
+            return callback(slab<T>{*this, offset});
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      // Reopens a slab from its offset
+      template <typename T>
+      slab<T> open_slab(Offset offset) noexcept {
+        return slab<T>{*this, offset};
+      }
+
+      // Reserves a block with room for capacity bytes of bump allocations
+      template <typename ...Callbacks>
+      auto make_sub_arena(std::size_t capacity, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return malloc_helper(
+          capacity
+        , [this, &callback](Offset offset) {
+            auto size = size_of(get_header(offset - block_header_size));
+            auto& index = get_index();
+            index[free_index::sub_arenas] = index[free_index::sub_arenas] + 1;
+            return callback(sub_arena{*this, offset, size});
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      // Allocates refs.length() independent blocks. When one free block can
+      // hold them all, they are carved from it back to back. Either every
+      // reference is filled in, or none are allocated.
+      template <typename T, typename ...Callbacks>
+      auto malloc_many(gsl::span<single_reference<T>> refs, Callbacks... callbacks) {
+        detail::assert_valid_type<T>();
+        using index_type = typename gsl::span<single_reference<T>>::index_type;
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto count = static_cast<std::size_t>(refs.length());
+        Offset block_size = block_size_for(sizeof(T));
+        if (count == 0) return callback(refs);
+        auto stride = std::size_t{block_header_size} + block_size;
+        if (count <= size_ / stride) {
+          auto run_size = detail::narrow_cast<Offset>(count * stride - block_header_size);
+          if (auto block = find_free_block(run_size)) {
+            remove_from_free_list(*block);
+            trim(*block, run_size);
+            mark_as_allocated(*block);
+            count_allocations(count);
+            carve(*block, block_size, count, [&](std::size_t i, Offset offset) {
+              observer_.on_malloc(offset / byte_multiplier, sizeof(T));
+              refs[static_cast<index_type>(i)] = reference::template create_single<T>(offset);
+            });
+            return callback(refs);
+          }
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+          auto success = malloc_helper(
+            sizeof(T)
+          , [&](Offset offset) {
+              refs[static_cast<index_type>(i)] = reference::template create_single<T>(offset);
+              return true;
+            }
+          , [](std::error_code) { return false; }
+          );
+          if (!success) {
+            free_many(refs.subspan(0, static_cast<index_type>(i)));
+            return callback(make_error_code(error::out_of_space));
+          }
+        }
+        return callback(refs);
+      }
+
+      // Frees every reference in refs, coalescing neighboring blocks (freed or
+      // already free) into one free block per contiguous run. Note that refs
+      // is sorted by offset in the process. Each reference must be allocated
+      // and appear only once, since a duplicate would free its block twice.
+      template <typename T, bool Unused>
+      void free_many(gsl::span<generic_reference<T, Unused>> refs) noexcept {
+        std::sort(refs.begin(), refs.end(), [](auto const& a, auto const& b) {
+          return static_cast<Offset>(a) < static_cast<Offset>(b);
+        });
+        assert(std::adjacent_find(refs.begin(), refs.end(), [](auto const& a, auto const& b) {
+          return static_cast<Offset>(a) == static_cast<Offset>(b);
+        }) == refs.end());
+        auto it = refs.begin();
+        auto end = refs.end();
+        count_frees(static_cast<std::size_t>(refs.length()));
+        for (auto const& ref : refs) observer_.on_free(static_cast<Offset>(ref) / byte_multiplier);
+        while (it != end) {
+          auto& first = get_header(static_cast<Offset>(*it++) - block_header_size);
+          auto start = &first;
+          auto& prev = prev_adjacent(first);
+          if (is_free_block(prev)) {
+            remove_from_free_list(prev);
+            start = &prev;
+          }
+          auto last = &first;
+          while (true) {
+            auto& next = next_adjacent(*last);
+            auto next_offset = get_offset(next);
+            if (it != end && static_cast<Offset>(*it) - block_header_size == next_offset) {
+              ++it;
+            } else if (is_free_block(next)) {
+              remove_from_free_list(next);
+            } else {
+              break;
+            }
+            last = &next;
+          }
+          auto& following = next_adjacent(*last);
+          auto start_offset = get_offset(*start);
+          (*start)[block_header::size] = get_offset(following) - start_offset - block_header_size;
+          mark_as_free(*start);
+          following[block_header::prev] = start_offset;
+          add_to_free_list(*start);
+        }
+      }
+
+      // Resizes a range, preserving its contents up to the smaller of the two
+      // sizes. The block is shrunk or extended into adjacent free space when
+      // possible, and is only moved to a new block (and the old block freed)
+      // otherwise. A block from malloc_range_aligned is only ever resized in
+      // place, since a move could lose its alignment, and
+      // callback(error::aligned_block) is called when that is not enough. On
+      // failure the original range is left untouched.
+      template <typename T, typename ...Callbacks>
+      auto realloc_range(range_reference<T> ref, Offset count, Callbacks... callbacks) {
+        detail::assert_valid_type<T>();
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        Offset offset = static_cast<Offset>(ref);
+        Offset old_count = ref[reference::count_field];
+        Offset target_size = block_size_for(sizeof(T) * count);
+        auto resized = resize_in_place(offset, target_size, sizeof(T) * std::min(old_count, count));
+        if (resized != 0) {
+          count_realloc();
+          observer_.on_free(offset / byte_multiplier);
+          observer_.on_malloc(resized / byte_multiplier, sizeof(T) * count);
+          return callback(reference::template create_range<T>(resized, count));
+        }
+        if (is_aligned_block(get_header(offset - block_header_size))) {
+          return callback(make_error_code(error::aligned_block));
+        }
+        return malloc_helper(
+          sizeof(T) * count
+        , [this, &callback, offset, old_count, count](Offset new_offset) {
+            touch(new_offset, sizeof(T) * std::min(old_count, count));
+            std::memcpy(
+              &buffer_[new_offset / byte_multiplier]
+            , &buffer_[offset / byte_multiplier]
+            , sizeof(T) * std::min(old_count, count)
+            );
+            free_offset(offset);
+            uncount_move();
+            count_realloc();
+            return callback(reference::template create_range<T>(new_offset, count));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
       template <typename T, bool Unused>
       void free(generic_reference<T, Unused> ref) noexcept {
-        auto offset = static_cast<Offset>(ref);
-        assert(0 < offset && offset < size_);
-        auto& block = get_header(offset - block_header_size);
-        auto& merged = merge_free_blocks(block); // marks block as free
-        add_to_free_list(merged);
+        free_offset(static_cast<Offset>(ref));
+      }
+
+      // Slides every allocated block toward the start of the heap, leaving all
+      // free space in a single block at the end, and calls callback(map).
+      // Blocks from malloc_aligned keep their offsets, so the free space just
+      // before each of them stays behind as a free block of its own.
+      // References into the heap must be passed through the map before they
+      // are used again. The observer sees each move as a free of the old offset
+      // followed by a malloc of the new one, sized to the whole block. Only
+      // the starts of blocks are remapped, so while a
+      // sub_arena or a slab is alive nothing moves, and
+      // callback(error::heap_pinned) is called instead.
+      template <typename ...Callbacks>
+      auto compact(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto& index = static_cast<heap const&>(*this).get_index();
+        if (index[free_index::pinned_blocks] != 0 || index[free_index::sub_arenas] != 0) {
+          return callback(make_error_code(error::heap_pinned));
+        }
+        return callback(compact_blocks());
+      }
+
+      // Recovers an image saved (or left behind by a crash) while sub_arenas
+      // were open, by clearing their count so that compact works again. Their
+      // blocks stay allocated. Only call this when no sub_arena of the buffer
+      // is alive in any process.
+      void forget_sub_arenas() noexcept {
+        get_index()[free_index::sub_arenas] = 0;
+      }
+
+      // Constant time apart from finding the largest free block, which walks
+      // the highest nonempty size class, so it is linear in the length of
+      // that class's free list. Sample it rather than calling it per
+      // operation.
+      statistics stats() const {
+        auto& index = get_index();
+        statistics result;
+        Offset free_blocks = index[free_index::free_blocks];
+        Offset allocated_blocks = index[free_index::allocated_blocks];
+        result.capacity = sentinel_offset() - first_block_offset() - block_header_size;
+        result.free_bytes = index[free_index::free_bytes];
+        result.free_blocks = free_blocks;
+        result.allocated_blocks = allocated_blocks;
+        result.allocated_bytes = detail::narrow_cast<Offset>(
+          sentinel_offset() - first_block_offset() - result.free_bytes
+          - (free_blocks + allocated_blocks) * block_header_size
+        );
+        result.largest_free_block = largest_free_block();
+        result.malloc_count = index[free_index::malloc_count];
+        result.free_count = index[free_index::free_count];
+        result.realloc_count = index[free_index::realloc_count];
+        for (std::size_t i = 0; i < examined_buckets; ++i) {
+          result.examined[i] = index[free_index::examined][i];
+        }
+        return result;
       }
 
+      // Told about every write the heap makes to its buffer
+      Observer& observer() noexcept { return observer_; }
+      Observer const& observer() const noexcept { return observer_; }
+
       // This is to facilitate testing
       template <typename Callback>
       void each_block(Callback&& callback) const {
-        Offset offset = first_block_offset;
+        Offset offset = first_block_offset();
         while(offset < sentinel_offset()) {
           auto& block = get_header(offset);
           Offset size; bool is_free;
@@ -146,46 +801,525 @@ namespace nocopy {
       }
 
     private:
+      template <typename, typename, bool>
+      friend class concurrent_heap;
+
+      void pin() {
+        auto& index = get_index();
+        index[free_index::pinned_blocks] = index[free_index::pinned_blocks] + 1;
+      }
+
+      void unpin() noexcept {
+        auto& index = get_index();
+        assert(index[free_index::pinned_blocks] != 0);
+        index[free_index::pinned_blocks] = index[free_index::pinned_blocks] - 1;
+      }
+
+      relocation_map compact_blocks() {
+        relocation_map map;
+        for (std::size_t i = 0; i < first_level_count_; ++i) {
+          new (&get_class(i)) free_class_t{};
+        }
+        auto& index = get_index();
+        index[free_index::first_level_map] = 0;
+        index[free_index::free_bytes] = 0;
+        index[free_index::free_blocks] = 0;
+
+        Offset offset = first_block_offset();
+        Offset destination = offset;
+        Offset last = guard_offset();
+        while (offset < sentinel_offset()) {
+          Offset size; bool is_free;
+          std::tie(size, is_free) = get_block_size(get_header(offset));
+          auto next = offset + block_header_size + size;
+          if (!is_free && is_aligned_block(get_header(offset))) {
+            // Aligned blocks stay put, and the space slid out from under the
+            // blocks before them becomes a free block. Free space only ever
+            // opens up a whole block at a time, so the gap is large enough.
+            if (destination != offset) {
+              auto& gap = get_header(destination);
+              new (&gap) block_header_t{};
+              gap[block_header::size] = offset - destination - block_header_size;
+              gap[block_header::prev] = last;
+              mark_as_free(gap);
+              add_to_free_list(gap);
+              last = destination;
+            }
+            get_header(offset)[block_header::prev] = last;
+            last = offset;
+            destination = next;
+          } else if (!is_free) {
+            if (destination != offset) {
+              touch(destination, (block_header_size + size) / byte_multiplier);
+              std::memmove(
+                &buffer_[destination / byte_multiplier]
+              , &buffer_[offset / byte_multiplier]
+              , (block_header_size + size) / byte_multiplier
+              );
+              map.moves_.emplace_back(offset + block_header_size, destination + block_header_size);
+              observer_.on_free((offset + block_header_size) / byte_multiplier);
+              observer_.on_malloc((destination + block_header_size) / byte_multiplier, size / byte_multiplier);
+            }
+            get_header(destination)[block_header::prev] = last;
+            last = destination;
+            destination += block_header_size + size;
+          }
+          offset = next;
+        }
+        assert(offset == sentinel_offset());
+
+        if (destination != sentinel_offset()) {
+          auto& tail = get_header(destination);
+          new (&tail) block_header_t{};
+          tail[block_header::size] = sentinel_offset() - destination - block_header_size;
+          tail[block_header::prev] = last;
+          mark_as_free(tail);
+          add_to_free_list(tail);
+          last = destination;
+        }
+        sentinel()[block_header::prev] = last;
+        return map;
+      }
+
+      // Moves the sentinel to the end of the grown heap. The new space joins
+      // the last block if it is free (or if the space is too small to hold a
+      // block of its own), and becomes a new free block otherwise.
+      void extend(Offset new_size) {
+        auto old_sentinel = sentinel_offset();
+        auto growth = new_size - size_;
+        if (growth == 0) return;
+        auto& last = prev_adjacent(sentinel());
+        Offset last_offset = get_offset(last);
+        if (is_free_block(last)) {
+          remove_from_free_list(last);
+          last[block_header::size] = size_of(last) + growth;
+          mark_as_free(last);
+          add_to_free_list(last);
+        } else if (growth < block_header_size + min_block_size) {
+          resize_allocated(last, size_of(last) + growth);
+        } else {
+          auto& block = get_header(old_sentinel);
+          block[block_header::size] = growth - block_header_size;
+          mark_as_free(block);
+          add_to_free_list(block);
+          last_offset = old_sentinel;
+        }
+        size_ = new_size;
+        new (&sentinel()) block_header_t{};
+        sentinel()[block_header::prev] = last_offset;
+        mark_as_allocated(sentinel());
+      }
+
+      void free_offset(Offset offset) noexcept {
+        assert(0 < offset && offset < size_);
+        count_frees(1);
+        observer_.on_free(offset / byte_multiplier);
+        auto& block = get_header(offset - block_header_size);
+        auto& merged = merge_free_blocks(block); // marks block as free
+        add_to_free_list(merged);
+      }
+
+      // Allocated blocks leave their free list links unused, so deferred frees
+      // can be chained through them before the block is actually freed
+      Offset deferred_link(Offset offset) const {
+        return links(get_header(offset - block_header_size))[block_header::next_free];
+      }
+      void set_deferred_link(Offset offset, Offset next) {
+        links(get_header(offset - block_header_size))[block_header::next_free] = next;
+      }
+
+      // Splits an allocated block into count blocks of block_size (the last one
+      // keeps any excess)
+      template <typename Callback>
+      void carve(block_header_t& block, Offset block_size, std::size_t count, Callback&& callback) {
+        Offset total; bool is_free;
+        std::tie(total, is_free) = get_block_size(block);
+        assert(!is_free);
+        Offset offset = get_offset(block);
+        Offset end = offset + block_header_size + total;
+        Offset last = offset;
+        for (std::size_t i = 0; i < count; ++i) {
+          auto& header = get_header(offset);
+          if (i > 0) {
+            new (&header) block_header_t{};
+            header[block_header::prev] = last;
+          }
+          Offset this_size = i + 1 == count ? end - offset - block_header_size : block_size;
+          header[block_header::size] = this_size;
+          callback(i, offset + block_header_size);
+          last = offset;
+          offset += block_header_size + this_size;
+        }
+        assert(offset == end);
+        get_header(end)[block_header::prev] = last;
+      }
+
+      // Returns the (possibly lower) offset of the resized block, or 0 if the
+      // adjacent blocks cannot make room for it
+      Offset resize_in_place(Offset offset, Offset target_size, std::size_t preserved_bytes) {
+        assert(0 < offset && offset < size_);
+        auto& block = get_header(offset - block_header_size);
+        Offset size; bool is_free;
+        std::tie(size, is_free) = get_block_size(block);
+        assert(!is_free);
+        if (target_size <= size) {
+          shrink(block, target_size);
+          return offset;
+        }
+        auto& next = next_adjacent(block);
+        Offset next_size; bool next_is_free;
+        std::tie(next_size, next_is_free) = get_block_size(next);
+        Offset available = size;
+        if (next_is_free) available += block_header_size + next_size;
+        if (target_size <= available) {
+          absorb_next(block);
+          shrink(block, target_size);
+          return offset;
+        }
+        // Sliding back into a free predecessor still avoids a second block,
+        // but it would lose an aligned block's alignment
+        if (is_aligned_block(block)) return 0;
+        auto& prev = prev_adjacent(block);
+        Offset prev_size; bool prev_is_free;
+        std::tie(prev_size, prev_is_free) = get_block_size(prev);
+        if (!prev_is_free || available + block_header_size + prev_size < target_size) {
+          return 0;
+        }
+        if (next_is_free) absorb_next(block);
+        remove_from_free_list(prev);
+        prev[block_header::size] = prev_size + block_header_size + available;
+        mark_as_allocated(prev);
+        next_adjacent(prev)[block_header::prev] = get_offset(prev);
+        auto new_offset = get_offset(prev) + block_header_size;
+        touch(new_offset, preserved_bytes);
+        std::memmove(
+          &buffer_[new_offset / byte_multiplier], &buffer_[offset / byte_multiplier], preserved_bytes
+        );
+        shrink(prev, target_size);
+        return new_offset;
+      }
+
+      // Merges the free block following an allocated block into it
+      void absorb_next(block_header_t& block) {
+        auto& next = next_adjacent(block);
+        Offset size, next_size; bool is_free, next_is_free;
+        std::tie(size, is_free) = get_block_size(block);
+        std::tie(next_size, next_is_free) = get_block_size(next);
+        assert(!is_free && next_is_free);
+        remove_from_free_list(next);
+        resize_allocated(block, size + block_header_size + next_size);
+        next_adjacent(block)[block_header::prev] = get_offset(block);
+      }
+
+      // Returns the tail of an allocated block to the free list if it is large
+      // enough to hold a block of its own
+      void shrink(block_header_t& block, Offset target_size) {
+        Offset size; bool is_free;
+        std::tie(size, is_free) = get_block_size(block);
+        assert(!is_free && target_size <= size);
+        auto remaining_size = size - target_size;
+        if (remaining_size < block_header_size + min_block_size) return;
+        resize_allocated(block, target_size);
+        auto& remainder = next_adjacent(block);
+        new (&remainder) block_header_t{};
+        remainder[block_header::size] = remaining_size - block_header_size;
+        remainder[block_header::prev] = get_offset(block);
+        next_adjacent(remainder)[block_header::prev] = get_offset(remainder);
+        add_to_free_list(merge_free_blocks(remainder));
+      }
+
       template <typename ...Callbacks>
       auto malloc_helper(std::size_t requested_size, Callbacks... callbacks) {
         auto callback = detail::make_overload(std::move(callbacks)...);
-        Offset target_size = detail::narrow_cast<Offset>(
-          byte_multiplier * detail::align_to(requested_size, alignment)
-        );
-        assert(target_size < size_);
-        Offset offset;
-        auto success = each_free([this, &offset, target_size](auto& block) {
-          if (trim(block, target_size)) {
-            remove_from_free_list(block);
-            mark_as_allocated(block);
-            auto result_offset = get_offset(block) + block_header_size;
-            assert(
-              first_block_offset + block_header_size <= result_offset
-              && result_offset < size_ - target_size
-            );
-            offset = result_offset;
-            return true;
-          } else {
-            return false;
-          }
-        });
-        if (success) {
-          return callback(offset);
+        Offset target_size = block_size_for(requested_size);
+        // A heap may grow, so requests larger than it are not a usage error
+        auto block = target_size < size_ ? find_free_block(target_size) : nullptr;
+        if (block != nullptr) {
+          remove_from_free_list(*block);
+          trim(*block, target_size);
+          mark_as_allocated(*block);
+          count_allocations(1);
+          auto result_offset = get_offset(*block) + block_header_size;
+          assert(
+            first_block_offset() + block_header_size <= result_offset
+            && result_offset < size_ - target_size
+          );
+          observer_.on_malloc(result_offset / byte_multiplier, requested_size);
+          return callback(result_offset);
         } else {
           return callback(make_error_code(error::out_of_space));
         }
       }
 
+      // Finds a block with room for an aligned payload plus a leading gap large
+      // enough to be split off as a free block of its own
+      template <typename ...Callbacks>
+      auto malloc_aligned_helper(
+        std::size_t requested_size, std::size_t requested_alignment, Callbacks... callbacks
+      ) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        assert(requested_alignment != 0 && (requested_alignment & (requested_alignment - 1)) == 0);
+        if (requested_alignment <= alignment) {
+          return malloc_helper(requested_size, callback);
+        }
+        auto unit_alignment = byte_multiplier * requested_alignment;
+        Offset target_size = block_size_for(requested_size);
+        auto search_size = std::size_t{target_size} + unit_alignment + block_header_size + min_block_size;
+        auto block = search_size < size_
+          ? find_free_block(detail::narrow_cast<Offset>(search_size))
+          : nullptr;
+        if (block == nullptr) {
+          return callback(make_error_code(error::out_of_space));
+        }
+        remove_from_free_list(*block);
+        auto payload = std::size_t{get_offset(*block)} + block_header_size;
+        auto aligned = detail::align_to(payload, unit_alignment);
+        if (aligned != payload && aligned - payload < block_header_size + min_block_size) {
+          aligned = detail::align_to(payload + block_header_size + min_block_size, unit_alignment);
+        }
+        if (aligned != payload) {
+          block = &split_free_block(*block, detail::narrow_cast<Offset>(aligned - payload));
+        }
+        trim(*block, target_size);
+        mark_as_allocated(*block);
+        mark_as_aligned(*block);
+        count_allocations(1);
+        observer_.on_malloc(aligned / byte_multiplier, requested_size);
+        return callback(detail::narrow_cast<Offset>(aligned));
+      }
+
+      // Splits the first gap units off a free block (which is not in a free
+      // list) into a free block of its own. Returns the rest, which is not
+      // added to a free list either.
+      block_header_t& split_free_block(block_header_t& block, Offset gap) {
+        Offset size = size_of(block);
+        assert(block_header_size + min_block_size <= gap && gap <= size);
+        auto block_offset = get_offset(block);
+        auto& rest = get_header(block_offset + gap);
+        new (&rest) block_header_t{};
+        rest[block_header::size] = size - gap;
+        rest[block_header::prev] = block_offset;
+        mark_as_free(rest);
+        next_adjacent(rest)[block_header::prev] = get_offset(rest);
+        block[block_header::size] = gap - block_header_size;
+        mark_as_free(block);
+        add_to_free_list(block);
+        return rest;
+      }
+
+      block_header_t* find_free_block(Offset target_size) {
+        std::size_t examined = 0;
+        auto block = std::is_same<Placement, good_fit>::value
+          ? good_fit_search(target_size, examined)
+          : std::is_same<Placement, first_fit>::value
+          ? lowest_fit_search(target_size, examined)
+          : best_fit_search(target_size, examined);
+        auto& bucket = get_index()[free_index::examined][examined_bucket(examined)];
+        bucket = detail::narrow_cast<Offset>(bucket + 1);
+        return block == free_list_end ? nullptr : &get_header(block);
+      }
+
+      // Every block in a class at or above the rounded-up request is large
+      // enough, so the head of the first nonempty class is taken. The last
+      // class is unbounded and is therefore walked, and if nothing is found
+      // the request's own class is walked as a last resort.
+      Offset good_fit_search(Offset target_size, std::size_t& examined) const {
+        auto granules = detail::narrow_cast<Offset>(target_size / granularity);
+        auto start = clamp(size_class::for_request(granules));
+        auto c = start;
+        Offset block = free_list_end;
+        while (block == free_list_end && next_nonempty_class(c)) {
+          block = first_fit_in_class(c, target_size, examined);
+          if (!next_class(c)) break;
+        }
+        auto exact = clamp(size_class::for_block(granules));
+        if (block == free_list_end && (exact.first != start.first || exact.second != start.second)) {
+          block = first_fit_in_class(exact, target_size, examined);
+        }
+        return block;
+      }
+
+      // Every free block that could fit is in the request's own class or above
+      // it. Each class's list is in address order, so its first fitting block
+      // is its lowest, and the lowest of those across all of the classes is
+      // the lowest fitting block in the heap. Above the request's class the
+      // head fits (unless it is the unbounded last class), so this walks one
+      // list and then visits the head of every nonempty class above it.
+      Offset lowest_fit_search(Offset target_size, std::size_t& examined) const {
+        auto granules = detail::narrow_cast<Offset>(target_size / granularity);
+        auto c = clamp(size_class::for_block(granules));
+        Offset lowest = free_list_end;
+        while (next_nonempty_class(c)) {
+          auto block = first_fit_in_class(c, target_size, examined);
+          if (block != free_list_end && (lowest == free_list_end || block < lowest)) {
+            lowest = block;
+          }
+          if (!next_class(c)) break;
+        }
+        return lowest;
+      }
+
+      // Best fit searches the request's own class, and then the next nonempty
+      // class above it (every block of which fits unless it is the unbounded
+      // last class)
+      Offset best_fit_search(Offset target_size, std::size_t& examined) const {
+        auto granules = detail::narrow_cast<Offset>(target_size / granularity);
+        auto c = clamp(size_class::for_block(granules));
+        for (int attempt = 0; attempt < 2 && next_nonempty_class(c); ++attempt) {
+          auto block = best_fit_in_class(c, target_size, examined);
+          if (block != free_list_end) return block;
+          if (!next_class(c)) break;
+        }
+        return free_list_end;
+      }
+
+      // Returns the offset of the smallest block that fits, or free_list_end
+      Offset best_fit_in_class(size_class c, Offset target_size, std::size_t& examined) const {
+        Offset best = free_list_end;
+        Offset best_size = 0;
+        Offset offset = get_class(c.first)[free_class::heads][c.second];
+        while (offset != free_list_end) {
+          ++examined;
+          auto& block = get_header(offset);
+          auto size = size_of(block);
+          if (target_size <= size && (best == free_list_end || size < best_size)) {
+            best = offset;
+            best_size = size;
+            if (size == target_size) break;
+          }
+          offset = links(block)[block_header::next_free];
+        }
+        return best;
+      }
+
+      bool next_class(size_class& c) const {
+        if (++c.second == second_level_count) {
+          c.second = 0;
+          if (++c.first == first_level_count_) return false;
+        }
+        return true;
+      }
+
+      static std::size_t examined_bucket(std::size_t examined) {
+        if (examined <= 1) return examined;
+        return std::min(detail::highest_set_bit(examined - 1) + 2, examined_buckets - 1);
+      }
+
+      // Returns the offset of the first block that fits, or free_list_end
+      Offset first_fit_in_class(size_class c, Offset target_size, std::size_t& examined) const {
+        Offset offset = get_class(c.first)[free_class::heads][c.second];
+        while (offset != free_list_end) {
+          ++examined;
+          auto& block = get_header(offset);
+          Offset size; bool is_free;
+          std::tie(size, is_free) = get_block_size(block);
+          assert(is_free);
+          if (target_size <= size) return offset;
+          offset = links(block)[block_header::next_free];
+        }
+        return free_list_end;
+      }
+
+      // Advances c to the first nonempty class at or above it
+      bool next_nonempty_class(size_class& c) const {
+        auto second_map = detail::bits_from(
+          static_cast<Offset>(get_class(c.first)[free_class::second_level_map]), c.second
+        );
+        if (second_map != 0) {
+          c.second = detail::lowest_set_bit(second_map);
+          return true;
+        }
+        auto first_map = detail::bits_from(
+          static_cast<Offset>(get_index()[free_index::first_level_map]), c.first + 1
+        );
+        if (first_map == 0) return false;
+        c.first = detail::lowest_set_bit(first_map);
+        c.second = detail::lowest_set_bit(
+          static_cast<Offset>(get_class(c.first)[free_class::second_level_map])
+        );
+        return true;
+      }
+
+      // Blocks in the top nonempty class are within one class width of each
+      // other, so only that list needs to be walked
+      Offset largest_free_block() const {
+        Offset first_map = get_index()[free_index::first_level_map];
+        if (first_map == 0) return 0;
+        auto first = detail::highest_set_bit(first_map);
+        auto& free_list = get_class(first);
+        auto second = detail::highest_set_bit(
+          static_cast<Offset>(free_list[free_class::second_level_map])
+        );
+        Offset largest = 0;
+        Offset offset = free_list[free_class::heads][second];
+        while (offset != free_list_end) {
+          auto& block = get_header(offset);
+          Offset size; bool is_free;
+          std::tie(size, is_free) = get_block_size(block);
+          largest = std::max(largest, size);
+          offset = links(block)[block_header::next_free];
+        }
+        return largest;
+      }
+
+      void count_allocations(std::size_t count) {
+        auto& index = get_index();
+        index[free_index::allocated_blocks] = detail::narrow_cast<Offset>(
+          index[free_index::allocated_blocks] + count
+        );
+        index[free_index::malloc_count] = detail::narrow_cast<Offset>(
+          index[free_index::malloc_count] + count
+        );
+      }
+
+      void count_frees(std::size_t count) {
+        auto& index = get_index();
+        index[free_index::allocated_blocks] = detail::narrow_cast<Offset>(
+          index[free_index::allocated_blocks] - count
+        );
+        index[free_index::free_count] = detail::narrow_cast<Offset>(
+          index[free_index::free_count] + count
+        );
+      }
+
+      void count_realloc() {
+        auto& index = get_index();
+        index[free_index::realloc_count] = index[free_index::realloc_count] + 1;
+      }
+
+      // Takes back the malloc and the free that moving a range made, so that
+      // the move is only counted as a realloc
+      void uncount_move() {
+        auto& index = get_index();
+        index[free_index::malloc_count] = index[free_index::malloc_count] - 1;
+        index[free_index::free_count] = index[free_index::free_count] - 1;
+      }
+
+      size_class clamp(size_class c) const {
+        if (c.first < first_level_count_) return c;
+        return {first_level_count_ - 1, second_level_count - 1};
+      }
+
+      size_class class_of(block_header_t const& block) const {
+        Offset size; bool is_free;
+        std::tie(size, is_free) = get_block_size(block);
+        return clamp(size_class::for_block(size / granularity));
+      }
+
       template <typename Self, typename Callback>
       static bool each_free(Self&& self, Callback&& callback) {
-        Offset offset = self.get_header(list_head_offset)[block_header::next_free];
-        while (offset != list_head_offset) {
-          assert(0 < offset && offset < self.size_);
-          auto& block = self.get_header(offset);
-          if (callback(block)) {
-            return true;
+        for (std::size_t first = 0; first < self.first_level_count_; ++first) {
+          for (std::size_t second = 0; second < second_level_count; ++second) {
+            Offset offset = self.get_class(first)[free_class::heads][second];
+            while (offset != free_list_end) {
+              assert(0 < offset && offset < self.size_);
+              auto& block = self.get_header(offset);
+              if (callback(block)) {
+                return true;
+              }
+              offset = self.links(block)[block_header::next_free];
+            }
           }
-          offset = block[block_header::next_free];
         }
         return false;
       }
@@ -210,66 +1344,158 @@ namespace nocopy {
         return (reinterpret_cast<std::uintptr_t>(buffer) & (alignment - 1)) == 0;
       }
 
-      static bool is_heap_big_enough(Offset size) {
-        return initial_bookkeeping < size;
+      static bool is_heap_big_enough(Offset size, std::size_t first_level_count) {
+        auto bookkeeping = index_size(first_level_count) + 3 * block_header_size + min_block_size;
+        return bookkeeping < size;
+      }
+
+      static std::size_t first_level_count_for(Offset size) {
+        return size_class::first_level_count(detail::narrow_cast<Offset>(size / granularity));
+      }
+
+      static Offset index_size(std::size_t first_level_count) {
+        return detail::narrow_cast<Offset>(
+          byte_multiplier * detail::align_to(
+            sizeof(free_index_t) + first_level_count * sizeof(free_class_t), alignment
+          )
+        );
       }
 
-      static bool is_heap_too_big(Offset size) {
+      static bool is_heap_too_big(std::size_t size) {
         return std::numeric_limits<Offset>::max() / byte_multiplier < size;
       }
 
       void init() {
-        new (&buffer_[list_head_offset]) block_header_t{};
-        new (&buffer_[first_block_offset]) block_header_t{};
-        new (&buffer_[sentinel_offset()]) block_header_t{};
-        list_head()[block_header::prev_free] = list_head_offset;
-        list_head()[block_header::next_free] = list_head_offset;
-        first_block()[block_header::size] = size_ - initial_bookkeeping;
-        mark_as_allocated(list_head());
+        new (&get_index()) free_index_t{};
+        for (std::size_t i = 0; i < first_level_count_; ++i) {
+          new (&get_class(i)) free_class_t{};
+        }
+        get_index()[free_index::first_level_count] = first_level_count_;
+        get_index()[free_index::header_layout] = header_layout_tag;
+        new (&guard()) block_header_t{};
+        new (&first_block()) block_header_t{};
+        new (&sentinel()) block_header_t{};
+        first_block()[block_header::size]
+          = sentinel_offset() - first_block_offset() - block_header_size;
+        first_block()[block_header::prev] = guard_offset();
+        sentinel()[block_header::prev] = first_block_offset();
+        mark_as_allocated(guard());
         mark_as_free(first_block());
         mark_as_allocated(sentinel());
         add_to_free_list(first_block());
       }
 
-      block_header_t const& list_head() const {
-        return get_header(list_head_offset);
+      free_index_t const& get_index() const {
+        return reinterpret_cast<free_index_t const&>(buffer_[0]);
+      }
+      free_index_t& get_index() {
+        touch(0, sizeof(free_index_t));
+        return const_cast<free_index_t&>(static_cast<heap const&>(*this).get_index());
+      }
+
+      free_class_t const& get_class(std::size_t first) const {
+        assert(first < first_level_count_);
+        return reinterpret_cast<free_class_t const&>(
+          buffer_[sizeof(free_index_t) + first * sizeof(free_class_t)]
+        );
+      }
+      free_class_t& get_class(std::size_t first) {
+        auto offset = sizeof(free_index_t) + first * sizeof(free_class_t);
+        touch(detail::narrow_cast<Offset>(byte_multiplier * offset), sizeof(free_class_t));
+        return const_cast<free_class_t&>(static_cast<heap const&>(*this).get_class(first));
+      }
+
+      Offset guard_offset() const {
+        return index_size(first_level_count_);
+      }
+
+      block_header_t const& guard() const {
+        return get_header(guard_offset());
       }
-      block_header_t& list_head() {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).list_head());
+      block_header_t& guard() {
+        return writable(static_cast<heap const&>(*this).guard());
+      }
+
+      Offset first_block_offset() const {
+        return guard_offset() + block_header_size;
       }
 
       block_header_t const& first_block() const {
-        return get_header(first_block_offset);
+        return get_header(first_block_offset());
       }
       block_header_t& first_block() {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).first_block());
+        return writable(static_cast<heap const&>(*this).first_block());
       }
 
-      // LIFO
+      // LIFO within each size class, or in address order for first fit,
+      // which walks the class's list to find the block's place
       void add_to_free_list(block_header_t& block) {
-        auto& head = list_head();
-        auto& next = next_free(head);
-        block[block_header::next_free] = head[block_header::next_free];
-        block[block_header::prev_free] = next[block_header::prev_free];
+        auto c = class_of(block);
+        auto& free_list = get_class(c.first);
+        auto& head = free_list[free_class::heads][c.second];
         auto block_offset = get_offset(block);
-        head[block_header::next_free] = block_offset;
-        next[block_header::prev_free] = block_offset;
+        Offset prev = free_list_end;
+        Offset next = head;
+        if (address_ordered) {
+          auto const& self = static_cast<heap const&>(*this);
+          while (next != free_list_end && next < block_offset) {
+            prev = next;
+            next = self.links(self.get_header(next))[block_header::next_free];
+          }
+        }
+        auto& block_links = links(block);
+        block_links[block_header::next_free] = next;
+        block_links[block_header::prev_free] = prev;
+        if (next != free_list_end) {
+          links(get_header(next))[block_header::prev_free] = block_offset;
+        }
+        if (prev != free_list_end) {
+          links(get_header(prev))[block_header::next_free] = block_offset;
+        } else {
+          head = block_offset;
+        }
+        free_list[free_class::second_level_map] |= Offset{1} << c.second;
+        auto& index = get_index();
+        index[free_index::first_level_map] |= Offset{1} << c.first;
+        index[free_index::free_bytes] = index[free_index::free_bytes] + size_of(block);
+        index[free_index::free_blocks] = index[free_index::free_blocks] + 1;
       }
 
+      // The block's size must not have changed since it was added
       void remove_from_free_list(block_header_t& block) {
-        auto& prev = prev_free(block);
-        auto& next = next_free(block);
-        prev[block_header::next_free] = block[block_header::next_free];
-        next[block_header::prev_free] = block[block_header::prev_free];
+        auto& index = get_index();
+        index[free_index::free_bytes] = index[free_index::free_bytes] - size_of(block);
+        index[free_index::free_blocks] = index[free_index::free_blocks] - 1;
+        auto const& block_links = static_cast<heap const&>(*this).links(block);
+        Offset prev = block_links[block_header::prev_free];
+        Offset next = block_links[block_header::next_free];
+        if (next != free_list_end) {
+          links(get_header(next))[block_header::prev_free] = prev;
+        }
+        if (prev != free_list_end) {
+          links(get_header(prev))[block_header::next_free] = next;
+          return;
+        }
+        auto c = class_of(block);
+        auto& free_list = get_class(c.first);
+        free_list[free_class::heads][c.second] = next;
+        if (next == free_list_end) {
+          free_list[free_class::second_level_map] &= ~(Offset{1} << c.second);
+          if (static_cast<Offset>(free_list[free_class::second_level_map]) == 0) {
+            get_index()[free_index::first_level_map] &= ~(Offset{1} << c.first);
+          }
+        }
       }
 
-      bool trim(block_header_t& block, Offset target_size) {
+      // Splits off any usable remainder of a block that is no longer in the
+      // free list
+      void trim(block_header_t& block, Offset target_size) {
         Offset block_size; bool is_free;
         std::tie(block_size, is_free) = get_block_size(block);
         assert(is_free);
-        if (target_size > block_size) return false;
+        assert(target_size <= block_size);
         auto remaining_size = block_size - target_size;
-        if (remaining_size >= block_header_size) {
+        if (remaining_size >= block_header_size + min_block_size) {
           block[block_header::size] = target_size;
           auto& remainder = next_adjacent(block);
           remainder[block_header::size] = remaining_size - block_header_size;
@@ -279,7 +1505,6 @@ namespace nocopy {
           mark_as_free(remainder);
           add_to_free_list(remainder);
         }
-        return true;
       }
 
       block_header_t& merge_free_blocks(block_header_t& block) {
@@ -321,49 +1546,63 @@ namespace nocopy {
         }
       }
 
-      block_header_t const& next_free(block_header_t const& block) const {
-        return get_header(block[block_header::next_free]);
-      }
-      block_header_t& next_free(block_header_t const& block) {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).next_free(block));
-      }
-
-      block_header_t const& prev_free(block_header_t const& block) const {
-        return get_header(block[block_header::prev_free]);
-      }
-      block_header_t& prev_free(block_header_t const& block) {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).prev_free(block));
-      }
-
       block_header_t const& next_adjacent(block_header_t const& block) const {
         Offset size; bool is_free;
         std::tie(size, is_free) = get_block_size(block);
         return get_header(get_offset(block) + block_header_size + size);
       }
       block_header_t& next_adjacent(block_header_t const& block) {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).next_adjacent(block));
+        return writable(static_cast<heap const&>(*this).next_adjacent(block));
       }
 
       block_header_t const& prev_adjacent(block_header_t const& block) const {
         return get_header(block[block_header::prev]);
       }
       block_header_t& prev_adjacent(block_header_t const& block) {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).prev_adjacent(block));
+        return writable(static_cast<heap const&>(*this).prev_adjacent(block));
       }
 
+      // Sizes are multiples of granularity, so the low bits of the size field
+      // are free for flags: bit 0 marks a free block, and bit 1 an allocated
+      // block from malloc_aligned that must not move.
+      static constexpr Offset free_flag = 1;
+      static constexpr Offset aligned_flag = 2;
+      static_assert(granularity >= 4, "Block sizes need two spare bits for flags");
+
       static std::tuple<Offset, bool> get_block_size(block_header_t const& block) {
         Offset s = block[block_header::size];
-        Offset size = s & ~Offset{1};
-        bool is_free = (s & Offset{1}) == 1;
+        Offset size = s & ~(free_flag | aligned_flag);
+        bool is_free = (s & free_flag) != 0;
         return std::make_tuple(size, is_free);
       }
 
+      static Offset size_of(block_header_t const& block) {
+        return block[block_header::size] & ~(free_flag | aligned_flag);
+      }
+
+      // Changes the size of an allocated block, keeping its aligned flag
+      static void resize_allocated(block_header_t& block, Offset size) {
+        block[block_header::size] = size | (block[block_header::size] & aligned_flag);
+      }
+
+      static bool is_aligned_block(block_header_t const& block) {
+        return (block[block_header::size] & aligned_flag) != 0;
+      }
+
+      static void mark_as_aligned(block_header_t& block) {
+        block[block_header::size] |= aligned_flag;
+      }
+
+      static bool is_free_block(block_header_t const& block) {
+        return (block[block_header::size] & free_flag) != 0;
+      }
+
       static void mark_as_free(block_header_t& block) {
-        block[block_header::size] |= Offset{1};
+        block[block_header::size] = (block[block_header::size] & ~aligned_flag) | free_flag;
       }
 
       static void mark_as_allocated(block_header_t& block) {
-        block[block_header::size] &= ~Offset{1};
+        block[block_header::size] &= ~free_flag;
       }
 
       Offset sentinel_offset() const {
@@ -374,7 +1613,7 @@ namespace nocopy {
         return get_header(sentinel_offset());
       }
       block_header_t& sentinel() {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).sentinel());
+        return writable(static_cast<heap const&>(*this).sentinel());
       }
 
       Offset get_offset(block_header_t const& block) const {
@@ -386,43 +1625,109 @@ namespace nocopy {
         return reinterpret_cast<block_header_t&>(buffer_[offset / byte_multiplier]);
       }
       block_header_t& get_header(Offset offset) {
-        return const_cast<block_header_t&>(static_cast<heap const&>(*this).get_header(offset));
+        return writable(static_cast<heap const&>(*this).get_header(offset));
+      }
+
+      links_t const& links(block_header_t const& block) const {
+        return reinterpret_cast<links_t const&>(
+          buffer_[(get_offset(block) + links_offset) / byte_multiplier]
+        );
+      }
+      links_t& links(block_header_t const& block) {
+        touch(get_offset(block) + links_offset, sizeof(links_t));
+        return const_cast<links_t&>(static_cast<heap const&>(*this).links(block));
+      }
+
+      // The size of the block that holds requested_size bytes
+      static Offset block_size_for(std::size_t requested_size) {
+        return std::max(
+          Offset{min_block_size}
+        , detail::narrow_cast<Offset>(byte_multiplier * detail::align_to(requested_size, alignment))
+        );
+      }
+
+      template <typename X>
+      X const& object_at(Offset offset) const {
+        return reinterpret_cast<X const&>(buffer_[offset / byte_multiplier]);
+      }
+      template <typename X>
+      X& object_at(Offset offset) {
+        touch(offset, sizeof(X));
+        return const_cast<X&>(static_cast<heap const&>(*this).template object_at<X>(offset));
+      }
+
+      template <typename T>
+      static std::size_t bytes_of(single_reference<T> const&) { return sizeof(T); }
+      template <typename T>
+      static std::size_t bytes_of(range_reference<T> const& ref) {
+        return sizeof(T) * static_cast<Offset>(ref[reference::count_field]);
+      }
+
+      // Every non-const header accessor goes through here, so that the
+      // observer sees header writes
+      block_header_t& writable(block_header_t const& block) {
+        touch(get_offset(block), sizeof(block_header_t));
+        return const_cast<block_header_t&>(block);
+      }
+
+      void touch(Offset offset, std::size_t bytes) {
+        observer_.on_write(offset / byte_multiplier, bytes);
       }
 
       // Size is either in bytes or bits depending on AssumeSameSizedByte
       template <typename ...Callbacks>
       static auto create_helper(
-        bool do_init, unsigned char* buffer, std::size_t size, Callbacks... callbacks
+        bool do_init, std::size_t max_size, unsigned char* buffer, std::size_t size
+      , Callbacks... callbacks
       ) noexcept {
         auto callback = detail::make_overload(std::move(callbacks)...);
-        auto aligned_size = detail::narrow_cast<Offset>(
-          detail::align_backward(size / byte_multiplier, alignment)
+        auto aligned_size = detail::align_backward(size / byte_multiplier, alignment);
+        auto aligned_max_size = std::max(
+          aligned_size, detail::align_backward(max_size / byte_multiplier, alignment)
         );
         if (!is_aligned(buffer)) {
           return callback(make_error_code(error::heap_not_aligned));
-        } else if (!is_heap_big_enough(aligned_size) || is_heap_too_big(aligned_size)) {
+        } else if (is_heap_too_big(aligned_max_size)) {
           return callback(make_error_code(error::bad_heap_size));
-        } else {
-          heap result{buffer, aligned_size};
-          if (do_init) result.init();
-          return callback(result);
-        };
+        }
+        heap result{buffer, detail::narrow_cast<Offset>(aligned_size * byte_multiplier)};
+        if (do_init) {
+          result.first_level_count_ = first_level_count_for(
+            detail::narrow_cast<Offset>(aligned_max_size * byte_multiplier)
+          );
+        } else if (index_size(0) < result.size_) {
+          auto& index = result.get_index();
+          if (index[free_index::header_layout] != header_layout_tag) {
+            return callback(make_error_code(error::heap_layout_mismatch));
+          }
+          result.first_level_count_ = index[free_index::first_level_count];
+        }
+        if (!is_heap_big_enough(result.size_, result.first_level_count_)) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        if (do_init) result.init();
+        return callback(result);
       }
 
-      heap(unsigned char* buffer, Offset size) : buffer_{buffer}, size_{size} {}
+      heap(unsigned char* buffer, Offset size)
+        : buffer_{buffer}, size_{size}, first_level_count_{0} {}
 
       unsigned char* buffer_;
       Offset size_;
+      std::size_t first_level_count_;
+      Observer observer_;
     };
   }
 
 #ifdef UINT32_MAX
   using heap32 = detail::heap<uint32_t, uint32_t, true>; // assumes CHAR_BIT == 8 (has larger capacity)
   using pedantic_heap32 = detail::heap<uint32_t, uint32_t, false>; // supports CHAR_BIT != 8 (smaller capacity)
+  using compact_heap32 = detail::heap<uint32_t, uint32_t, true, detail::null_heap_observer, detail::compact_block_headers>;
 #endif
 #ifdef UINT64_MAX
   using heap64 = detail::heap<uint64_t, uint64_t, true>; // assumes CHAR_BIT == 8 (has larger capacity)
   using pedantic_heap64 = detail::heap<uint64_t, uint64_t, false>; // supports CHAR_BIT != 8 (smaller capacity)
+  using compact_heap64 = detail::heap<uint64_t, uint64_t, true, detail::null_heap_observer, detail::compact_block_headers>;
 #endif
 }
 
@@ -0,0 +1,159 @@
+#ifndef UUID_DF4A8FA8_0541_482E_933D_20CE380B759E
+#define UUID_DF4A8FA8_0541_482E_933D_20CE380B759E
+
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/field.hpp>
+#include <nocopy/heap.hpp>
+#include <nocopy/structpack.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace nocopy {
+  enum class trace_op : uint8_t { malloc, free };
+
+  // One event of a heap trace. Times are in nanoseconds since the recorder
+  // was created (or last cleared), offsets are in bytes, and size is the
+  // requested size of a malloc (and zero for a free).
+  struct trace_event {
+    trace_op op;
+    uint64_t time;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  namespace detail {
+    // The op is stored as a full 64 bit field so that a record has no
+    // padding, and the same events always produce the same bytes
+    struct trace_record {
+      NOCOPY_FIELD(time, uint64_t);
+      NOCOPY_FIELD(offset, uint64_t);
+      NOCOPY_FIELD(size, uint64_t);
+      NOCOPY_FIELD(op, uint64_t);
+      using type = structpack<time_t, offset_t, size_t, op_t>;
+    };
+    using trace_record_t = typename trace_record::type;
+    static_assert(sizeof(trace_record_t) == 4 * sizeof(uint64_t), "trace records must not be padded");
+  }
+
+  // Collects a heap's mallocs and frees as a binary trace of fixed-size
+  // little-endian records, which read_trace turns back into trace_events.
+  // Room for max_events events is reserved up front, since the heap reports
+  // events from noexcept frees, so recording never allocates. Events past
+  // that are dropped and counted.
+  class trace_recorder final {
+  public:
+    static constexpr std::size_t default_max_events = std::size_t{1} << 16;
+
+    explicit trace_recorder(std::size_t max_events = default_max_events)
+      : start_{clock_type::now()} {
+      trace_.reserve(max_events * sizeof(detail::trace_record_t));
+    }
+
+    void record(trace_op op, std::size_t offset, std::size_t size) noexcept {
+      detail::trace_record_t record{};
+      auto position = trace_.size();
+      if (trace_.capacity() - position < sizeof(record)) {
+        ++dropped_;
+        return;
+      }
+      record[detail::trace_record::time] = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start_).count()
+      );
+      record[detail::trace_record::offset] = offset;
+      record[detail::trace_record::size] = size;
+      record[detail::trace_record::op] = static_cast<uint64_t>(op);
+      trace_.insert(
+        trace_.end()
+      , reinterpret_cast<unsigned char const*>(&record)
+      , reinterpret_cast<unsigned char const*>(&record) + sizeof(record)
+      );
+    }
+
+    std::vector<unsigned char> const& trace() const noexcept { return trace_; }
+
+    // The number of events that didn't fit
+    std::size_t dropped() const noexcept { return dropped_; }
+
+    void clear() noexcept {
+      trace_.clear();
+      dropped_ = 0;
+      start_ = clock_type::now();
+    }
+
+  private:
+    using clock_type = std::chrono::steady_clock;
+
+    clock_type::time_point start_;
+    std::vector<unsigned char> trace_;
+    std::size_t dropped_ = 0;
+  };
+
+  namespace detail {
+    // A heap observer that records allocations in a trace_recorder (if one
+    // has been set)
+    struct trace_observer {
+      void on_write(std::size_t, std::size_t) noexcept {}
+      void on_malloc(std::size_t offset, std::size_t size) noexcept {
+        if (recorder != nullptr) recorder->record(trace_op::malloc, offset, size);
+      }
+      void on_free(std::size_t offset) noexcept {
+        if (recorder != nullptr) recorder->record(trace_op::free, offset, 0);
+      }
+
+      trace_recorder* recorder = nullptr;
+    };
+  }
+
+  // Heaps that record their allocations. Attach a recorder with
+  // heap.observer().recorder = &recorder. Other heaps pay nothing, since the
+  // default observer's hooks are empty.
+#ifdef UINT32_MAX
+  using traced_heap32 = detail::heap<uint32_t, uint32_t, true, detail::trace_observer>;
+#endif
+#ifdef UINT64_MAX
+  using traced_heap64 = detail::heap<uint64_t, uint64_t, true, detail::trace_observer>;
+#endif
+
+  // Calls on_event for each event of a trace. The trace is checked in full
+  // first, so on_event is never called for a malformed trace.
+  template <typename OnEvent, typename ...Callbacks>
+  auto read_trace(
+    unsigned char const* trace, std::size_t size, OnEvent&& on_event, Callbacks... callbacks
+  ) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    constexpr auto record_size = sizeof(detail::trace_record_t);
+    auto each_record = [&](auto&& on_record) {
+      for (std::size_t position = 0; position < size; position += record_size) {
+        alignas(detail::trace_record_t) unsigned char raw[record_size];
+        std::memcpy(raw, trace + position, record_size);
+        on_record(reinterpret_cast<detail::trace_record_t const&>(raw));
+      }
+    };
+    bool valid = size % record_size == 0;
+    if (valid) {
+      each_record([&](detail::trace_record_t const& record) {
+        uint64_t op = record[detail::trace_record::op];
+        valid = valid && op <= static_cast<uint64_t>(trace_op::free);
+      });
+    }
+    if (!valid) {
+      return callback(make_error_code(error::bad_trace));
+    }
+    each_record([&](detail::trace_record_t const& record) {
+      uint64_t op = record[detail::trace_record::op];
+      on_event(trace_event{
+        static_cast<trace_op>(op)
+      , record[detail::trace_record::time]
+      , record[detail::trace_record::offset]
+      , record[detail::trace_record::size]
+      });
+    });
+    return callback();
+  }
+}
+
+#endif
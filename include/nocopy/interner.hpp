@@ -0,0 +1,136 @@
+#ifndef UUID_9E4C0B7A_2D61_4F3E_8A55_C1B7E0F3D942
+#define UUID_9E4C0B7A_2D61_4F3E_8A55_C1B7E0F3D942
+
+#include <nocopy/fwd/archive.hpp>
+
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+
+namespace nocopy {
+  namespace detail {
+    // Deduplicates the strings and ranges added to an archive. It is kept
+    // beside the archive and used in place of the archive's add: contents
+    // seen before return the reference from the first time, and only new
+    // contents are added to the archive.
+    //
+    // Contents are keyed by their bytes along with the size and alignment of
+    // their type, so identical ranges of types with the same layout share
+    // storage. Keys are copied, so the archive's data is never read (which
+    // means streaming archives work too). Since every caller shares the
+    // interned data, ranges are returned as range_reference<T const>.
+    //
+    // The interner cannot see the archive shrink. Clear it whenever the
+    // archive is reset, and pass it the same cursor whenever the archive is
+    // truncated.
+    template <typename Offset>
+    class interner final {
+      using reference = detail::reference<Offset>;
+
+    public:
+      template <typename Archive, typename ...Callbacks>
+      auto add(Archive& archive, char const* str, std::size_t len, Callbacks... callbacks) {
+        assert(str != nullptr);
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto count = detail::narrow_cast<Offset>(len + 1);
+        make_key<char>(str, len);
+        key_.push_back('\0');
+        auto found = entries_.find(key_);
+        if (found != entries_.end()) {
+          return callback(reference::template create_range<char const>(found->second, count));
+        }
+        return archive.add(
+          str, len
+        , [&](auto ref) {
+            entries_.emplace(key_, static_cast<Offset>(ref));
+            return callback(ref);
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename Archive, typename ...Callbacks>
+      auto add(Archive& archive, std::string const& str, Callbacks... callbacks) {
+        return this->add(archive, str.c_str(), str.length(), callbacks...);
+      }
+
+      template <typename Archive, typename T, typename ...Callbacks>
+      auto add(Archive& archive, gsl::span<T> in, Callbacks... callbacks) {
+        using U = std::remove_const_t<T>;
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto count = detail::narrow_cast<Offset>(in.length());
+        make_key<U>(reinterpret_cast<char const*>(in.data()), sizeof(U) * count);
+        auto found = entries_.find(key_);
+        if (found != entries_.end()) {
+          return callback(reference::template create_range<U const>(found->second, count));
+        }
+        return archive.add(
+          in
+        , [&](auto ref) {
+            auto offset = static_cast<Offset>(ref);
+            entries_.emplace(key_, offset);
+            return callback(reference::template create_range<U const>(offset, count));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      // The number of distinct contents added
+      std::size_t size() const noexcept { return entries_.size(); }
+
+      void clear() noexcept { entries_.clear(); }
+
+      // Forgets the contents that an archive truncate(cursor_value) discards,
+      // i.e., any that do not end by cursor_value. This walks every entry.
+      void truncate(Offset cursor_value) noexcept {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+          auto length = it->first.size() - layout_size;
+          if (it->second + length > cursor_value) {
+            it = entries_.erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+
+    private:
+      // Each key starts with the size and alignment of its type
+      static constexpr std::size_t layout_size = 2 * sizeof(std::size_t);
+
+      // The key is built in a member so that lookups reuse its storage
+      template <typename T>
+      void make_key(char const* bytes, std::size_t length) {
+        detail::assert_valid_type<T>();
+        std::size_t const layout[] = {sizeof(T), detail::alignment_for<T>()};
+        static_assert(sizeof(layout) == layout_size, "");
+        key_.assign(reinterpret_cast<char const*>(layout), sizeof(layout));
+        key_.append(bytes, length);
+      }
+
+      std::unordered_map<std::string, Offset> entries_;
+      std::string key_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using interner32 = detail::interner<uint32_t>;
+#endif
+#ifdef UINT64_MAX
+  using interner64 = detail::interner<uint64_t>;
+#endif
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef UUID_3B8E6F21_7C4D_4A90_9E15_D84C2A6B07F3
+#define UUID_3B8E6F21_7C4D_4A90_9E15_D84C2A6B07F3
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <system_error>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace nocopy {
+  // Scatter-gather I/O for archive images (POSIX only). An image (from an
+  // archive's image()) is a single contiguous range, so each archive takes
+  // one iovec, and many archives can go out in one writev or sendmsg.
+  inline iovec image_iovec(gsl::span<unsigned char const> image) noexcept {
+    return {const_cast<unsigned char*>(image.data()), static_cast<std::size_t>(image.size())};
+  }
+
+  template <typename Archive>
+  iovec image_iovec(Archive const& archive) noexcept {
+    return image_iovec(archive.image());
+  }
+
+  // Writes every iovec with writev, resuming after partial writes and
+  // interrupts. The iovecs are consumed (advanced past what was written).
+  inline std::error_code write_iovecs(int fd, iovec* iovecs, std::size_t count) noexcept {
+#ifdef IOV_MAX
+    constexpr std::size_t max_batch = IOV_MAX;
+#else
+    constexpr std::size_t max_batch = 16;
+#endif
+    while (count != 0) {
+      if (iovecs->iov_len == 0) {
+        ++iovecs;
+        --count;
+        continue;
+      }
+      auto written = ::writev(fd, iovecs, static_cast<int>(std::min(count, max_batch)));
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return {errno, std::system_category()};
+      }
+      auto remaining = static_cast<std::size_t>(written);
+      while (remaining != 0 && remaining >= iovecs->iov_len) {
+        remaining -= iovecs->iov_len;
+        ++iovecs;
+        --count;
+      }
+      if (remaining != 0) {
+        iovecs->iov_base = static_cast<unsigned char*>(iovecs->iov_base) + remaining;
+        iovecs->iov_len -= remaining;
+      }
+    }
+    return {};
+  }
+}
+
+#endif
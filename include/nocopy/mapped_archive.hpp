@@ -0,0 +1,95 @@
+#ifndef UUID_8F8DBFB6_FF47_4F2F_8A24_99C1A5A342C1
+#define UUID_8F8DBFB6_FF47_4F2F_8A24_99C1A5A342C1
+
+#include <nocopy/archive_view.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/errors.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nocopy {
+  namespace detail {
+    // An archive image file mapped read-only (POSIX only). Opening it maps
+    // the file and checks the header, so it costs the same for any size, and
+    // pages are only read from disk as they are derefed.
+    template <typename Offset>
+    class mapped_archive final {
+    public:
+      using view_type = archive_view<Offset>;
+
+      mapped_archive(mapped_archive&& other) noexcept
+        : base_{other.base_}, size_{other.size_}, view_{other.view_} {
+        other.base_ = nullptr;
+      }
+      mapped_archive& operator=(mapped_archive&&) = delete;
+      ~mapped_archive() {
+        if (base_ != nullptr) ::munmap(base_, size_);
+      }
+
+      template <typename ...Callbacks>
+      static auto open(char const* path, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return callback(last_error());
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+          auto e = last_error();
+          ::close(fd);
+          return callback(e);
+        }
+        auto size = static_cast<std::size_t>(status.st_size);
+        if (size == 0) {
+          ::close(fd);
+          return callback(make_error_code(error::bad_archive));
+        }
+        auto address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        auto e = last_error();
+        ::close(fd); // the mapping keeps the file open
+        if (address == MAP_FAILED) return callback(e);
+        auto base = static_cast<unsigned char*>(address);
+        return view_type::open(
+          base, size
+        , [&](view_type view) { return callback(mapped_archive{base, size, view}); }
+        , [&](std::error_code error) {
+            ::munmap(base, size);
+            return callback(error);
+          }
+        );
+      }
+
+      view_type const& view() const noexcept { return view_; }
+
+      unsigned char const* data() const noexcept { return base_; }
+      std::size_t size() const noexcept { return size_; }
+
+    private:
+      mapped_archive(unsigned char* base, std::size_t size, view_type view) noexcept
+        : base_{base}, size_{size}, view_{view} {}
+
+      static std::error_code last_error() noexcept {
+        return std::error_code{errno, std::system_category()};
+      }
+
+      unsigned char* base_;
+      std::size_t size_;
+      view_type view_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using mapped_archive32 = detail::mapped_archive<uint32_t>;
+#endif
+#ifdef UINT64_MAX
+  using mapped_archive64 = detail::mapped_archive<uint64_t>;
+#endif
+}
+
+#endif
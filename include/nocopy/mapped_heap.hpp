@@ -0,0 +1,246 @@
+#ifndef UUID_75BC75D1_C02E_4C23_901E_305724A1D2E5
+#define UUID_75BC75D1_C02E_4C23_901E_305724A1D2E5
+
+#include <nocopy/fwd/mapped_heap.hpp>
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/errors.hpp>
+#include <nocopy/heap.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nocopy {
+  namespace detail {
+    // A heap kept in a memory-mapped file (POSIX only), so it persists without
+    // being copied, and reopening it takes the same time regardless of its
+    // size. Address space for max_size bytes is reserved up front and the
+    // file is mapped at its start, so growing the heap extends the file and
+    // maps the new pages in place. The buffer never moves, and references
+    // and derefed pointers remain valid across a grow.
+    template <typename Offset, typename AlignmentType, bool AssumeSameSizedByte>
+    class mapped_heap final {
+      static constexpr std::size_t byte_multiplier = AssumeSameSizedByte ? 1 : CHAR_BIT;
+    #ifdef MAP_NORESERVE
+      static constexpr int reserve_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    #else
+      static constexpr int reserve_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    #endif
+
+      class mapping final {
+      public:
+        explicit mapping(int fd) noexcept : fd_{fd} {}
+        mapping(mapping&& other) noexcept
+          : fd_{other.fd_}, base_{other.base_}, reserved_{other.reserved_}, size_{other.size_} {
+          other.fd_ = -1;
+          other.base_ = nullptr;
+        }
+        mapping& operator=(mapping&&) = delete;
+        ~mapping() {
+          if (base_ != nullptr) ::munmap(base_, reserved_);
+          if (fd_ >= 0) ::close(fd_);
+        }
+
+        int fd_;
+        unsigned char* base_ = nullptr;
+        std::size_t reserved_ = 0;
+        std::size_t size_ = 0;
+      };
+
+    public:
+      using heap_type = ::nocopy::detail::heap<Offset, AlignmentType, AssumeSameSizedByte>;
+      using offset_t = Offset; // for client code
+
+      template <typename T>
+      using single_reference = typename heap_type::template single_reference<T>;
+
+      template <typename T>
+      using range_reference = typename heap_type::template range_reference<T>;
+
+      mapped_heap(mapped_heap&&) = default;
+      mapped_heap& operator=(mapped_heap&&) = delete;
+
+      // Creates (or truncates) the file at path. Sizes are in bytes.
+      template <typename ...Callbacks>
+      static auto create(
+        char const* path, std::size_t size, std::size_t max_size, Callbacks... callbacks
+      ) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return open_helper(true, path, size, max_size, callback);
+      }
+
+      // Opens a file written by create. The whole file is the heap.
+      template <typename ...Callbacks>
+      static auto open(char const* path, std::size_t max_size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return open_helper(false, path, 0, max_size, callback);
+      }
+
+      heap_type& heap() noexcept { return *heap_; }
+      heap_type const& heap() const noexcept { return *heap_; }
+
+      unsigned char* data() const noexcept { return mapping_.base_; }
+      std::size_t size() const noexcept { return mapping_.size_; }
+      std::size_t max_size() const noexcept { return mapping_.reserved_; }
+
+      // Extends the file to size bytes and adds the new space to the heap. On
+      // failure the file and the mapping are returned to their old size.
+      template <typename ...Callbacks>
+      auto grow(std::size_t size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        auto old_size = mapping_.size_;
+        if (size < old_size || mapping_.reserved_ < size) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        // The mapping already covers the page holding the old end of the file
+        auto mapped = detail::align_to(old_size, page_size());
+        if (::ftruncate(mapping_.fd_, static_cast<off_t>(size)) != 0) {
+          return callback(last_error());
+        }
+        if (mapped < size) {
+          auto address = ::mmap(
+            mapping_.base_ + mapped, size - mapped, PROT_READ | PROT_WRITE
+          , MAP_SHARED | MAP_FIXED, mapping_.fd_, static_cast<off_t>(mapped)
+          );
+          if (address == MAP_FAILED) {
+            auto e = last_error();
+            unmap_from(mapped, size);
+            shrink(old_size);
+            return callback(e);
+          }
+        }
+        return heap_->grow(
+          mapping_.base_, size * byte_multiplier
+        , [&]() {
+            mapping_.size_ = size;
+            return callback();
+          }
+        , [&](std::error_code e) {
+            unmap_from(mapped, size);
+            shrink(old_size);
+            return callback(e);
+          }
+        );
+      }
+
+      // Writes modified pages back to the file. The kernel tracks which pages
+      // are dirty, so only those are written.
+      template <typename ...Callbacks>
+      auto sync(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        if (::msync(mapping_.base_, mapping_.size_, MS_SYNC) != 0) {
+          return callback(last_error());
+        }
+        return callback();
+      }
+
+      // Asks the kernel to back the mapping with huge pages. This is only a
+      // hint, and whether it is honored for a shared file mapping depends on
+      // the platform and filesystem. Returns false if the hint was rejected.
+      bool advise_huge_pages() noexcept {
+      #ifdef MADV_HUGEPAGE
+        return ::madvise(mapping_.base_, mapping_.reserved_, MADV_HUGEPAGE) == 0;
+      #else
+        return false;
+      #endif
+      }
+
+    private:
+      template <typename Callback>
+      static auto open_helper(
+        bool do_init, char const* path, std::size_t size, std::size_t max_size, Callback& callback
+      ) -> decltype(callback(std::declval<mapped_heap>())) {
+        // Sizes are checked before the file is touched, so a failed create
+        // leaves an existing file as it was
+        if (do_init && (size == 0 || !heap_type::accepts_size(
+          size * byte_multiplier
+        , detail::align_to(std::max(size, max_size), page_size()) * byte_multiplier
+        ))) {
+          return callback(make_error_code(error::bad_heap_size));
+        }
+        int flags = do_init ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR;
+        mapping m{::open(path, flags, 0644)};
+        if (m.fd_ < 0) return callback(last_error());
+        if (do_init) {
+          if (::ftruncate(m.fd_, static_cast<off_t>(size)) != 0) return callback(last_error());
+        } else {
+          struct stat status;
+          if (::fstat(m.fd_, &status) != 0) return callback(last_error());
+          size = static_cast<std::size_t>(status.st_size);
+          if (size == 0) return callback(make_error_code(error::bad_heap_size));
+        }
+        max_size = detail::align_to(std::max(size, max_size), page_size());
+
+        // Reserve the address space without committing memory for it, then
+        // map the file over the start of the reservation
+        auto reserved = ::mmap(nullptr, max_size, PROT_NONE, reserve_flags, -1, 0);
+        if (reserved == MAP_FAILED) return callback(last_error());
+        m.base_ = static_cast<unsigned char*>(reserved);
+        m.reserved_ = max_size;
+        m.size_ = size;
+        auto address = ::mmap(
+          m.base_, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m.fd_, 0
+        );
+        if (address == MAP_FAILED) return callback(last_error());
+
+        auto on_heap = [&](heap_type h) { return callback(mapped_heap{std::move(m), h}); };
+        auto on_error = [&](std::error_code e) { return callback(e); };
+        auto base = m.base_;
+        if (do_init) {
+          return heap_type::create_growable(
+            base, size * byte_multiplier, max_size * byte_multiplier, on_heap, on_error
+          );
+        } else {
+          return heap_type::load(base, size * byte_multiplier, on_heap, on_error);
+        }
+      }
+
+      // Puts the reservation back over pages mapped past offset by a failed grow
+      void unmap_from(std::size_t offset, std::size_t size) noexcept {
+        if (size <= offset) return;
+        ::mmap(
+          mapping_.base_ + offset, size - offset, PROT_NONE, reserve_flags | MAP_FIXED, -1, 0
+        );
+      }
+
+      // Best effort: the grow has already failed, so its error is the one reported
+      void shrink(std::size_t size) noexcept {
+        static_cast<void>(::ftruncate(mapping_.fd_, static_cast<off_t>(size)));
+      }
+
+      static std::size_t page_size() noexcept {
+        return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+      }
+
+      static std::error_code last_error() noexcept {
+        return std::error_code{errno, std::system_category()};
+      }
+
+      mapped_heap(mapping&& m, heap_type h)
+        : mapping_{std::move(m)}, heap_{new heap_type{h}} {}
+
+      mapping mapping_;
+      // Sub arenas and slabs point at the heap, so it stays put when this moves
+      std::unique_ptr<heap_type> heap_;
+    };
+  }
+
+#ifdef UINT32_MAX
+  using mapped_heap32 = detail::mapped_heap<uint32_t, uint32_t, true>;
+#endif
+#ifdef UINT64_MAX
+  using mapped_heap64 = detail::mapped_heap<uint64_t, uint64_t, true>;
+#endif
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef UUID_9D2E6B71_3C58_4A0F_8E16_B47F05A2C93D
+#define UUID_9D2E6B71_3C58_4A0F_8E16_B47F05A2C93D
+
+#include <nocopy/archive_view.hpp>
+#include <nocopy/growable_archive.hpp>
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/graph_walker.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+namespace nocopy {
+  namespace detail {
+    // Visits the references in a source archive's data and writes each one,
+    // rebased by base, to the same position in a copy of that data. Since the
+    // source is never modified, a value reached along several paths is
+    // rewritten with the same result each time.
+    template <typename Offset>
+    class relocator final {
+      using reference = detail::reference<Offset>;
+
+    public:
+      relocator(unsigned char const* source, unsigned char* destination, Offset base) noexcept
+        : source_{source}, destination_{destination}, base_{base} {}
+
+      template <typename Ref>
+      std::error_code on_reference(Ref const& ref) const noexcept {
+        auto position = reinterpret_cast<unsigned char const*>(&ref) - source_;
+        auto rebased = rebase(ref);
+        std::memcpy(destination_ + position, &rebased, sizeof(rebased));
+        return {};
+      }
+
+      template <typename Ref>
+      Ref rebase(Ref const& ref) const noexcept {
+        return reference::rebase(ref, base_);
+      }
+
+    private:
+      unsigned char const* source_;
+      unsigned char* destination_;
+      Offset base_;
+    };
+  }
+
+  // Appends the data of the archive viewed by from to into, aligned to
+  // max_alignment, and rebases the references reachable from root so that
+  // they point into the appended copy. Calls callback(rebased root), which
+  // derefs in into right away, or callback(error_code), in which case into
+  // is left as it was. References already in into are not affected.
+  //
+  // The walk from root checks everything verify does, so from may be
+  // untrusted, and follows references at most MaxDepth deep. Its work is
+  // bounded the same way: a range reached along several paths is rewritten
+  // once per path, and a graph sharing ranges so much that this would cost
+  // more than the size of from fails with error::graph_too_large.
+  // Only what is reachable from root is rebased: data in from that holds
+  // references but is not reachable is copied with its references stale.
+  // from must not view into's own buffer, which may move as it grows.
+  template <
+    std::size_t MaxDepth = 64, typename Offset, typename Grow, typename Ref, typename ...Callbacks
+  >
+  auto merge(
+    detail::growable_archive<Offset, Grow>& into, detail::archive_view<Offset> const& from
+  , Ref const& root, Callbacks... callbacks
+  ) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    auto previous = into.cursor();
+    auto words = detail::align_to(static_cast<std::size_t>(from.cursor()), sizeof(uint64_t)) / sizeof(uint64_t);
+    return into.template alloc_range<uint64_t>(
+      detail::narrow_cast<Offset>(words)
+    , [&](auto copy) {
+        auto destination = reinterpret_cast<unsigned char*>(into.deref(copy).data());
+        std::memcpy(destination, from.data(), from.cursor());
+        detail::relocator<Offset> relocator{from.data(), destination, static_cast<Offset>(copy)};
+        detail::graph_walker<Offset, detail::relocator<Offset>> walker{
+          from.data(), from.cursor(), MaxDepth, relocator
+        };
+        if (auto e = walker.walk_root(root)) {
+          into.truncate(previous);
+          return callback(e);
+        }
+        return callback(relocator.rebase(root));
+      }
+    , [&callback](std::error_code e) { return callback(e); }
+    );
+  }
+}
+
+#endif
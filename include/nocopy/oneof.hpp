@@ -90,6 +90,11 @@ namespace nocopy {
       );
     }
 
+    // The index of the current type, which is only known to be less than
+    // type_count() if the data is trusted
+    std::size_t index() const { return get_tag(); }
+    static constexpr std::size_t type_count() { return packed::num_types(); }
+
     template <typename T>
     auto& operator[](T) {
       static_assert(packed::template is_allowed<detail::field_traits<T>>()
@@ -0,0 +1,290 @@
+#ifndef UUID_550ED354_1103_4BE4_B779_E06A6E6A8FCC
+#define UUID_550ED354_1103_4BE4_B779_E06A6E6A8FCC
+
+#include <nocopy/fwd/archive.hpp>
+
+#include <nocopy/detail/align_to.hpp>
+#include <nocopy/detail/archive_header.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+#include <nocopy/detail/narrow_cast.hpp>
+#include <nocopy/detail/reference.hpp>
+#include <nocopy/detail/traits.hpp>
+#include <nocopy/errors.hpp>
+
+#include <nocopy/detail/ignore_warnings_from_dependencies.hpp>
+BEGIN_IGNORE_WARNINGS_FROM_DEPENDENCIES
+#include <span.h>
+END_IGNORE_WARNINGS_FROM_DEPENDENCIES
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace nocopy {
+  // Streaming archive sink for a std::ostream, which must be seekable so that
+  // the header can be patched. The image starts at the stream's position when
+  // the sink is created.
+  class ostream_sink final {
+  public:
+    explicit ostream_sink(std::ostream& os) : os_{&os}, start_{os.tellp()} {}
+
+    std::error_code write(unsigned char const* bytes, std::size_t length) {
+      os_->write(reinterpret_cast<char const*>(bytes), static_cast<std::streamsize>(length));
+      return *os_ ? std::error_code{} : make_error_code(std::io_errc::stream);
+    }
+
+    std::error_code patch(std::size_t offset, unsigned char const* bytes, std::size_t length) {
+      auto end = os_->tellp();
+      os_->seekp(start_ + static_cast<std::streamoff>(offset));
+      os_->write(reinterpret_cast<char const*>(bytes), static_cast<std::streamsize>(length));
+      os_->seekp(end);
+      return *os_ ? std::error_code{} : make_error_code(std::io_errc::stream);
+    }
+
+  private:
+    std::ostream* os_;
+    std::streampos start_;
+  };
+
+  namespace detail {
+    // Builds an archive image directly into a Sink, so that an archive larger
+    // than memory can be written. Only the window of data after the last
+    // flush is kept in memory, and flush writes it out. References remain
+    // valid (offsets only grow), but flushed data can no longer be derefed.
+    //
+    // A Sink has write(bytes, length), which appends to the image, and
+    // patch(offset, bytes, length), which overwrites bytes already written.
+    // Both return a std::error_code. The header is written as zeros and
+    // patched with the cursor by finish.
+    template <typename Offset, typename Sink>
+    class streaming_archive final {
+      using header = archive_header<Offset>;
+      using header_t = typename header::type;
+
+      using reference = detail::reference<Offset>;
+
+      template <typename T, bool is_single>
+      using generic_reference = typename reference::template generic<T, is_single>;
+
+      static constexpr auto word_size = sizeof(uint64_t);
+
+    public:
+      using offset_t = Offset; // for client code
+
+      template <typename T>
+      using single_reference = typename reference::template single<T>;
+
+      template <typename T>
+      using range_reference = typename reference::template range<T>;
+
+      streaming_archive(streaming_archive&&) = default;
+      streaming_archive& operator=(streaming_archive&&) = default;
+
+      // window_size is the initial size of the in-memory window, which grows
+      // when an allocation does not fit
+      template <typename ...Callbacks>
+      static auto create(Sink sink, std::size_t window_size, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        unsigned char zeros[header::size] = {};
+        if (auto e = sink.write(zeros, sizeof(zeros))) {
+          return callback(e);
+        }
+        return callback(streaming_archive{std::move(sink), window_size});
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto alloc(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_helper<T>(
+          1
+        , [&](Offset offset, Offset) {
+            return callback(reference::template create_single<T>(offset));
+          }
+        , callback
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto alloc_range(Offset count, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_helper<T>(
+          count
+        , [&](Offset offset, Offset allocated) {
+            return callback(reference::template create_range<T>(offset, allocated));
+          }
+        , callback
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto add(T const& t, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc<T>(
+          [&](auto ref) {
+            this->deref(ref) = t;
+            return callback(ref);
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename T, typename ...Callbacks>
+      auto add(gsl::span<T> in, Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_range<std::remove_const_t<T>>(
+          detail::narrow_cast<Offset>(in.length())
+        , [&](auto ref) {
+            std::copy(in.cbegin(), in.cend(), this->deref(ref).begin());
+            return callback(ref);
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename ...Callbacks>
+      auto add(char const* str, std::size_t len, Callbacks... callbacks) {
+        assert(str != nullptr);
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        return alloc_range<char>(
+          detail::narrow_cast<Offset>(len + 1)
+        , [&](auto ref) {
+            // The terminator is already there, since allocations are zeroed
+            std::memcpy(&at(static_cast<Offset>(ref)), str, len);
+            return callback(reference::template create_range<char const>(
+              static_cast<Offset>(ref), detail::narrow_cast<Offset>(len + 1)
+            ));
+          }
+        , [&callback](std::error_code e) { return callback(e); }
+        );
+      }
+
+      template <typename ...Callbacks>
+      auto add(std::string const& str, Callbacks... callbacks) {
+        return this->add(str.c_str(), str.length(), callbacks...);
+      }
+
+      // Only references at or after flushed() can be derefed. Note that
+      // pointers into the window are invalidated by flushes and by
+      // allocations that grow the window.
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused> const& ref) const noexcept {
+        return ref.deref(at(static_cast<Offset>(ref)));
+      }
+      template <typename T, bool Unused>
+      decltype(auto) deref(generic_reference<T, Unused>& ref) noexcept {
+        return ref.deref(at(static_cast<Offset>(ref)));
+      }
+
+      char const* get_string(range_reference<char const> const& ref) const noexcept {
+        return this->deref(ref).data();
+      }
+
+      // Writes out everything allocated so far (except for a few bytes kept
+      // to preserve the window's alignment). Call it once the data allocated
+      // so far has been filled in.
+      template <typename ...Callbacks>
+      auto flush(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        assert(!finished_);
+        auto length = detail::align_backward(cursor_, word_size) - flushed_;
+        if (auto e = sink_.write(window(), length)) {
+          return callback(e);
+        }
+        std::memmove(window(), window() + length, cursor_ - flushed_ - length);
+        flushed_ += length;
+        return callback();
+      }
+
+      // Writes out the rest of the data and patches the header. The archive
+      // cannot be used afterward.
+      template <typename ...Callbacks>
+      auto finish(Callbacks... callbacks) {
+        auto callback = detail::make_overload(std::move(callbacks)...);
+        assert(!finished_);
+        if (auto e = sink_.write(window(), cursor_ - flushed_)) {
+          return callback(e);
+        }
+        flushed_ = cursor_;
+        finished_ = true;
+        alignas(header_t) unsigned char raw[sizeof(header_t)];
+        auto& image_header = *new (raw) header_t{};
+        image_header[header::cursor] = detail::narrow_cast<Offset>(cursor_);
+        if (auto e = sink_.patch(0, raw, sizeof(raw))) {
+          return callback(e);
+        }
+        return callback();
+      }
+
+      Offset cursor() const noexcept { return detail::narrow_cast<Offset>(cursor_); }
+      Offset flushed() const noexcept { return detail::narrow_cast<Offset>(flushed_); }
+
+      Sink& sink() noexcept { return sink_; }
+
+    private:
+      streaming_archive(Sink sink, std::size_t window_size)
+        : sink_(std::move(sink))
+        , window_(std::max<std::size_t>(detail::align_to(window_size, word_size) / word_size, 1)) {}
+
+      unsigned char* window() noexcept { return reinterpret_cast<unsigned char*>(window_.data()); }
+      unsigned char const* window() const noexcept {
+        return reinterpret_cast<unsigned char const*>(window_.data());
+      }
+
+      unsigned char& at(Offset offset) noexcept {
+        assert(flushed_ <= offset && offset <= cursor_);
+        return window()[offset - flushed_];
+      }
+      unsigned char const& at(Offset offset) const noexcept {
+        assert(flushed_ <= offset && offset <= cursor_);
+        return window()[offset - flushed_];
+      }
+
+      // Allocations (and the alignment padding before them) are zeroed, since
+      // nocopy types expect to start out value-initialized
+      template <typename T, typename Success, typename Error>
+      auto alloc_helper(std::size_t count, Success&& success_callback, Error&& error_callback) {
+        detail::assert_valid_type<T>();
+        assert(!finished_);
+        auto addr = detail::align_to(cursor_, detail::alignment_for<T>());
+        auto size = sizeof(T) * count;
+        std::size_t max_offset = std::numeric_limits<Offset>::max();
+        if (addr > max_offset || max_offset - addr < size) {
+          return error_callback(make_error_code(error::out_of_space));
+        }
+        auto end = addr + size;
+        auto needed = end - flushed_;
+        if (window_.size() * word_size < needed) {
+          window_.resize(std::max(2 * window_.size(), detail::align_to(needed, word_size) / word_size));
+        }
+        std::memset(window() + (cursor_ - flushed_), 0, end - cursor_);
+        cursor_ = end;
+        return success_callback(detail::narrow_cast<Offset>(addr), detail::narrow_cast<Offset>(count));
+      }
+
+      Sink sink_;
+      std::vector<uint64_t> window_;
+      std::size_t flushed_ = 0;
+      std::size_t cursor_ = 0;
+      bool finished_ = false;
+    };
+  }
+
+#ifdef UINT32_MAX
+  template <typename Sink = ostream_sink>
+  using streaming_archive32 = detail::streaming_archive<uint32_t, Sink>;
+#endif
+#ifdef UINT64_MAX
+  template <typename Sink = ostream_sink>
+  using streaming_archive64 = detail::streaming_archive<uint64_t, Sink>;
+#endif
+}
+
+#endif
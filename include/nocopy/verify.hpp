@@ -0,0 +1,44 @@
+#ifndef UUID_23F5CD58_47D3_4C59_A18F_FACFF8E36BBA
+#define UUID_23F5CD58_47D3_4C59_A18F_FACFF8E36BBA
+
+#include <nocopy/archive_view.hpp>
+#include <nocopy/detail/graph_walker.hpp>
+#include <nocopy/detail/lambda_overload.hpp>
+
+#include <system_error>
+
+namespace nocopy {
+  namespace detail {
+    struct null_reference_visitor {
+      template <typename Ref>
+      std::error_code on_reference(Ref const&) const noexcept { return {}; }
+    };
+  }
+
+  // Checks an untrusted archive before it is derefed: every reference
+  // reachable from root must be aligned and within the archive's cursor,
+  // every non-empty range of char const must end with a terminator, and
+  // every oneof tag must be in range. References are followed at most
+  // MaxDepth deep. Only types that can hold references or oneofs are looked
+  // into, so a range of plain structpacks costs one bounds check. The work
+  // is bounded by the size of the archive, and a graph that shares ranges
+  // so much that it would take longer fails with error::graph_too_large.
+  //
+  // Once verification succeeds, the view's unchecked deref is safe for
+  // everything reachable from root, and so is get_string, except on empty
+  // ranges.
+  template <std::size_t MaxDepth = 64, typename Offset, typename Ref, typename ...Callbacks>
+  auto verify(detail::archive_view<Offset> const& view, Ref const& root, Callbacks... callbacks) {
+    auto callback = detail::make_overload(std::move(callbacks)...);
+    detail::null_reference_visitor visitor;
+    detail::graph_walker<Offset, detail::null_reference_visitor> walker{
+      view.data(), view.cursor(), MaxDepth, visitor
+    };
+    if (auto e = walker.walk_root(root)) {
+      return callback(e);
+    }
+    return callback();
+  }
+}
+
+#endif
@@ -1 +1,231 @@
 #include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+  struct point {
+    NOCOPY_FIELD(x, int32_t);
+    NOCOPY_FIELD(y, int32_t);
+    NOCOPY_FIELD(weight, double);
+    using type = nocopy::structpack<x_t, y_t, weight_t>;
+  };
+  using point_t = point::type;
+}
+
+TEST_CASE("fixed capacity archive", "[archive]") {
+  using archive_t = nocopy::archive32<64>;
+  auto archive = std::unique_ptr<archive_t>{new archive_t{}};
+
+  auto ref = archive->alloc<point_t>(
+    [](auto r) { return r; }
+  , [](std::error_code) -> archive_t::single_reference<point_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  archive->deref(ref)[point::x] = 3;
+  REQUIRE(archive->deref(ref)[point::x] == 3);
+  REQUIRE(archive->deref(ref)[point::weight] == 0);
+
+  auto str = archive->add(
+    std::string{"hello"}
+  , [](auto r) { return r; }
+  , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(std::string{archive->get_string(str)} == "hello");
+
+  archive->alloc_range<uint64_t>(
+    100
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::out_of_space); }
+  );
+}
+
+TEST_CASE("fixed capacity archive images", "[archive]") {
+  using archive_t = nocopy::archive64<4096>;
+  auto archive = std::unique_ptr<archive_t>{new archive_t{}};
+  auto ref = archive->alloc_range<point_t>(
+    2
+  , [](auto r) { return r; }
+  , [](std::error_code) -> archive_t::range_reference<point_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  archive->deref(ref)[1][point::y] = 5;
+
+  // The image holds only the used bytes
+  auto image = archive->image();
+  REQUIRE(static_cast<std::size_t>(image.size()) == archive_t::header_size + 2 * sizeof(point_t));
+
+  // It loads from an unaligned buffer into an archive that was used before
+  std::vector<unsigned char> copy(static_cast<std::size_t>(image.size()) + 1);
+  std::copy(image.begin(), image.end(), copy.begin() + 1);
+  auto loaded = std::unique_ptr<archive_t>{new archive_t{}};
+  loaded->alloc_range<uint8_t>(
+    1000
+  , [&](auto r) { for (auto& b : loaded->deref(r)) b = 0xff; }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  loaded->load(
+    copy.data() + 1, copy.size() - 1
+  , []() {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(loaded->cursor() == archive->cursor());
+  REQUIRE(loaded->deref(ref)[1][point::y] == 5);
+  // Leftover data is zeroed, so new allocations start out zeroed
+  auto fresh = loaded->alloc<uint64_t>(
+    [](auto r) { return r; }
+  , [](std::error_code) -> archive_t::single_reference<uint64_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(loaded->deref(fresh) == 0);
+
+  // Truncated images are rejected
+  loaded->load(
+    copy.data() + 1, copy.size() - 2
+  , []() { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_archive); }
+  );
+}
+
+TEST_CASE("archive reuse", "[archive]") {
+  using archive_t = nocopy::archive32<1 << 20>;
+  nocopy::archive_pool<archive_t> pool{1};
+  REQUIRE(pool.idle() == 0);
+
+  archive_t* first;
+  {
+    auto archive = pool.acquire();
+    first = archive.get();
+    archive->alloc_range<uint32_t>(
+      100
+    , [&](auto ref) { for (auto& value : archive->deref(ref)) value = ~uint32_t{0}; }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  REQUIRE(pool.idle() == 1);
+
+  {
+    // The same archive comes back empty and zeroed
+    auto archive = pool.acquire();
+    REQUIRE(archive.get() == first);
+    REQUIRE(archive->cursor() == 0);
+    archive->alloc_range<uint32_t>(
+      100
+    , [&](auto ref) { for (auto value : archive->deref(ref)) REQUIRE(value == 0); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+
+    // Only max_idle archives are kept
+    auto other = pool.acquire();
+    REQUIRE(other.get() != first);
+  }
+  REQUIRE(pool.idle() == 1);
+
+  // Growable archives are reset in place, keeping their buffer
+  auto growable = nocopy::growable_archive32<>::create(
+    nullptr, 0, nocopy::vector_growth{}
+  , [](auto a) { return a; }
+  , [](std::error_code) -> nocopy::growable_archive32<> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  growable.alloc_range<uint8_t>(
+    64
+  , [&](auto ref) { for (auto& b : growable.deref(ref)) b = 1; }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  auto capacity = growable.capacity();
+  growable.reset();
+  REQUIRE(growable.cursor() == 0);
+  REQUIRE(growable.capacity() == capacity);
+  growable.alloc_range<uint8_t>(
+    64
+  , [&](auto ref) { for (auto b : growable.deref(ref)) REQUIRE(b == 0); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+}
+
+TEST_CASE("growable archive", "[archive]") {
+  using archive_t = nocopy::growable_archive64<>;
+  alignas(uint64_t) std::array<unsigned char, 64> initial;
+  auto archive = archive_t::create(
+    initial.data(), sizeof(initial), nocopy::vector_growth{}
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(archive.cursor() == 0);
+  REQUIRE(archive.capacity() == sizeof(initial) - archive_t::header_size);
+
+  // References stay valid as the archive moves out of the initial buffer
+  std::vector<archive_t::single_reference<point_t>> points;
+  std::vector<archive_t::range_reference<char const>> names;
+  for (int32_t i = 0; i < 500; ++i) {
+    archive.alloc<point_t>(
+      [&](auto ref) {
+        archive.deref(ref)[point::x] = i;
+        archive.deref(ref)[point::y] = -i;
+        points.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    archive.add(
+      "point " + std::to_string(i)
+    , [&](auto ref) { names.push_back(ref); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  REQUIRE(archive.capacity() >= archive.cursor());
+  auto check = [&](archive_t const& a) {
+    for (int32_t i = 0; i < 500; ++i) {
+      auto& p = a.deref(points[static_cast<std::size_t>(i)]);
+      REQUIRE(p[point::x] == i);
+      REQUIRE(p[point::y] == -i);
+      REQUIRE(p[point::weight] == 0);
+      REQUIRE(a.get_string(names[static_cast<std::size_t>(i)]) == "point " + std::to_string(i));
+      REQUIRE(static_cast<uint64_t>(points[static_cast<std::size_t>(i)]) % alignof(uint64_t) == 0);
+    }
+  };
+  check(archive);
+
+  // The image can be copied and loaded elsewhere
+  auto image = archive.image();
+  std::vector<uint64_t> copy(static_cast<std::size_t>(image.size()) / sizeof(uint64_t) + 1);
+  std::memcpy(copy.data(), image.data(), static_cast<std::size_t>(image.size()));
+  auto loaded = archive_t::load(
+    reinterpret_cast<unsigned char*>(copy.data()), static_cast<std::size_t>(image.size())
+  , nocopy::vector_growth{}
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(loaded.cursor() == archive.cursor());
+  check(loaded);
+
+  // A truncated image is rejected
+  archive_t::load(
+    reinterpret_cast<unsigned char*>(copy.data()), static_cast<std::size_t>(image.size()) - 1
+  , nocopy::vector_growth{}
+  , [](archive_t) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_archive); }
+  );
+
+  // Without a growth policy the caller's buffer is the limit. The header is
+  // wider than a 32 bit cursor, and none of the buffer's old contents leak
+  // into it.
+  using fixed_t = nocopy::growable_archive32<nocopy::fixed_capacity>;
+  initial.fill(0xff);
+  auto fixed = fixed_t::create(
+    initial.data(), sizeof(initial), nocopy::fixed_capacity{}
+  , [](fixed_t a) { return a; }
+  , [](std::error_code) -> fixed_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(fixed.image().size() == fixed_t::header_size);
+  for (auto byte : fixed.image()) REQUIRE(byte == 0);
+  fixed.alloc_range<uint8_t>(
+    sizeof(initial) - fixed_t::header_size
+  , [](auto) {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  fixed.alloc<uint8_t>(
+    [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::out_of_space); }
+  );
+}
@@ -0,0 +1,78 @@
+#ifndef UUID_5F0C8E2A_71B4_4D36_9A1E_C2B84D7F6035
+#define UUID_5F0C8E2A_71B4_4D36_9A1E_C2B84D7F6035
+
+// A schema and helpers shared by the tests of archive images
+
+#include <nocopy.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <system_error>
+
+namespace fixtures {
+  // Error callback for steps that should not fail
+  template <typename T>
+  struct shouldnt_fail {
+    T operator()(std::error_code) const { throw std::runtime_error{"shouldn't happen"}; }
+  };
+
+  template <typename Builder>
+  Builder make_builder() {
+    return Builder::create(nullptr, 0, nocopy::vector_growth{}, [](Builder a) { return a; }, shouldnt_fail<Builder>{});
+  }
+
+  template <typename View>
+  View open_view(gsl::span<unsigned char const> image) {
+    return View::open(
+      image.data(), static_cast<std::size_t>(image.size()), [](View v) { return v; }, shouldnt_fail<View>{}
+    );
+  }
+
+  using builder_t = nocopy::growable_archive32<>;
+  using view_t = nocopy::archive_view32;
+
+  struct point {
+    NOCOPY_FIELD(x, int32_t);
+    NOCOPY_FIELD(y, int32_t);
+    using type = nocopy::structpack<x_t, y_t>;
+  };
+  using point_t = point::type;
+
+  // Covers every kind of value a walk looks into: references to strings,
+  // single values and ranges, and oneofs with and without references
+  struct shape {
+    NOCOPY_FIELD(name, builder_t::range_reference<char const>);
+    NOCOPY_FIELD(center, builder_t::single_reference<point_t>);
+    NOCOPY_FIELD(outline, builder_t::range_reference<point_t>);
+    NOCOPY_FIELD(radius, uint32_t);
+    NOCOPY_FIELD(side, float);
+    NOCOPY_FIELD(size, NOCOPY_ONEOF(radius_t, side_t));
+    NOCOPY_FIELD(tag, builder_t::range_reference<char const>);
+    NOCOPY_FIELD(id, uint32_t);
+    NOCOPY_FIELD(label, NOCOPY_ONEOF(tag_t, id_t));
+    using type = nocopy::structpack<name_t, center_t, outline_t, size_t, label_t>;
+  };
+  using shape_t = shape::type;
+
+  struct group {
+    NOCOPY_FIELD(shapes, builder_t::range_reference<shape_t>);
+    using type = nocopy::structpack<shapes_t>;
+  };
+  using group_t = group::type;
+
+  template <typename T, typename Callback>
+  builder_t::range_reference<T> alloc_range(builder_t& builder, uint32_t count, Callback&& fill) {
+    return builder.alloc_range<T>(
+      count
+    , [&](auto ref) { fill(builder.deref(ref)); return ref; }
+    , shouldnt_fail<builder_t::range_reference<T>>{}
+    );
+  }
+
+  inline builder_t::range_reference<char const> add_string(builder_t& builder, std::string const& str) {
+    using string_t = builder_t::range_reference<char const>;
+    return builder.add(str, [](string_t ref) { return ref; }, shouldnt_fail<string_t>{});
+  }
+}
+
+#endif
@@ -0,0 +1,83 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include "archive_fixtures.hpp"
+
+#include <string>
+#include <vector>
+
+namespace {
+  struct sample {
+    NOCOPY_FIELD(time, uint64_t);
+    NOCOPY_FIELD(level, float);
+    using type = nocopy::structpack<time_t, level_t>;
+  };
+  using sample_t = sample::type;
+  using builder_t = nocopy::growable_archive64<>;
+  using fixtures::make_builder;
+}
+
+TEST_CASE("archive views", "[archive_view]") {
+  using view_t = nocopy::archive_view64;
+  auto builder = make_builder<builder_t>();
+  auto samples = builder.alloc_range<sample_t>(
+    10
+  , [&](auto ref) {
+      uint64_t time = 0;
+      for (auto& s : builder.deref(ref)) s[sample::time] = time++;
+      return ref;
+    }
+  , [](std::error_code) -> builder_t::range_reference<sample_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto name = builder.add(
+    std::string{"sensor"}
+  , [](auto ref) { return ref; }
+  , [](std::error_code) -> builder_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto image = builder.image();
+  auto open = [&](std::size_t size) {
+    return view_t::open(
+      image.data(), size
+    , [](view_t v) { return v; }
+    , [](std::error_code) -> view_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  };
+  auto view = open(static_cast<std::size_t>(image.size()));
+  REQUIRE(view.cursor() == builder.cursor());
+  REQUIRE(view.deref(samples)[9][sample::time] == 9);
+  REQUIRE(std::string{view.get_string(name)} == "sensor");
+  REQUIRE(view.contains(samples));
+  view.checked_get_string(
+    name
+  , [](char const* str) { REQUIRE(std::string{str} == "sensor"); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+
+  // The header is checked against the size when a view is opened
+  view_t::open(
+    image.data(), static_cast<std::size_t>(image.size()) - 1
+  , [](view_t) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_archive); }
+  );
+
+  // References are checked against the cursor of the view they are used with
+  auto small = make_builder<builder_t>();
+  small.add(uint64_t{1}, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+  auto small_view = view_t::open(
+    small.image().data(), static_cast<std::size_t>(small.image().size())
+  , [](view_t v) { return v; }
+  , [](std::error_code) -> view_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(!small_view.contains(samples));
+  small_view.checked_deref(
+    samples
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_reference); }
+  );
+  small_view.checked_get_string(
+    name
+  , [](char const*) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_reference); }
+  );
+}
@@ -0,0 +1,123 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+  struct entry {
+    NOCOPY_FIELD(thread, uint32_t);
+    NOCOPY_FIELD(index, uint32_t);
+    NOCOPY_FIELD(name, nocopy::concurrent_archive32::range_reference<char const>);
+    using type = nocopy::structpack<thread_t, index_t, name_t>;
+  };
+  using entry_t = entry::type;
+
+  using archive_t = nocopy::concurrent_archive32;
+  using view_t = nocopy::archive_view32;
+
+  archive_t make_archive(std::vector<uint64_t>& buffer) {
+    return archive_t::create(
+      reinterpret_cast<unsigned char*>(buffer.data()), buffer.size() * sizeof(uint64_t)
+    , [](archive_t a) { return a; }
+    , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  }
+
+  std::string name_for(std::size_t thread, uint32_t index) {
+    return std::to_string(thread) + "/" + std::to_string(index);
+  }
+}
+
+TEST_CASE("concurrent archive building", "[concurrent_archive]") {
+  constexpr std::size_t thread_count = 4;
+  constexpr uint32_t entries_per_thread = 2000;
+
+  // A chunk size of zero reserves each allocation separately
+  for (std::size_t chunk_size : {0, 256, 4096}) {
+    // Garbage in the buffer must not leak into the image
+    std::vector<uint64_t> buffer(1 << 17, ~uint64_t{0});
+    auto archive = make_archive(buffer);
+
+    std::vector<std::vector<archive_t::single_reference<entry_t>>> refs(thread_count);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t] {
+        auto writer = archive.make_writer(chunk_size);
+        for (uint32_t i = 0; i < entries_per_thread; ++i) {
+          auto name = writer.add(
+            name_for(t, i)
+          , [](auto ref) { return ref; }
+          , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+          );
+          writer.alloc<entry_t>(
+            [&](auto ref) {
+              auto& e = writer.deref(ref);
+              e[entry::thread] = static_cast<uint32_t>(t);
+              e[entry::index] = i;
+              e[entry::name] = name;
+              refs[t].push_back(ref);
+            }
+          , [](std::error_code) { throw std::runtime_error{"shouldn't happen"}; }
+          );
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // The result reads like any other archive image
+    auto image = archive.image();
+    auto view = view_t::open(
+      image.data(), static_cast<std::size_t>(image.size())
+    , [](view_t v) { return v; }
+    , [](std::error_code) -> view_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    REQUIRE(view.cursor() == archive.cursor());
+    for (std::size_t t = 0; t < thread_count; ++t) {
+      REQUIRE(refs[t].size() == entries_per_thread);
+      for (uint32_t i = 0; i < entries_per_thread; ++i) {
+        auto ref = refs[t][i];
+        bool verified = false;
+        nocopy::verify(view, ref, [&]() { verified = true; }, [](std::error_code) {});
+        REQUIRE(verified);
+        auto& e = view.deref(ref);
+        REQUIRE(e[entry::thread] == t);
+        REQUIRE(e[entry::index] == i);
+        REQUIRE(std::string{view.get_string(e[entry::name])} == name_for(t, i));
+      }
+    }
+  }
+}
+
+TEST_CASE("concurrent archive capacity", "[concurrent_archive]") {
+  // The buffer doesn't need to be zeroed, but none of its old contents leak
+  // into the header of the image
+  std::vector<uint64_t> buffer(16, ~uint64_t{0});
+  auto archive = make_archive(buffer);
+  for (auto byte : archive.image()) REQUIRE(byte == 0);
+  REQUIRE(archive.capacity() == buffer.size() * sizeof(uint64_t) - archive_t::header_size);
+  auto writer = archive.make_writer(64);
+
+  // An allocation larger than what is left of the chunk or the buffer fails
+  // without claiming anything
+  writer.alloc_range<uint64_t>(
+    100
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::out_of_space); }
+  );
+  REQUIRE(archive.cursor() == 0);
+
+  // A chunk that no longer fits gives way to an exact reservation
+  writer.alloc_range<uint64_t>(
+    archive.capacity() / sizeof(uint64_t)
+  , [](auto ref) { REQUIRE(static_cast<uint32_t>(ref) == 0); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(archive.cursor() == archive.capacity());
+  writer.alloc<uint8_t>(
+    [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::out_of_space); }
+  );
+}
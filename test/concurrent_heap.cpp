@@ -0,0 +1,118 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <thread>
+#include <vector>
+
+constexpr unsigned long long operator "" _KB(unsigned long long val) {
+  return val << 10;
+}
+
+namespace {
+  struct measurement {
+    NOCOPY_FIELD(delta, float);
+    NOCOPY_FIELD(first, uint32_t);
+    NOCOPY_FIELD(second, uint8_t);
+    using type = nocopy::structpack<delta_t, first_t, second_t>;
+  };
+  using measurement_t = measurement::type;
+
+  using cheap = nocopy::concurrent_heap64;
+
+  cheap make_heap(unsigned char* buffer, std::size_t size, std::size_t arenas) {
+    return cheap::create(
+      buffer, size, arenas
+    , [](cheap h) { return h; }
+    , [](std::error_code) -> cheap { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  }
+
+  cheap::arena acquire(cheap& heap) {
+    return heap.acquire(
+      [](cheap::arena a) { return a; }
+    , [](std::error_code) -> cheap::arena { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  }
+
+  std::size_t free_bytes(cheap const& heap) {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < heap.arena_count(); ++i) {
+      heap.arena_heap(i).each_free_block([&](auto size, auto) { total += size; });
+    }
+    return total;
+  }
+}
+
+TEST_CASE("arenas are exclusive", "[concurrent_heap]") {
+  alignas(uint64_t) std::array<unsigned char, 16_KB> buffer;
+  auto heap = make_heap(buffer.data(), sizeof(buffer), 2);
+  {
+    auto a = acquire(heap);
+    auto b = acquire(heap);
+    REQUIRE(a.index() != b.index());
+    bool failed = false;
+    heap.acquire([](cheap::arena) {}, [&](std::error_code) { failed = true; });
+    REQUIRE(failed);
+  }
+  // Released arenas can be claimed again
+  auto c = acquire(heap);
+}
+
+TEST_CASE("writer threads share one buffer", "[concurrent_heap]") {
+  constexpr std::size_t thread_count = 4;
+  constexpr std::size_t per_thread = 200;
+  alignas(uint64_t) std::array<unsigned char, 256_KB> buffer;
+  auto heap = make_heap(buffer.data(), sizeof(buffer), thread_count);
+  auto initial_free = free_bytes(heap);
+
+  std::vector<std::vector<cheap::single_reference<measurement_t>>> results(thread_count);
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&heap, &results, t] {
+      auto arena = acquire(heap);
+      for (std::size_t i = 0; i < per_thread; ++i) {
+        arena.malloc<measurement_t>(
+          [&](auto ref) {
+            heap.deref(ref)[measurement::first] = static_cast<uint32_t>(t * per_thread + i);
+            results[t].push_back(ref);
+          }
+        , [](std::error_code) { throw std::runtime_error{"shouldn't happen"}; }
+        );
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  for (std::size_t t = 0; t < thread_count; ++t) {
+    REQUIRE(results[t].size() == per_thread);
+    for (std::size_t i = 0; i < per_thread; ++i) {
+      REQUIRE(heap.deref(results[t][i])[measurement::first] == t * per_thread + i);
+    }
+  }
+
+  // Every thread frees the references allocated by its neighbor
+  threads.clear();
+  for (std::size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&heap, &results, t] {
+      auto arena = acquire(heap);
+      for (auto ref : results[(t + 1) % thread_count]) {
+        arena.free(ref);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  heap.flush();
+  REQUIRE(free_bytes(heap) == initial_free);
+
+  SECTION("the buffer can be loaded elsewhere") {
+    auto loaded = cheap::load(
+      buffer.data(), sizeof(buffer)
+    , [](cheap h) { return h; }
+    , [](std::error_code) -> cheap { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    REQUIRE(loaded.arena_count() == thread_count);
+    REQUIRE(free_bytes(loaded) == initial_free);
+  }
+}
@@ -0,0 +1,129 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+#include <nocopy/delta.hpp>
+
+#include <array>
+#include <cstring>
+#include <random>
+#include <vector>
+
+constexpr unsigned long long operator "" _KB(unsigned long long val) {
+  return val << 10;
+}
+
+TEST_CASE("dirty tracker runs", "[delta]") {
+  nocopy::dirty_tracker tracker{64};
+  tracker.reserve(1000 * 64);
+  REQUIRE(tracker.empty());
+  tracker.mark(10, 1);
+  tracker.mark(64, 64);
+  tracker.mark(60 * 64, 8 * 64); // spans a bitmap word
+  tracker.mark(1000 * 64, 0);
+  std::vector<std::pair<std::size_t, std::size_t>> runs;
+  tracker.each_run([&](std::size_t offset, std::size_t length) { runs.emplace_back(offset, length); });
+  REQUIRE(runs.size() == 2);
+  REQUIRE(runs[0] == std::make_pair(std::size_t{0}, std::size_t{128}));
+  REQUIRE(runs[1] == std::make_pair(std::size_t{60 * 64}, std::size_t{8 * 64}));
+  tracker.clear();
+  REQUIRE(tracker.empty());
+
+  // A write past the reserved size doesn't allocate, and everything from the
+  // end of the bitmap on is reported as dirty
+  tracker.mark(1023 * 64, 4 * 64);
+  REQUIRE(!tracker.empty());
+  runs.clear();
+  tracker.each_run([&](std::size_t offset, std::size_t length) { runs.emplace_back(offset, length); });
+  REQUIRE(runs.size() == 1);
+  REQUIRE(runs[0].first == 1023 * 64);
+  REQUIRE(runs[0].second >= 4 * 64);
+  tracker.clear();
+  REQUIRE(tracker.empty());
+}
+
+TEST_CASE("heap deltas replicate a heap", "[delta]") {
+  using heap_t = nocopy::tracked_heap64;
+  alignas(uint64_t) std::array<unsigned char, 256_KB> primary;
+  alignas(uint64_t) std::array<unsigned char, 256_KB> replica;
+  auto heap = heap_t::create(
+    primary.data(), sizeof(primary)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  replica = primary; // the initial full copy
+
+  nocopy::dirty_tracker tracker{256};
+  tracker.reserve(sizeof(primary));
+  heap.observer().tracker = &tracker;
+
+  std::default_random_engine generator{7};
+  std::vector<heap_t::range_reference<uint32_t>> allocs;
+  std::vector<unsigned char> delta;
+  for (int tick = 0; tick < 20; ++tick) {
+    for (int i = 0; i < 10; ++i) {
+      if (allocs.empty() || generator() % 3 != 0) {
+        heap.malloc_range<uint32_t>(
+          1 + generator() % 64
+        , [&](auto ref) {
+            for (auto& value : heap.deref(ref)) value = static_cast<uint32_t>(generator());
+            allocs.push_back(ref);
+          }
+        , [](std::error_code) {}
+        );
+      } else {
+        auto it = allocs.begin() + static_cast<std::ptrdiff_t>(generator() % allocs.size());
+        heap.free(*it);
+        allocs.erase(it);
+      }
+    }
+    delta.clear();
+    nocopy::export_delta(primary.data(), sizeof(primary), tracker, delta);
+    REQUIRE(tracker.empty());
+    REQUIRE(delta.size() < sizeof(primary) / 4);
+    nocopy::apply_delta(
+      replica.data(), sizeof(replica), delta.data(), delta.size()
+    , []() {}, [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(std::memcmp(primary.data(), replica.data(), sizeof(primary)) == 0);
+  }
+
+  auto loaded = nocopy::heap64::load(
+    replica.data(), sizeof(replica)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> nocopy::heap64 { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  for (auto ref : allocs) {
+    auto expected = heap.deref(ref);
+    auto actual = loaded.deref(ref);
+    REQUIRE(std::equal(expected.begin(), expected.end(), actual.begin()));
+  }
+}
+
+TEST_CASE("malformed deltas are rejected", "[delta]") {
+  std::array<unsigned char, 1_KB> source{};
+  std::array<unsigned char, 1_KB> target{};
+  source[100] = 1;
+  nocopy::dirty_tracker tracker{64};
+  tracker.reserve(sizeof(source));
+  tracker.mark(100, 1);
+  std::vector<unsigned char> delta;
+  nocopy::export_delta(source.data(), sizeof(source), tracker, delta);
+
+  // A truncated delta, and a delta for a smaller buffer
+  nocopy::apply_delta(
+    target.data(), sizeof(target), delta.data(), delta.size() - 1
+  , []() { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_delta); }
+  );
+  nocopy::apply_delta(
+    target.data(), 100, delta.data(), delta.size()
+  , []() { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_delta); }
+  );
+  REQUIRE(target[100] == 0);
+  nocopy::apply_delta(
+    target.data(), sizeof(target), delta.data(), delta.size()
+  , []() {}, [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(target[100] == 1);
+}
@@ -0,0 +1,55 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+#include <nocopy/fd_sink.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+TEST_CASE("streaming archives to a file descriptor", "[streaming_archive]") {
+  using archive_t = nocopy::streaming_archive32<nocopy::fd_sink>;
+  char path[] = "/tmp/nocopy_fd_sink_XXXXXX";
+  int fd = ::mkstemp(path);
+  REQUIRE(fd >= 0);
+
+  auto archive = archive_t::create(
+    nocopy::fd_sink{fd}, 64
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  std::vector<archive_t::range_reference<uint16_t>> ranges;
+  for (uint16_t i = 1; i <= 40; ++i) {
+    archive.alloc_range<uint16_t>(
+      i
+    , [&](auto ref) {
+        for (auto& value : archive.deref(ref)) value = i;
+        ranges.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    archive.flush([]() {}, [](std::error_code) { REQUIRE(false); });
+  }
+  archive.finish([]() {}, [](std::error_code) { REQUIRE(false); });
+
+  auto size = ::lseek(fd, 0, SEEK_END);
+  std::vector<uint64_t> buffer(static_cast<std::size_t>(size) / sizeof(uint64_t) + 1);
+  REQUIRE(::pread(fd, buffer.data(), static_cast<std::size_t>(size), 0) == size);
+  ::close(fd);
+  ::unlink(path);
+
+  using loaded_t = nocopy::growable_archive32<nocopy::fixed_capacity>;
+  auto loaded = loaded_t::load(
+    reinterpret_cast<unsigned char*>(buffer.data()), static_cast<std::size_t>(size), nocopy::fixed_capacity{}
+  , [](loaded_t a) { return a; }
+  , [](std::error_code) -> loaded_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  for (uint16_t i = 1; i <= 40; ++i) {
+    auto values = loaded.deref(ranges[i - 1u]);
+    REQUIRE(values.size() == i);
+    for (auto value : values) REQUIRE(value == i);
+  }
+}
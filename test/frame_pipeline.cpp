@@ -0,0 +1,225 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+#include <nocopy/frame_pipeline.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+  using archive_t = nocopy::growable_archive32<>;
+  using view_t = nocopy::archive_view32;
+
+  // A file of framed archives, each holding its index as a string
+  struct frame_file {
+    explicit frame_file(std::size_t count, bool checksum = true) {
+      fd = ::mkstemp(path);
+      REQUIRE(fd >= 0);
+      for (std::size_t i = 0; i < count; ++i) {
+        auto archive = archive_t::create(
+          nullptr, 0, nocopy::vector_growth{}
+        , [](archive_t a) { return a; }
+        , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+        );
+        names.push_back(archive.add(
+          std::to_string(i) + std::string(i % 37, '.')
+        , [](auto ref) { return ref; }
+        , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+        ));
+        auto image = archive.image();
+        std::vector<unsigned char> framed(nocopy::framed_size(static_cast<std::size_t>(image.size())));
+        nocopy::encode_frame(
+          image, nocopy::frame_options{7, checksum}, framed.data(), framed.size()
+        , [](std::size_t) {}
+        , [](std::error_code) { REQUIRE(false); }
+        );
+        REQUIRE(::write(fd, framed.data(), framed.size()) == static_cast<ssize_t>(framed.size()));
+      }
+      rewind();
+    }
+
+    ~frame_file() {
+      ::close(fd);
+      std::remove(path);
+    }
+
+    void rewind() { ::lseek(fd, 0, SEEK_SET); }
+
+    std::string expected(std::size_t i) const { return std::to_string(i) + std::string(i % 37, '.'); }
+
+    char path[32] = "/tmp/nocopy_pipeline_XXXXXX";
+    int fd;
+    std::vector<archive_t::range_reference<char const>> names;
+  };
+
+  // Called from worker threads, so it reports problems with an empty string
+  // rather than through Catch
+  std::string name_in(nocopy::frame const& f, archive_t::range_reference<char const> const& ref) {
+    if (f.schema_version != 7) return {};
+    return view_t::open(
+      f.payload.data(), static_cast<std::size_t>(f.payload.size())
+    , [&](view_t view) { return std::string{view.get_string(ref)}; }
+    , [](std::error_code) { return std::string{}; }
+    );
+  }
+}
+
+TEST_CASE("pipelined frame reading", "[frame_pipeline]") {
+  constexpr std::size_t count = 500;
+  frame_file file{count};
+
+  SECTION("ordered") {
+    nocopy::pipeline_options options;
+    options.buffer_size = 256; // most frames straddle buffers
+    options.buffer_count = 2;
+    uint64_t next = 0;
+    nocopy::read_frames(
+      file.fd, options
+    , [&](nocopy::frame const& f, uint64_t sequence) {
+        REQUIRE(sequence == next);
+        REQUIRE(name_in(f, file.names[sequence]) == file.expected(sequence));
+        ++next;
+      }
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(next == count);
+  }
+
+  SECTION("ordered with several workers") {
+    nocopy::pipeline_options options;
+    options.buffer_size = 1024;
+    options.buffer_count = 4;
+    options.workers = 4;
+    uint64_t next = 0;
+    std::size_t mismatches = 0;
+    nocopy::read_frames(
+      file.fd, options
+    , [&](nocopy::frame const& f, uint64_t sequence) {
+        // Workers take turns, so nothing here needs a lock
+        if (sequence != next || name_in(f, file.names[sequence]) != file.expected(sequence)) ++mismatches;
+        ++next;
+      }
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(mismatches == 0);
+    REQUIRE(next == count);
+  }
+
+  SECTION("frames from a pipe are handled as they arrive") {
+    std::vector<unsigned char> stream(static_cast<std::size_t>(::lseek(file.fd, 0, SEEK_END)));
+    file.rewind();
+    REQUIRE(::read(file.fd, stream.data(), stream.size()) == static_cast<ssize_t>(stream.size()));
+    auto first_frame = nocopy::framed_size(static_cast<std::size_t>(
+      archive_t::header_size + file.expected(0).size() + 1
+    ));
+
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    std::mutex mutex;
+    std::condition_variable handled_first;
+    std::size_t handled = 0;
+    bool first_in_time = false;
+    std::thread writer{[&] {
+      // Send one frame, and only send the rest once it has been handled
+      // (which the default 1 MiB buffers would never allow if reading waited
+      // for them to fill)
+      auto ok = ::write(fds[1], stream.data(), first_frame) == static_cast<ssize_t>(first_frame);
+      {
+        std::unique_lock<std::mutex> lock{mutex};
+        first_in_time = ok && handled_first.wait_for(lock, std::chrono::seconds{10}, [&] { return handled != 0; });
+      }
+      auto rest = stream.size() - first_frame;
+      ok = ::write(fds[1], stream.data() + first_frame, rest) == static_cast<ssize_t>(rest);
+      (void)ok;
+      ::close(fds[1]);
+    }};
+    nocopy::read_frames(
+      fds[0], nocopy::pipeline_options{}
+    , [&](nocopy::frame const&, uint64_t) {
+        {
+          std::lock_guard<std::mutex> lock{mutex};
+          ++handled;
+        }
+        handled_first.notify_one();
+      }
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    writer.join();
+    ::close(fds[0]);
+    REQUIRE(first_in_time);
+    REQUIRE(handled == count);
+  }
+
+  SECTION("unordered") {
+    nocopy::pipeline_options options;
+    options.buffer_size = 1024;
+    options.buffer_count = 4;
+    options.workers = 4;
+    options.ordered = false;
+    std::mutex mutex;
+    std::vector<bool> seen(count, false);
+    std::size_t mismatches = 0;
+    nocopy::read_frames(
+      file.fd, options
+    , [&](nocopy::frame const& f, uint64_t sequence) {
+        auto name = name_in(f, file.names[sequence]);
+        std::lock_guard<std::mutex> lock{mutex};
+        if (seen[sequence] || name != file.expected(sequence)) ++mismatches;
+        seen[sequence] = true;
+      }
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(mismatches == 0);
+    REQUIRE(std::count(seen.begin(), seen.end(), true) == static_cast<std::ptrdiff_t>(count));
+  }
+
+  SECTION("frames larger than a buffer are rejected") {
+    nocopy::pipeline_options options;
+    options.buffer_size = 48;
+    nocopy::read_frames(
+      file.fd, options
+    , [](nocopy::frame const&, uint64_t) {}
+    , []() { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_frame); }
+    );
+  }
+
+  SECTION("truncated streams are rejected") {
+    auto size = ::lseek(file.fd, 0, SEEK_END);
+    REQUIRE(::ftruncate(file.fd, size - 1) == 0);
+    file.rewind();
+    std::size_t handled = 0;
+    nocopy::read_frames(
+      file.fd, nocopy::pipeline_options{}
+    , [&](nocopy::frame const&, uint64_t) { ++handled; }
+    , []() { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_frame); }
+    );
+    // Reading stops at the error, so some earlier frames may be dropped
+    REQUIRE(handled < count);
+  }
+
+  SECTION("invalid options are rejected") {
+    nocopy::pipeline_options options;
+    options.buffer_count = 1;
+    nocopy::read_frames(
+      file.fd, options
+    , [](nocopy::frame const&, uint64_t) {}
+    , []() { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == std::errc::invalid_argument); }
+    );
+  }
+}
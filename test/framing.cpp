@@ -0,0 +1,204 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <string>
+#include <vector>
+
+namespace {
+  struct stream {
+    std::vector<uint64_t> storage;
+    std::size_t size = 0;
+
+    unsigned char* data() { return reinterpret_cast<unsigned char*>(storage.data()); }
+
+    void append(std::string const& payload, nocopy::frame_options options) {
+      auto bytes = gsl::span<unsigned char const>{
+        reinterpret_cast<unsigned char const*>(payload.data())
+      , static_cast<gsl::span<unsigned char const>::index_type>(payload.size())
+      };
+      storage.resize((size + nocopy::framed_size(payload.size())) / sizeof(uint64_t));
+      nocopy::encode_frame(
+        bytes, options, data() + size, storage.size() * sizeof(uint64_t) - size
+      , [&](std::size_t written) { size += written; }
+      , [](std::error_code) { REQUIRE(false); }
+      );
+    }
+  };
+
+  std::vector<std::string> payloads() {
+    std::vector<std::string> result;
+    for (std::size_t i = 0; i < 20; ++i) {
+      result.push_back(std::string(i * 3, static_cast<char>('a' + i)));
+    }
+    return result;
+  }
+
+  stream make_stream() {
+    stream s;
+    uint16_t version = 0;
+    for (auto& payload : payloads()) {
+      s.append(payload, nocopy::frame_options{version, version % 2 == 0});
+      ++version;
+    }
+    return s;
+  }
+}
+
+TEST_CASE("framing", "[framing]") {
+  auto s = make_stream();
+  auto expected = payloads();
+
+  SECTION("frames within a chunk are not copied") {
+    nocopy::frame_decoder decoder;
+    std::size_t count = 0;
+    decoder.feed(
+      s.data(), s.size
+    , [&](nocopy::frame f) {
+        REQUIRE(f.schema_version == count);
+        REQUIRE(std::string(f.payload.begin(), f.payload.end()) == expected[count]);
+        REQUIRE(f.payload.data() >= s.data());
+        REQUIRE(f.payload.data() < s.data() + s.size);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(f.payload.data()) % nocopy::frame_alignment == 0);
+        ++count;
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(count == expected.size());
+    REQUIRE(decoder.buffered() == 0);
+  }
+
+  SECTION("frames may straddle chunks of any size") {
+    for (std::size_t chunk = 1; chunk <= 48; ++chunk) {
+      nocopy::frame_decoder decoder;
+      std::vector<std::string> decoded;
+      for (std::size_t position = 0; position < s.size; position += chunk) {
+        decoder.feed(
+          s.data() + position, std::min(chunk, s.size - position)
+        , [&](nocopy::frame f) { decoded.emplace_back(f.payload.begin(), f.payload.end()); }
+        , [](std::error_code) { REQUIRE(false); }
+        );
+      }
+      REQUIRE(decoded == expected);
+      REQUIRE(decoder.buffered() == 0);
+    }
+  }
+
+  SECTION("headers can be written separately from payloads") {
+    std::string payload = "gathered";
+    auto bytes = gsl::span<unsigned char const>{
+      reinterpret_cast<unsigned char const*>(payload.data()), static_cast<std::ptrdiff_t>(payload.size())
+    };
+    std::vector<unsigned char> gathered(nocopy::frame_header_size);
+    nocopy::write_frame_header(
+      gathered.data(), bytes, nocopy::frame_options{3, true}
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    gathered.insert(gathered.end(), bytes.begin(), bytes.end());
+    auto padding = nocopy::frame_padding(payload.size());
+    gathered.insert(gathered.end(), padding.begin(), padding.end());
+    REQUIRE(gathered.size() == nocopy::framed_size(payload.size()));
+
+    stream encoded;
+    encoded.append(payload, nocopy::frame_options{3, true});
+    REQUIRE(std::equal(gathered.begin(), gathered.end(), encoded.data()));
+  }
+
+  SECTION("malformed frames are reported") {
+    nocopy::frame_decoder decoder;
+    auto expect_error = [&](std::error_code expected_error) {
+      bool reported = false;
+      decoder.feed(
+        s.data(), s.size
+      , [](nocopy::frame) {}
+      , [&](std::error_code e) { REQUIRE(e == expected_error); reported = true; }
+      );
+      REQUIRE(reported);
+    };
+
+    // Even numbered frames have checksums
+    auto third = nocopy::framed_size(expected[0].size()) + nocopy::framed_size(expected[1].size());
+    s.data()[third + nocopy::frame_header_size] ^= 1;
+    expect_error(nocopy::error::frame_checksum_mismatch);
+    // The error sticks until reset
+    expect_error(nocopy::error::frame_checksum_mismatch);
+
+    decoder.reset();
+    s.data()[0] ^= 1;
+    expect_error(nocopy::error::bad_frame);
+  }
+
+  SECTION("frames longer than the limit are rejected") {
+    nocopy::frame_decoder decoder{16};
+    std::size_t count = 0;
+    bool reported = false;
+    decoder.feed(
+      s.data(), s.size
+    , [&](nocopy::frame f) { REQUIRE(f.payload.size() <= 16); ++count; }
+    , [&](std::error_code e) { REQUIRE(e == nocopy::error::bad_frame); reported = true; }
+    );
+    REQUIRE(count == 6);
+    REQUIRE(reported);
+  }
+
+  SECTION("by default, frames over a megabyte are rejected from the header alone") {
+    std::vector<unsigned char> payload(nocopy::default_max_frame_length + 1);
+    auto bytes = gsl::span<unsigned char const>{payload.data(), static_cast<std::ptrdiff_t>(payload.size())};
+    std::vector<unsigned char> header(nocopy::frame_header_size);
+    nocopy::write_frame_header(
+      header.data(), bytes, nocopy::frame_options{0, false}
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    nocopy::frame_decoder decoder;
+    bool reported = false;
+    decoder.feed(header.data(), 4, [](nocopy::frame) { REQUIRE(false); }, [](std::error_code) { REQUIRE(false); });
+    decoder.feed(
+      header.data() + 4, header.size() - 4
+    , [](nocopy::frame) { REQUIRE(false); }
+    , [&](std::error_code e) { REQUIRE(e == nocopy::error::bad_frame); reported = true; }
+    );
+    REQUIRE(reported);
+  }
+}
+
+TEST_CASE("framed archives", "[framing]") {
+  using archive_t = nocopy::growable_archive32<>;
+  using view_t = nocopy::archive_view32;
+  auto archive = archive_t::create(
+    nullptr, 0, nocopy::vector_growth{}
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto name = archive.add(
+    std::string{"framed"}
+  , [](auto ref) { return ref; }
+  , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  auto image = archive.image();
+  std::vector<uint64_t> buffer(nocopy::framed_size(static_cast<std::size_t>(image.size())) / sizeof(uint64_t));
+  auto bytes = reinterpret_cast<unsigned char*>(buffer.data());
+  nocopy::encode_frame(
+    image, nocopy::frame_options{1, true}, bytes, buffer.size() * sizeof(uint64_t)
+  , [](std::size_t) {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+
+  // The payload is aligned, so it is read in place
+  nocopy::frame_decoder decoder;
+  bool decoded = false;
+  decoder.feed(
+    bytes, buffer.size() * sizeof(uint64_t)
+  , [&](nocopy::frame f) {
+      view_t::open(
+        f.payload.data(), static_cast<std::size_t>(f.payload.size())
+      , [&](view_t view) { REQUIRE(std::string{view.get_string(name)} == "framed"); decoded = true; }
+      , [](std::error_code) { REQUIRE(false); }
+      );
+    }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(decoded);
+}
@@ -4,6 +4,7 @@
 #include <nocopy.hpp>
 #include <nocopy/detail/narrow_cast.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <iterator>
 #include <unordered_map>
@@ -122,3 +123,849 @@ TEST_CASE("raw heap corruption", "[heap]") {
   , [](std::error_code) { REQUIRE(false); }
   );
 }
+
+TEST_CASE("loaded heap shares the free list index", "[heap]") {
+  using offset_t = nocopy::heap64::offset_t;
+  alignas(uint64_t) std::array<unsigned char, 16_KB> buffer;
+  auto on_error = [](std::error_code) -> nocopy::heap64 { throw std::runtime_error{"shouldn't happen"}; };
+  auto heap = nocopy::heap64::create(buffer.data(), sizeof(buffer), [](auto h) { return h; }, on_error);
+
+  std::vector<nocopy::heap64::range_reference<uint8_t>> allocs;
+  for (offset_t size = 1; size < 200; size += 7) {
+    heap.malloc_range<uint8_t>(size
+    , [&](auto result) { allocs.push_back(result); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  // Leave every other block free so that the free lists are fragmented
+  for (std::size_t i = 0; i < allocs.size(); i += 2) {
+    heap.free(allocs[i]);
+  }
+
+  auto loaded = nocopy::heap64::load(buffer.data(), sizeof(buffer), [](auto h) { return h; }, on_error);
+  std::vector<std::pair<offset_t, offset_t>> expected, actual;
+  heap.each_free_block([&](auto size, auto offset) { expected.emplace_back(offset, size); });
+  loaded.each_free_block([&](auto size, auto offset) { actual.emplace_back(offset, size); });
+  REQUIRE(expected == actual);
+
+  // A request that fits one of the freed holes is served from it rather than
+  // from the large tail block
+  offset_t hole = 0;
+  loaded.each_free_block([&](auto size, auto offset) {
+    if (size < 1_KB && size > 64) hole = offset;
+  });
+  REQUIRE(hole != 0);
+  loaded.malloc_range<uint8_t>(64
+  , [&](auto result) { REQUIRE(static_cast<offset_t>(result) < static_cast<offset_t>(allocs.back())); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+}
+
+TEST_CASE("realloc_range", "[heap]") {
+  using offset_t = nocopy::heap64::offset_t;
+  using range_t = nocopy::heap64::range_reference<uint32_t>;
+  alignas(uint64_t) std::array<unsigned char, 4_KB> buffer;
+  auto heap = nocopy::heap64::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> nocopy::heap64 { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto malloc_range = [&](offset_t count) {
+    return heap.malloc_range<uint32_t>(
+      count
+    , [](auto result) { return result; }
+    , [](std::error_code) -> range_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  };
+  auto realloc_range = [&](range_t ref, offset_t count) {
+    return heap.realloc_range(
+      ref, count
+    , [](auto result) { return result; }
+    , [](std::error_code) -> range_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  };
+  auto fill = [&](range_t ref) {
+    auto data = heap.deref(ref);
+    for (uint32_t i = 0; i < data.size(); ++i) data[i] = i;
+  };
+  auto check = [&](range_t ref, offset_t count) {
+    auto data = heap.deref(ref);
+    for (uint32_t i = 0; i < count; ++i) REQUIRE(data[i] == i);
+  };
+
+  auto a = malloc_range(16);
+  auto b = malloc_range(16);
+  auto c = malloc_range(16);
+  fill(a);
+  fill(b);
+
+  SECTION("grows into the following free block") {
+    heap.free(c);
+    auto grown = realloc_range(b, 64);
+    REQUIRE(static_cast<offset_t>(grown) == static_cast<offset_t>(b));
+    REQUIRE(heap.deref(grown).size() == 64);
+    check(grown, 16);
+  }
+
+  SECTION("shrinks in place and frees the tail") {
+    std::size_t free_blocks = 0;
+    heap.each_free_block([&](auto, auto) { ++free_blocks; });
+    auto shrunk = realloc_range(b, 4);
+    REQUIRE(static_cast<offset_t>(shrunk) == static_cast<offset_t>(b));
+    check(shrunk, 4);
+    std::size_t new_free_blocks = 0;
+    heap.each_free_block([&](auto, auto) { ++new_free_blocks; });
+    REQUIRE(new_free_blocks == free_blocks + 1);
+  }
+
+  SECTION("slides back into a free predecessor") {
+    heap.free(a);
+    auto grown = realloc_range(b, 24);
+    REQUIRE(static_cast<offset_t>(grown) == static_cast<offset_t>(a));
+    check(grown, 16);
+  }
+
+  SECTION("moves when neighbors are allocated") {
+    auto grown = realloc_range(b, 64);
+    REQUIRE(static_cast<offset_t>(grown) != static_cast<offset_t>(b));
+    check(grown, 16);
+    check(a, 16);
+  }
+
+  SECTION("leaves the range untouched on failure") {
+    bool failed = false;
+    heap.realloc_range(b, 900, [](auto) {}, [&](std::error_code) { failed = true; });
+    REQUIRE(failed);
+    check(b, 16);
+  }
+
+  std::vector<std::pair<offset_t, bool>> blocks;
+  heap.each_block([&](auto, bool is_free, auto offset) { blocks.emplace_back(offset, is_free); });
+  for (std::size_t i = 1; i < blocks.size(); ++i) {
+    REQUIRE(!(blocks[i - 1].second && blocks[i].second));
+  }
+}
+
+TEST_CASE("malloc_many and free_many", "[heap]") {
+  using offset_t = nocopy::heap64::offset_t;
+  using ref_t = nocopy::heap64::single_reference<measurement_t>;
+  alignas(uint64_t) std::array<unsigned char, 16_KB> buffer;
+  auto heap = nocopy::heap64::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> nocopy::heap64 { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  std::vector<std::pair<offset_t, offset_t>> initial;
+  heap.each_free_block([&](auto size, auto offset) { initial.emplace_back(offset, size); });
+
+  std::vector<ref_t> refs(20, ref_t{});
+  heap.malloc_many<measurement_t>(
+    gsl::span<ref_t>{refs.data(), static_cast<std::ptrdiff_t>(refs.size())}
+  , [](auto) {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+
+  // Carved back to back from one block
+  for (std::size_t i = 1; i < refs.size(); ++i) {
+    REQUIRE(static_cast<offset_t>(refs[i]) > static_cast<offset_t>(refs[i - 1]));
+  }
+  std::vector<offset_t> allocated;
+  heap.each_block([&](auto, bool is_free, auto offset) { if (!is_free) allocated.push_back(offset); });
+  REQUIRE(allocated.size() == refs.size());
+  for (std::size_t i = 0; i < refs.size(); ++i) {
+    REQUIRE(allocated[i] == static_cast<offset_t>(refs[i]));
+    heap.deref(refs[i])[measurement::first] = static_cast<uint32_t>(i);
+  }
+  for (std::size_t i = 0; i < refs.size(); ++i) {
+    REQUIRE(heap.deref(refs[i])[measurement::first] == i);
+  }
+
+  SECTION("freeing a batch in any order restores a single free block") {
+    std::reverse(refs.begin(), refs.end());
+    std::swap(refs[3], refs[11]);
+    heap.free_many(gsl::span<ref_t>{refs.data(), static_cast<std::ptrdiff_t>(refs.size())});
+    std::vector<std::pair<offset_t, offset_t>> after;
+    heap.each_free_block([&](auto size, auto offset) { after.emplace_back(offset, size); });
+    REQUIRE(after == initial);
+  }
+
+  SECTION("freeing part of a batch coalesces only the freed runs") {
+    std::vector<ref_t> some{refs[2], refs[0], refs[3], refs[7]};
+    heap.free_many(gsl::span<ref_t>{some.data(), static_cast<std::ptrdiff_t>(some.size())});
+    std::size_t free_blocks = 0;
+    heap.each_block([&](auto, bool is_free, auto) { if (is_free) ++free_blocks; });
+    // {0}, {2, 3}, {7}, and the tail
+    REQUIRE(free_blocks == 4);
+  }
+
+  SECTION("a batch that does not fit is not allocated") {
+    std::vector<ref_t> huge(1000, ref_t{});
+    bool failed = false;
+    heap.malloc_many<measurement_t>(
+      gsl::span<ref_t>{huge.data(), static_cast<std::ptrdiff_t>(huge.size())}
+    , [](auto) {}
+    , [&](std::error_code) { failed = true; }
+    );
+    REQUIRE(failed);
+    std::size_t allocated_blocks = 0;
+    heap.each_block([&](auto, bool is_free, auto) { if (!is_free) ++allocated_blocks; });
+    REQUIRE(allocated_blocks == refs.size());
+  }
+}
+
+template <typename Heap>
+typename Heap::relocation_map compact(Heap& heap) {
+  return heap.compact(
+    [](typename Heap::relocation_map map) { return map; }
+  , [](std::error_code) -> typename Heap::relocation_map { throw std::runtime_error{"shouldn't happen"}; }
+  );
+}
+
+struct node {
+  NOCOPY_FIELD(value, uint32_t);
+  NOCOPY_FIELD(next, nocopy::heap64::single_reference<measurement_t>);
+  using type = nocopy::structpack<value_t, next_t>;
+};
+
+TEST_CASE("compact", "[heap]") {
+  using heap_t = nocopy::heap64;
+  using offset_t = heap_t::offset_t;
+  alignas(uint64_t) std::array<unsigned char, 8_KB> buffer;
+  heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](heap_t) {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  // Compaction works on a heap that was loaded rather than created
+  auto heap = heap_t::load(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  std::vector<heap_t::range_reference<uint32_t>> ranges;
+  for (uint32_t i = 0; i < 10; ++i) {
+    heap.malloc_range<uint32_t>(
+      i + 1
+    , [&](auto ref) {
+        for (auto& value : heap.deref(ref)) value = i;
+        ranges.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  auto target = heap.malloc<measurement_t>([](auto ref) { return ref; }, [](std::error_code) -> heap_t::single_reference<measurement_t> { throw std::runtime_error{"shouldn't happen"}; });
+  heap.deref(target)[measurement::first] = 1234;
+  auto root = heap.malloc<node::type>([](auto ref) { return ref; }, [](std::error_code) -> heap_t::single_reference<node::type> { throw std::runtime_error{"shouldn't happen"}; });
+  heap.deref(root)[node::value] = 99;
+  heap.deref(root)[node::next] = target;
+
+  std::vector<heap_t::range_reference<uint32_t>> kept;
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    if (i % 2 == 0) heap.free(ranges[i]); else kept.push_back(ranges[i]);
+  }
+
+  auto map = compact(heap);
+  REQUIRE(!map.empty());
+
+  std::vector<bool> layout;
+  heap.each_block([&](auto, bool is_free, auto) { layout.push_back(is_free); });
+  REQUIRE(layout.size() == kept.size() + 3);
+  REQUIRE(layout.back());
+  layout.pop_back();
+  for (bool is_free : layout) REQUIRE(!is_free);
+  std::size_t free_blocks = 0;
+  heap.each_free_block([&](auto, auto) { ++free_blocks; });
+  REQUIRE(free_blocks == 1);
+
+  for (auto& ref : kept) {
+    ref = map(ref);
+    auto values = heap.deref(ref);
+    for (auto value : values) REQUIRE(value == values.size() - 1);
+  }
+  root = map(root);
+  auto& root_node = heap.deref(root);
+  REQUIRE(root_node[node::value] == 99);
+  map.relocate(root_node, node::next);
+  REQUIRE(heap.deref(root_node[node::next])[measurement::first] == 1234);
+  REQUIRE(static_cast<offset_t>(root_node[node::next]) == map(static_cast<offset_t>(target)));
+
+  // The reclaimed space is usable as one block
+  heap.free(root);
+  compact(heap);
+  heap.malloc_range<uint8_t>(4_KB, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+}
+
+TEST_CASE("statistics", "[heap]") {
+  using heap_t = nocopy::heap32;
+  using offset_t = heap_t::offset_t;
+  alignas(uint32_t) std::array<unsigned char, 16_KB> buffer;
+  auto heap = heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  auto empty = heap.stats();
+  REQUIRE(empty.allocated_bytes == 0);
+  REQUIRE(empty.allocated_blocks == 0);
+  REQUIRE(empty.free_blocks == 1);
+  REQUIRE(empty.free_bytes == empty.capacity);
+  REQUIRE(empty.largest_free_block == empty.capacity);
+  REQUIRE(empty.fragmentation() == 0);
+
+  auto check = [&]() {
+    auto stats = heap.stats();
+    offset_t allocated_bytes = 0, allocated_blocks = 0, free_bytes = 0, free_blocks = 0, largest = 0;
+    heap.each_block([&](offset_t size, bool is_free, offset_t) {
+      if (is_free) {
+        free_bytes += size;
+        ++free_blocks;
+        largest = std::max(largest, size);
+      } else {
+        allocated_bytes += size;
+        ++allocated_blocks;
+      }
+    });
+    REQUIRE(stats.allocated_bytes == allocated_bytes);
+    REQUIRE(stats.allocated_blocks == allocated_blocks);
+    REQUIRE(stats.free_bytes == free_bytes);
+    REQUIRE(stats.free_blocks == free_blocks);
+    REQUIRE(stats.largest_free_block == largest);
+    return stats;
+  };
+
+  std::default_random_engine generator{42};
+  std::uniform_int_distribution<offset_t> rand_size{1, 300};
+  std::vector<heap_t::range_reference<uint8_t>> allocs;
+  offset_t mallocs = 0, frees = 0;
+  for (auto i = 0u; i < 200u; ++i) {
+    if (allocs.empty() || generator() % 3 != 0) {
+      heap.malloc_range<uint8_t>(
+        rand_size(generator)
+      , [&](auto ref) { allocs.push_back(ref); ++mallocs; }
+      , [](std::error_code) {}
+      );
+    } else {
+      auto it = allocs.begin() + static_cast<std::ptrdiff_t>(generator() % allocs.size());
+      heap.free(*it);
+      allocs.erase(it);
+      ++frees;
+    }
+  }
+  auto stats = check();
+  REQUIRE(stats.malloc_count == mallocs);
+  REQUIRE(stats.free_count == frees);
+  offset_t searches = 0;
+  for (auto count : stats.examined) searches += count;
+  REQUIRE(searches == 200 - frees);
+  REQUIRE(stats.fragmentation() >= 0);
+  REQUIRE(stats.fragmentation() < 1);
+
+  // Counters are kept in the buffer
+  auto loaded = heap_t::load(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(loaded.stats().malloc_count == mallocs);
+  REQUIRE(loaded.stats().free_bytes == stats.free_bytes);
+
+  auto map = compact(heap);
+  for (auto& ref : allocs) ref = map(ref);
+  stats = check();
+  REQUIRE(stats.free_blocks == 1);
+  REQUIRE(stats.fragmentation() == 0);
+
+  // A realloc counts as neither a malloc nor a free, whether it stays in
+  // place or moves. After compacting, the lowest block is boxed in by the
+  // guard and its neighbour, so growing it has to move it.
+  auto lowest = std::min_element(
+    allocs.begin(), allocs.end()
+  , [](auto a, auto b) { return static_cast<offset_t>(a) < static_cast<offset_t>(b); }
+  );
+  auto old_offset = static_cast<offset_t>(*lowest);
+  *lowest = heap.realloc_range(
+    *lowest, 1
+  , [&](auto ref) { REQUIRE(static_cast<offset_t>(ref) == old_offset); return ref; }
+  , [](std::error_code) -> heap_t::range_reference<uint8_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(stats.largest_free_block > 512);
+  *lowest = heap.realloc_range(
+    *lowest, 512
+  , [&](auto ref) { REQUIRE(static_cast<offset_t>(ref) != old_offset); return ref; }
+  , [](std::error_code) -> heap_t::range_reference<uint8_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  stats = check();
+  REQUIRE(stats.malloc_count == mallocs);
+  REQUIRE(stats.free_count == frees);
+  REQUIRE(stats.realloc_count == 2);
+
+  heap.free_many(gsl::span<heap_t::range_reference<uint8_t>>{allocs});
+  stats = check();
+  REQUIRE(stats.allocated_blocks == 0);
+  REQUIRE(stats.free_bytes == stats.capacity);
+
+  std::size_t reported = 0;
+  stats.each([&](char const* name, double value) {
+    if (std::string{name} == "free_count") REQUIRE(value == frees + allocs.size());
+    ++reported;
+  });
+  REQUIRE(reported == 18);
+}
+
+TEST_CASE("compact headers", "[heap]") {
+  using compact_t = nocopy::compact_heap64;
+  alignas(uint64_t) std::array<unsigned char, 64_KB> buffer;
+
+  auto count_fitting = [&](auto heap) {
+    std::size_t count = 0;
+    while (heap.template malloc<uint32_t>([](auto) { return true; }, [](std::error_code) { return false; })) {
+      ++count;
+    }
+    return count;
+  };
+  auto full_count = count_fitting(nocopy::heap64::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> nocopy::heap64 { throw std::runtime_error{"shouldn't happen"}; }
+  ));
+  auto heap = compact_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> compact_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto compact_count = count_fitting(heap);
+  REQUIRE(compact_count * 4 >= full_count * 5);
+
+  // Free list links live in the payload of free blocks, so contents must
+  // survive everything the free lists do around them
+  heap = compact_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> compact_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  std::default_random_engine generator{3};
+  std::vector<compact_t::range_reference<uint8_t>> allocs;
+  std::vector<uint8_t> tags;
+  auto check_contents = [&]() {
+    for (std::size_t i = 0; i < allocs.size(); ++i) {
+      for (auto byte : heap.deref(allocs[i])) REQUIRE(byte == tags[i]);
+    }
+  };
+  for (auto i = 0u; i < 2000u; ++i) {
+    auto choice = generator() % 8;
+    if (allocs.empty() || choice < 5) {
+      heap.malloc_range<uint8_t>(
+        generator() % 40
+      , [&](auto ref) {
+          auto tag = static_cast<uint8_t>(i);
+          for (auto& byte : heap.deref(ref)) byte = tag;
+          allocs.push_back(ref);
+          tags.push_back(tag);
+        }
+      , [](std::error_code) {}
+      );
+    } else if (choice < 7) {
+      auto index = static_cast<std::ptrdiff_t>(generator() % allocs.size());
+      heap.free(allocs[static_cast<std::size_t>(index)]);
+      allocs.erase(allocs.begin() + index);
+      tags.erase(tags.begin() + index);
+    } else {
+      auto map = compact(heap);
+      for (auto& ref : allocs) ref = map(ref);
+    }
+  }
+  check_contents();
+  std::size_t free_blocks = 0;
+  heap.each_block([&](auto size, bool is_free, auto) {
+    REQUIRE(size >= 2 * sizeof(compact_t::offset_t));
+    if (is_free) ++free_blocks;
+  });
+  std::size_t listed = 0;
+  heap.each_free_block([&](auto, auto) { ++listed; });
+  REQUIRE(listed == free_blocks);
+  heap.free_many(gsl::span<compact_t::range_reference<uint8_t>>{allocs});
+  REQUIRE(heap.stats().free_blocks == 1);
+
+  // A buffer can only be loaded with the header layout it was created with
+  nocopy::heap64::load(
+    buffer.data(), sizeof(buffer)
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::heap_layout_mismatch); }
+  );
+}
+
+TEST_CASE("aligned allocations", "[heap]") {
+  using heap_t = nocopy::heap64;
+  using offset_t = heap_t::offset_t;
+  alignas(4096) static std::array<unsigned char, 64_KB> buffer;
+  auto heap = heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  std::vector<heap_t::range_reference<uint8_t>> allocs;
+  for (std::size_t alignment : {8, 16, 32, 64, 4096, 64, 32}) {
+    heap.malloc_range_aligned<uint8_t>(
+      alignment, 100
+    , [&](auto ref) {
+        REQUIRE(static_cast<offset_t>(ref) % alignment == 0);
+        auto span = heap.deref(ref);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(span.data()) % alignment == 0);
+        for (auto& byte : span) byte = static_cast<uint8_t>(alignment);
+        allocs.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  auto single = heap.malloc_aligned<measurement_t>(
+    256
+  , [](auto ref) { return ref; }
+  , [](std::error_code) -> heap_t::single_reference<measurement_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(static_cast<offset_t>(single) % 256 == 0);
+
+  // The space skipped to reach the 4096 byte boundary went back to the free
+  // list, so a small allocation lands before the aligned block
+  auto page_aligned = static_cast<offset_t>(allocs[4]);
+  heap.malloc_range<uint8_t>(
+    512
+  , [&](auto ref) { REQUIRE(static_cast<offset_t>(ref) < page_aligned); heap.free(ref); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+
+  std::size_t alignments[] = {8, 16, 32, 64, 4096, 64, 32};
+  for (std::size_t i = 0; i < allocs.size(); ++i) {
+    for (auto byte : heap.deref(allocs[i])) REQUIRE(byte == static_cast<uint8_t>(alignments[i]));
+  }
+
+  heap.malloc_range_aligned<uint8_t>(4096, 60_KB, [](auto) { REQUIRE(false); }, [](std::error_code) {});
+
+  // Aligned blocks never move: compact slides the other blocks around them,
+  // and realloc_range only resizes them in place
+  heap.free(allocs[3]);
+  allocs.erase(allocs.begin() + 3);
+  std::size_t kept_alignments[] = {8, 16, 32, 4096, 64, 32};
+  heap.malloc_range<uint8_t>(
+    24
+  , [&](auto ref) { heap.free(ref); }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  auto map = compact(heap);
+  for (std::size_t i = 1; i < allocs.size(); ++i) {
+    REQUIRE(static_cast<offset_t>(map(allocs[i])) == static_cast<offset_t>(allocs[i]));
+  }
+  allocs[0] = map(allocs[0]);
+  REQUIRE(static_cast<offset_t>(map(single)) == static_cast<offset_t>(single));
+  for (std::size_t i = 0; i < allocs.size(); ++i) {
+    for (auto byte : heap.deref(allocs[i])) REQUIRE(byte == static_cast<uint8_t>(kept_alignments[i]));
+  }
+  heap.realloc_range(
+    allocs[3], 60_KB
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::aligned_block); }
+  );
+  allocs[3] = heap.realloc_range(
+    allocs[3], 50
+  , [&](auto ref) { REQUIRE(static_cast<offset_t>(ref) == page_aligned); return ref; }
+  , [](std::error_code) -> heap_t::range_reference<uint8_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  for (auto byte : heap.deref(allocs[3])) REQUIRE(byte == 4096 % 256);
+
+  heap.free(single);
+  heap.free_many(gsl::span<heap_t::range_reference<uint8_t>>{allocs});
+  auto stats = heap.stats();
+  REQUIRE(stats.free_blocks == 1);
+  REQUIRE(stats.free_bytes == stats.capacity);
+
+  // Compact headers need room for free list links in the skipped space
+  alignas(4096) static std::array<unsigned char, 16_KB> compact_buffer;
+  auto compact = nocopy::compact_heap64::create(
+    compact_buffer.data(), sizeof(compact_buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> nocopy::compact_heap64 { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  for (int i = 0; i < 20; ++i) {
+    compact.malloc_aligned<uint32_t>(
+      64
+    , [](auto ref) { REQUIRE(static_cast<offset_t>(ref) % 64 == 0); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  compact.each_block([](auto size, bool, auto) { REQUIRE(size >= 2 * sizeof(offset_t)); });
+}
+
+TEST_CASE("sub arenas", "[heap]") {
+  using heap_t = nocopy::heap64;
+  using offset_t = heap_t::offset_t;
+  alignas(uint64_t) std::array<unsigned char, 16_KB> buffer;
+  auto heap = heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto long_lived = heap.malloc<measurement_t>(
+    [](auto ref) { return ref; }
+  , [](std::error_code) -> heap_t::single_reference<measurement_t> { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  heap.deref(long_lived)[measurement::first] = 42;
+  auto before = heap.stats();
+
+  {
+    auto arena = heap.make_sub_arena(
+      4_KB
+    , [](auto a) { return a; }
+    , [](std::error_code) -> heap_t::sub_arena { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    REQUIRE(arena.capacity() >= 4_KB);
+    REQUIRE(heap.stats().allocated_blocks == before.allocated_blocks + 1);
+
+    std::vector<offset_t> offsets;
+    for (int i = 0; i < 10; ++i) {
+      arena.malloc<measurement_t>(
+        [&](auto ref) {
+          heap.deref(ref)[measurement::first] = static_cast<uint32_t>(i);
+          offsets.push_back(static_cast<offset_t>(ref));
+        }
+      , [](std::error_code) { REQUIRE(false); }
+      );
+    }
+    for (std::size_t i = 1; i < offsets.size(); ++i) {
+      REQUIRE(offsets[i] - offsets[i - 1] == nocopy::detail::align_to(sizeof(measurement_t), 8));
+    }
+
+    auto checkpoint = arena.mark();
+    auto used = arena.used();
+    arena.malloc_range<uint8_t>(1_KB, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+    arena.rollback(checkpoint);
+    REQUIRE(arena.used() == used);
+    arena.malloc_range<uint8_t>(
+      1_KB
+    , [&](auto ref) { REQUIRE(static_cast<offset_t>(ref) == offsets.front() + used); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    arena.malloc_range<uint8_t>(8_KB, [](auto) { REQUIRE(false); }, [](std::error_code) {});
+    arena.reset();
+    REQUIRE(arena.used() == 0);
+
+    // Compacting would move the arena's block out from under it
+    heap.compact(
+      [](auto) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::heap_pinned); }
+    );
+
+    // The pin is in the buffer, so copies of the heap see it too
+    auto copy = heap;
+    copy.compact(
+      [](auto) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::heap_pinned); }
+    );
+
+    // An image saved while the arena is open (say, by a process that then
+    // crashed) stays pinned until the arena is forgotten
+    alignas(uint64_t) std::array<unsigned char, 16_KB> saved = buffer;
+    auto loaded = heap_t::load(
+      saved.data(), sizeof(saved)
+    , [](auto h) { return h; }
+    , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    loaded.compact(
+      [](auto) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::heap_pinned); }
+    );
+    loaded.forget_sub_arenas();
+    compact(loaded);
+  }
+
+  // Once the arena is released, the heap compacts again
+  compact(heap);
+
+  // Releasing the arena frees exactly its block
+  auto after = heap.stats();
+  REQUIRE(after.allocated_blocks == before.allocated_blocks);
+  REQUIRE(after.free_bytes == before.free_bytes);
+  REQUIRE(heap.deref(long_lived)[measurement::first] == 42);
+}
+
+TEST_CASE("slabs", "[heap]") {
+  using heap_t = nocopy::heap64;
+  using offset_t = heap_t::offset_t;
+  using slab_t = heap_t::slab<measurement_t>;
+  alignas(uint64_t) std::array<unsigned char, 64_KB> buffer;
+  auto heap = heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto empty = heap.stats();
+
+  auto slab = heap.make_slab<measurement_t>(
+    64
+  , [](auto s) { return s; }
+  , [](std::error_code) -> slab_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  std::vector<heap_t::single_reference<measurement_t>> cells;
+  for (uint32_t i = 0; i < 200; ++i) {
+    slab.malloc(
+      [&](auto ref) {
+        new (&heap.deref(ref)) measurement_t{};
+        heap.deref(ref)[measurement::first] = i;
+        cells.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  // Cells within a chunk are packed back to back without headers
+  auto stride = nocopy::detail::align_to(sizeof(measurement_t), sizeof(offset_t));
+  for (std::size_t i = 1; i < 64; ++i) {
+    REQUIRE(static_cast<offset_t>(cells[i]) - static_cast<offset_t>(cells[i - 1]) == stride);
+  }
+  // One block for the slab, and one per chunk
+  REQUIRE(heap.stats().allocated_blocks == 1 + 4);
+
+  std::vector<offset_t> freed;
+  for (std::size_t i = 0; i < cells.size(); i += 2) {
+    freed.push_back(static_cast<offset_t>(cells[i]));
+    slab.free(cells[i]);
+  }
+  auto reused = slab.malloc(
+    [](auto ref) { return static_cast<offset_t>(ref); }
+  , [](std::error_code) -> offset_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(reused == freed.back());
+
+  // The slab's state is in the buffer
+  auto loaded = heap_t::load(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto reopened = loaded.open_slab<measurement_t>(slab.offset());
+  for (std::size_t i = 1; i < cells.size(); i += 2) {
+    REQUIRE(loaded.deref(cells[i])[measurement::first] == i);
+  }
+  auto next = reopened.malloc(
+    [](auto ref) { return static_cast<offset_t>(ref); }
+  , [](std::error_code) -> offset_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(next == freed[freed.size() - 2]);
+
+  // Compacting would move chunks that the slab links to by offset, even
+  // after the heap is reloaded
+  loaded.compact(
+    [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::heap_pinned); }
+  );
+
+  reopened.destroy();
+  compact(loaded);
+  auto after = loaded.stats();
+  REQUIRE(after.allocated_blocks == 0);
+  REQUIRE(after.free_bytes == empty.free_bytes);
+}
+
+template <typename Heap>
+Heap create_heap(unsigned char* buffer, std::size_t size) {
+  return Heap::create(
+    buffer, size
+  , [](auto h) { return h; }
+  , [](std::error_code) -> Heap { throw std::runtime_error{"shouldn't happen"}; }
+  );
+}
+
+TEST_CASE("placement policies", "[heap]") {
+  using nocopy::detail::null_heap_observer;
+  using first_fit_t = nocopy::detail::heap<
+    uint64_t, uint64_t, true, null_heap_observer, nocopy::detail::full_block_headers
+  , nocopy::detail::first_fit
+  >;
+  using best_fit_t = nocopy::detail::heap<
+    uint64_t, uint64_t, true, null_heap_observer, nocopy::detail::full_block_headers
+  , nocopy::detail::best_fit
+  >;
+  using compact_best_fit_t = nocopy::detail::heap<
+    uint64_t, uint64_t, true, null_heap_observer, nocopy::detail::compact_block_headers
+  , nocopy::detail::best_fit
+  >;
+  alignas(uint64_t) std::array<unsigned char, 64_KB> buffer;
+  auto malloc_bytes = [](auto& heap, std::size_t count) {
+    using heap_t = std::decay_t<decltype(heap)>;
+    return heap.template malloc_range<uint8_t>(
+      count
+    , [](auto ref) { return ref; }
+    , [](std::error_code) -> typename heap_t::template range_reference<uint8_t> {
+        throw std::runtime_error{"shouldn't happen"};
+      }
+    );
+  };
+  auto offset_of = [](auto ref) { return static_cast<uint64_t>(ref); };
+
+  // Random workloads leave the free lists consistent with the blocks
+  auto exercise = [&](auto heap) {
+    std::default_random_engine generator{9};
+    std::vector<decltype(malloc_bytes(heap, 1))> allocs;
+    for (auto i = 0u; i < 3000u; ++i) {
+      if (allocs.empty() || generator() % 4 != 0) {
+        heap.template malloc_range<uint8_t>(
+          1 + generator() % 600
+        , [&](auto ref) { allocs.push_back(ref); }
+        , [](std::error_code) {}
+        );
+      } else {
+        auto it = allocs.begin() + static_cast<std::ptrdiff_t>(generator() % allocs.size());
+        heap.free(*it);
+        allocs.erase(it);
+      }
+    }
+    uint64_t free_bytes = 0, free_blocks = 0, listed = 0;
+    heap.each_block([&](uint64_t size, bool is_free, uint64_t) {
+      if (is_free) { free_bytes += size; ++free_blocks; }
+    });
+    heap.each_free_block([&](uint64_t, uint64_t) { ++listed; });
+    auto stats = heap.stats();
+    REQUIRE(listed == free_blocks);
+    REQUIRE(stats.free_blocks == free_blocks);
+    REQUIRE(stats.free_bytes == free_bytes);
+    for (auto ref : allocs) heap.free(ref);
+    REQUIRE(heap.stats().free_blocks == 1);
+  };
+  exercise(create_heap<nocopy::heap64>(buffer.data(), sizeof(buffer)));
+  exercise(create_heap<first_fit_t>(buffer.data(), sizeof(buffer)));
+  exercise(create_heap<best_fit_t>(buffer.data(), sizeof(buffer)));
+  exercise(create_heap<compact_best_fit_t>(buffer.data(), sizeof(buffer)));
+
+  SECTION("first fit takes the lowest fitting address") {
+    auto heap = create_heap<first_fit_t>(buffer.data(), sizeof(buffer));
+    auto a = malloc_bytes(heap, 256);
+    malloc_bytes(heap, 8);
+    auto b = malloc_bytes(heap, 256);
+    malloc_bytes(heap, 8);
+    heap.free(a);
+    heap.free(b);
+    REQUIRE(offset_of(malloc_bytes(heap, 256)) == offset_of(a));
+  }
+
+  SECTION("first fit takes the lowest fitting address across size classes") {
+    auto heap = create_heap<first_fit_t>(buffer.data(), sizeof(buffer));
+    auto large = malloc_bytes(heap, 4096);
+    malloc_bytes(heap, 8);
+    auto small = malloc_bytes(heap, 256);
+    malloc_bytes(heap, 8);
+    heap.free(large);
+    heap.free(small);
+    REQUIRE(offset_of(malloc_bytes(heap, 256)) == offset_of(large));
+  }
+
+  SECTION("best fit takes the smallest fitting block") {
+    auto heap = create_heap<best_fit_t>(buffer.data(), sizeof(buffer));
+    auto small = malloc_bytes(heap, 1000);
+    malloc_bytes(heap, 8);
+    auto large = malloc_bytes(heap, 1016);
+    malloc_bytes(heap, 8);
+    heap.free(small);
+    heap.free(large);
+    REQUIRE(offset_of(malloc_bytes(heap, 992)) == offset_of(small));
+  }
+}
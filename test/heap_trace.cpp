@@ -0,0 +1,121 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <array>
+#include <vector>
+
+constexpr unsigned long long operator "" _KB(unsigned long long val) {
+  return val << 10;
+}
+
+TEST_CASE("traces record mallocs and frees", "[heap_trace]") {
+  using heap_t = nocopy::traced_heap64;
+  alignas(uint64_t) std::array<unsigned char, 16_KB> buffer;
+  auto heap = heap_t::create(
+    buffer.data(), sizeof(buffer)
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  // Nothing is recorded until a recorder is attached
+  heap.malloc<uint32_t>([](auto) {}, [](std::error_code) { REQUIRE(false); });
+  nocopy::trace_recorder recorder;
+  heap.observer().recorder = &recorder;
+
+  std::vector<nocopy::trace_event> expected;
+  auto malloc_range = [&](uint64_t count) {
+    return heap.malloc_range<uint16_t>(
+      count
+    , [&](auto ref) {
+        expected.push_back({nocopy::trace_op::malloc, 0, static_cast<uint64_t>(ref), 2 * count});
+        return ref;
+      }
+    , [](std::error_code) -> heap_t::range_reference<uint16_t> {
+        throw std::runtime_error{"shouldn't happen"};
+      }
+    );
+  };
+  auto free = [&](heap_t::range_reference<uint16_t> ref) {
+    heap.free(ref);
+    expected.push_back({nocopy::trace_op::free, 0, static_cast<uint64_t>(ref), 0});
+  };
+  auto a = malloc_range(10);
+  auto b = malloc_range(3);
+  free(a);
+  auto c = malloc_range(100);
+  free(c);
+  free(b);
+
+  std::vector<nocopy::trace_event> events;
+  nocopy::read_trace(
+    recorder.trace().data(), recorder.trace().size()
+  , [&](nocopy::trace_event e) { events.push_back(e); }
+  , []() {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(events.size() == expected.size());
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    REQUIRE(events[i].op == expected[i].op);
+    REQUIRE(events[i].offset == expected[i].offset);
+    REQUIRE(events[i].size == expected[i].size);
+    if (i != 0) REQUIRE(events[i - 1].time <= events[i].time);
+  }
+
+  // A truncated trace is rejected without reporting any events
+  std::size_t reported = 0;
+  nocopy::read_trace(
+    recorder.trace().data(), recorder.trace().size() - 1
+  , [&](nocopy::trace_event) { ++reported; }
+  , []() { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_trace); }
+  );
+  REQUIRE(reported == 0);
+
+  recorder.clear();
+  REQUIRE(recorder.trace().empty());
+
+  // Past its capacity, a recorder counts events instead of allocating
+  nocopy::trace_recorder small{2};
+  heap.observer().recorder = &small;
+  free(malloc_range(4));
+  REQUIRE(small.trace().size() == 2 * sizeof(nocopy::detail::trace_record_t));
+  REQUIRE(small.dropped() == 0);
+  free(malloc_range(4));
+  REQUIRE(small.trace().size() == 2 * sizeof(nocopy::detail::trace_record_t));
+  REQUIRE(small.dropped() == 2);
+  small.clear();
+  REQUIRE(small.dropped() == 0);
+
+  // Compaction shows up as a free and a malloc for each block it moves
+  heap.observer().recorder = &recorder;
+  recorder.clear();
+  expected.clear();
+  auto d = malloc_range(6);
+  auto e = malloc_range(8);
+  free(d);
+  heap.compact(
+    [&](auto const& map) {
+      auto moved = map(e);
+      REQUIRE(static_cast<uint64_t>(moved) != static_cast<uint64_t>(e));
+      expected.push_back({nocopy::trace_op::free, 0, static_cast<uint64_t>(e), 0});
+      expected.push_back({nocopy::trace_op::malloc, 0, static_cast<uint64_t>(moved), 16});
+      e = moved;
+    }
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  free(e);
+  events.clear();
+  nocopy::read_trace(
+    recorder.trace().data(), recorder.trace().size()
+  , [&](nocopy::trace_event event) { events.push_back(event); }
+  , []() {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  REQUIRE(events.size() == expected.size());
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    REQUIRE(events[i].op == expected[i].op);
+    REQUIRE(events[i].offset == expected[i].offset);
+    REQUIRE(events[i].size == expected[i].size);
+  }
+}
@@ -0,0 +1,124 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <array>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+  struct point {
+    NOCOPY_FIELD(x, int32_t);
+    NOCOPY_FIELD(y, int32_t);
+    using type = nocopy::structpack<x_t, y_t>;
+  };
+  using point_t = point::type;
+}
+
+TEST_CASE("interning", "[interner]") {
+  using archive_t = nocopy::growable_archive32<>;
+  auto archive = archive_t::create(
+    nullptr, 0, nocopy::vector_growth{}
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  nocopy::interner32 interner;
+  auto add_string = [&](std::string const& str) {
+    return interner.add(
+      archive, str
+    , [](auto ref) { return ref; }
+    , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  };
+
+  // Repeated strings share a reference
+  auto first = add_string("temperature");
+  auto cursor = archive.cursor();
+  for (int i = 0; i < 100; ++i) {
+    auto again = add_string("temperature");
+    REQUIRE(static_cast<uint32_t>(again) == static_cast<uint32_t>(first));
+    REQUIRE(archive.deref(again).size() == archive.deref(first).size());
+  }
+  REQUIRE(archive.cursor() == cursor);
+  REQUIRE(std::string{archive.get_string(first)} == "temperature");
+
+  // Different strings (including prefixes) do not
+  auto other = add_string("temp");
+  REQUIRE(static_cast<uint32_t>(other) != static_cast<uint32_t>(first));
+  REQUIRE(std::string{archive.get_string(other)} == "temp");
+  REQUIRE(interner.size() == 2);
+
+  // Ranges are interned by contents
+  auto add_points = [&](auto const& points) {
+    return interner.add(
+      archive, gsl::span<point_t const>{points}
+    , [](auto ref) { return ref; }
+    , [](std::error_code) -> archive_t::range_reference<point_t const> { throw std::runtime_error{"shouldn't happen"}; }
+    );
+  };
+  std::array<point_t, 3> points{};
+  points[1][point::x] = 7;
+  auto a = add_points(points);
+  auto b = add_points(points);
+  REQUIRE(static_cast<uint32_t>(a) == static_cast<uint32_t>(b));
+  REQUIRE(archive.deref(b).size() == 3);
+  REQUIRE(archive.deref(b)[1][point::x] == 7);
+  points[2][point::y] = 1;
+  auto c = add_points(points);
+  REQUIRE(static_cast<uint32_t>(c) != static_cast<uint32_t>(a));
+  REQUIRE(archive.deref(c)[2][point::y] == 1);
+  REQUIRE(interner.size() == 4);
+
+  // Interned ranges are shared, so they cannot be written through
+  static_assert(
+    std::is_same<decltype(a), archive_t::range_reference<point_t const>>::value, ""
+  );
+
+  // Truncating forgets what the archive discarded, and nothing before it
+  auto kept = archive.cursor();
+  auto dropped = add_string("humidity");
+  archive.truncate(kept);
+  interner.truncate(kept);
+  REQUIRE(interner.size() == 4);
+  REQUIRE(static_cast<uint32_t>(add_string("temperature")) == static_cast<uint32_t>(first));
+  auto readded = add_string("humidity");
+  REQUIRE(static_cast<uint32_t>(readded) == static_cast<uint32_t>(dropped));
+  REQUIRE(std::string{archive.get_string(readded)} == "humidity");
+  REQUIRE(interner.size() == 5);
+  archive.truncate(static_cast<uint32_t>(c));
+  interner.truncate(static_cast<uint32_t>(c));
+  REQUIRE(interner.size() == 3);
+
+  interner.clear();
+  REQUIRE(interner.size() == 0);
+  auto fresh = add_string("temperature");
+  REQUIRE(static_cast<uint32_t>(fresh) != static_cast<uint32_t>(first));
+}
+
+TEST_CASE("interning into a streaming archive", "[interner]") {
+  using archive_t = nocopy::streaming_archive64<>;
+  std::stringstream stream;
+  auto archive = archive_t::create(
+    nocopy::ostream_sink{stream}, 64
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  nocopy::interner64 interner;
+  std::vector<uint64_t> offsets;
+  for (int i = 0; i < 100; ++i) {
+    interner.add(
+      archive, "tag " + std::to_string(i % 10)
+    , [&](auto ref) { offsets.push_back(static_cast<uint64_t>(ref)); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    archive.flush([]() {}, [](std::error_code) { REQUIRE(false); });
+  }
+  // Strings interned before a flush are still found afterward
+  REQUIRE(interner.size() == 10);
+  for (std::size_t i = 10; i < offsets.size(); ++i) {
+    REQUIRE(offsets[i] == offsets[i % 10]);
+  }
+  archive.finish([]() {}, [](std::error_code) { REQUIRE(false); });
+}
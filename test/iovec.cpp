@@ -0,0 +1,59 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+#include <nocopy/iovec.hpp>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+TEST_CASE("writing archive images with writev", "[archive]") {
+  using archive_t = nocopy::archive32<1 << 16>;
+  char path[] = "/tmp/nocopy_iovec_XXXXXX";
+  int fd = ::mkstemp(path);
+  REQUIRE(fd >= 0);
+
+  // Small messages built in large archives only cost their used bytes
+  std::vector<std::unique_ptr<archive_t>> archives;
+  std::vector<archive_t::range_reference<char const>> names;
+  std::vector<iovec> iovecs;
+  for (int i = 0; i < 10; ++i) {
+    archives.emplace_back(new archive_t{});
+    names.push_back(archives.back()->add(
+      "message " + std::to_string(i)
+    , [](auto ref) { return ref; }
+    , [](std::error_code) -> archive_t::range_reference<char const> { throw std::runtime_error{"shouldn't happen"}; }
+    ));
+    iovecs.push_back(nocopy::image_iovec(*archives.back()));
+  }
+  REQUIRE(!nocopy::write_iovecs(fd, iovecs.data(), iovecs.size()));
+
+  std::size_t total = 0;
+  for (auto& a : archives) total += static_cast<std::size_t>(a->image().size());
+  REQUIRE(static_cast<std::size_t>(::lseek(fd, 0, SEEK_END)) == total);
+  REQUIRE(total < 10 * 64);
+
+  // Each image is loaded back into a reused archive
+  std::vector<unsigned char> contents(total);
+  REQUIRE(::pread(fd, contents.data(), total, 0) == static_cast<ssize_t>(total));
+  auto loaded = std::unique_ptr<archive_t>{new archive_t{}};
+  std::size_t position = 0;
+  for (int i = 0; i < 10; ++i) {
+    auto size = static_cast<std::size_t>(archives[static_cast<std::size_t>(i)]->image().size());
+    loaded->load(
+      contents.data() + position, size
+    , []() {}
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    REQUIRE(loaded->cursor() == archives[static_cast<std::size_t>(i)]->cursor());
+    REQUIRE(std::string{loaded->get_string(names[static_cast<std::size_t>(i)])} == "message " + std::to_string(i));
+    position += size;
+  }
+
+  ::close(fd);
+  std::remove(path);
+}
@@ -0,0 +1,53 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+#include <nocopy/fd_sink.hpp>
+#include <nocopy/mapped_archive.hpp>
+
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+TEST_CASE("mapped archives", "[archive_view]") {
+  using writer_t = nocopy::streaming_archive64<nocopy::fd_sink>;
+  char path[] = "/tmp/nocopy_mapped_archive_XXXXXX";
+  int fd = ::mkstemp(path);
+  REQUIRE(fd >= 0);
+  auto writer = writer_t::create(
+    nocopy::fd_sink{fd}, 4096
+  , [](writer_t w) { return w; }
+  , [](std::error_code) -> writer_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  std::vector<writer_t::range_reference<char const>> names;
+  for (int i = 0; i < 1000; ++i) {
+    writer.add(
+      "name " + std::to_string(i)
+    , [&](auto ref) { names.push_back(ref); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+  }
+  writer.finish([]() {}, [](std::error_code) { REQUIRE(false); });
+  ::close(fd);
+
+  {
+    auto mapped = nocopy::mapped_archive64::open(
+      path
+    , [](nocopy::mapped_archive64 m) { return m; }
+    , [](std::error_code) -> nocopy::mapped_archive64 { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    auto& view = mapped.view();
+    REQUIRE(view.cursor() == writer.cursor());
+    for (int i = 0; i < 1000; ++i) {
+      REQUIRE(view.get_string(names[static_cast<std::size_t>(i)]) == "name " + std::to_string(i));
+    }
+  }
+  ::unlink(path);
+
+  nocopy::mapped_archive64::open(
+    path
+  , [](nocopy::mapped_archive64) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == std::errc::no_such_file_or_directory); }
+  );
+}
@@ -0,0 +1,171 @@
+#include <catch.hpp>
+
+#include <nocopy/mapped_heap.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr unsigned long long operator "" _KB(unsigned long long val) {
+  return val << 10;
+}
+
+namespace {
+  std::string temp_path() {
+    char path[] = "/tmp/nocopy_mapped_heap_XXXXXX";
+    int fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    ::close(fd);
+    return path;
+  }
+}
+
+TEST_CASE("mapped heap persists and grows", "[mapped_heap]") {
+  using heap_t = nocopy::mapped_heap64;
+  auto path = temp_path();
+
+  std::vector<heap_t::range_reference<uint32_t>> saved;
+  {
+    auto mapped = heap_t::create(
+      path.c_str(), 16_KB, 4096_KB
+    , [](auto h) { return h; }
+    , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    auto& heap = mapped.heap();
+    auto values = heap.malloc_range<uint32_t>(
+      1000
+    , [](auto ref) { return ref; }
+    , [](std::error_code) -> heap_t::range_reference<uint32_t> { throw std::runtime_error{"shouldn't happen"}; }
+    );
+    uint32_t i = 0;
+    for (auto& value : heap.deref(values)) value = i++;
+    saved.push_back(values);
+    auto data = mapped.data();
+
+    heap.malloc_range<uint8_t>(64_KB, [](auto) { REQUIRE(false); }, [](std::error_code) {});
+    mapped.grow(256_KB, []() {}, [](std::error_code) { REQUIRE(false); });
+    REQUIRE(mapped.data() == data);
+    REQUIRE(mapped.size() == 256_KB);
+    heap.malloc_range<uint8_t>(64_KB, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+
+    // Growing into the space after a free last block extends that block
+    mapped.grow(512_KB, []() {}, [](std::error_code) { REQUIRE(false); });
+    std::size_t free_blocks = 0;
+    heap.each_free_block([&](auto, auto) { ++free_blocks; });
+    REQUIRE(free_blocks == 1);
+    REQUIRE(heap.stats().largest_free_block > 256_KB);
+
+    mapped.grow(8192_KB, []() { REQUIRE(false); }, [](std::error_code) {});
+    mapped.sync([]() {}, [](std::error_code) { REQUIRE(false); });
+  }
+
+  auto mapped = heap_t::open(
+    path.c_str(), 4096_KB
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(mapped.size() == 512_KB);
+  auto& heap = mapped.heap();
+  uint32_t i = 0;
+  for (auto value : heap.deref(saved.front())) REQUIRE(value == i++);
+  REQUIRE(heap.stats().allocated_blocks == 2);
+  heap.malloc_range<uint8_t>(256_KB, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("a failed grow leaves the mapped heap as it was", "[mapped_heap]") {
+  // Reopened with a reservation that 32 bit offsets can't address, so the
+  // heap refuses a grow after the (sparse) file has been extended
+  using heap_t = nocopy::mapped_heap32;
+  auto path = temp_path();
+  auto file_size = [&]() {
+    struct stat status;
+    REQUIRE(::stat(path.c_str(), &status) == 0);
+    return static_cast<std::size_t>(status.st_size);
+  };
+
+  heap_t::create(
+    path.c_str(), 16_KB, 64_KB
+  , [](auto) {}
+  , [](std::error_code) { REQUIRE(false); }
+  );
+  auto mapped = heap_t::open(
+    path.c_str(), 8192_KB * 1024
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  mapped.grow(
+    4096_KB * 1024
+  , []() { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_heap_size); }
+  );
+  REQUIRE(mapped.size() == 16_KB);
+  REQUIRE(file_size() == 16_KB);
+
+  mapped.grow(32_KB, []() {}, [](std::error_code) { REQUIRE(false); });
+  REQUIRE(mapped.size() == 32_KB);
+  REQUIRE(file_size() == 32_KB);
+  mapped.heap().malloc_range<uint8_t>(24_KB, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("sub arenas outlive a move of the mapped heap", "[mapped_heap]") {
+  using heap_t = nocopy::mapped_heap64;
+  using arena_t = heap_t::heap_type::sub_arena;
+  auto path = temp_path();
+  auto mapped = heap_t::create(
+    path.c_str(), 16_KB, 64_KB
+  , [](auto h) { return h; }
+  , [](std::error_code) -> heap_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  auto heap = &mapped.heap();
+
+  // Declared before the arena, so the moved heap outlives it
+  std::vector<heap_t> moved;
+  auto arena = mapped.heap().make_sub_arena(
+    1_KB
+  , [](auto a) { return a; }
+  , [](std::error_code) -> arena_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  moved.push_back(std::move(mapped));
+  REQUIRE(&moved.front().heap() == heap);
+  arena.malloc_range<uint8_t>(64, [](auto) {}, [](std::error_code) { REQUIRE(false); });
+
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("a failed create leaves the file as it was", "[mapped_heap]") {
+  using heap_t = nocopy::mapped_heap64;
+  auto path = temp_path();
+  auto file = ::fopen(path.c_str(), "w");
+  REQUIRE(file != nullptr);
+  ::fputs("keep", file);
+  ::fclose(file);
+
+  for (std::size_t size : {std::size_t{0}, std::size_t{64}}) {
+    heap_t::create(
+      path.c_str(), size, 4096_KB
+    , [](auto) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::bad_heap_size); }
+    );
+    struct stat status;
+    REQUIRE(::stat(path.c_str(), &status) == 0);
+    REQUIRE(status.st_size == 4);
+  }
+
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("mapped heap reports system errors", "[mapped_heap]") {
+  using heap_t = nocopy::mapped_heap64;
+  heap_t::open(
+    "/nonexistent/nocopy_heap", 4096_KB
+  , [](auto) { REQUIRE(false); }
+  , [](std::error_code e) { REQUIRE(e == std::errc::no_such_file_or_directory); }
+  );
+}
@@ -0,0 +1,152 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include "archive_fixtures.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+  using namespace fixtures;
+  using root_t = builder_t::single_reference<group_t>;
+
+  // A group of count shapes, each named prefix and labeled with either a tag
+  // or its index. Every shape shares one outline.
+  root_t build_shard(builder_t& builder, std::string const& prefix, uint32_t count) {
+    auto name = add_string(builder, prefix);
+    auto tag = add_string(builder, prefix + " tag");
+    auto outline = alloc_range<point_t>(builder, 3, [](auto points) {
+      for (int32_t i = 0; i < 3; ++i) {
+        points[i][point::x] = i;
+        points[i][point::y] = -i;
+      }
+    });
+    auto shapes = alloc_range<shape_t>(builder, count, [](auto) {});
+    for (uint32_t i = 0; i < count; ++i) {
+      using center_t = builder_t::single_reference<point_t>;
+      auto center = builder.alloc<point_t>([](center_t ref) { return ref; }, shouldnt_fail<center_t>{});
+      builder.deref(center)[point::x] = static_cast<int32_t>(i);
+      auto& s = builder.deref(shapes)[static_cast<std::ptrdiff_t>(i)];
+      s[shape::name] = name;
+      s[shape::center] = center;
+      s[shape::outline] = outline;
+      if (i % 2 == 0) {
+        s[shape::label][shape::tag] = tag;
+      } else {
+        s[shape::label][shape::id] = i;
+      }
+    }
+
+    auto root = builder.alloc<group_t>([](root_t ref) { return ref; }, shouldnt_fail<root_t>{});
+    builder.deref(root)[group::shapes] = shapes;
+    return root;
+  }
+
+  template <typename Archive>
+  void check_shard(Archive const& archive, root_t root, std::string const& prefix, uint32_t count) {
+    auto shapes = archive.deref(archive.deref(root)[group::shapes]);
+    REQUIRE(shapes.size() == count);
+    for (uint32_t i = 0; i < count; ++i) {
+      auto& s = shapes[static_cast<std::ptrdiff_t>(i)];
+      REQUIRE(archive.get_string(s[shape::name]) == prefix);
+      REQUIRE(archive.deref(s[shape::center])[point::x] == static_cast<int32_t>(i));
+      auto outline = archive.deref(s[shape::outline]);
+      REQUIRE(outline.size() == 3);
+      REQUIRE(outline[2][point::y] == -2);
+      s[shape::label].visit(
+        [&](shape::tag_t, auto const& tag) {
+          REQUIRE(i % 2 == 0);
+          REQUIRE(archive.get_string(tag) == prefix + " tag");
+        }
+      , [&](shape::id_t, auto const& id) { REQUIRE(id == i); }
+      );
+    }
+  }
+}
+
+TEST_CASE("merging archives", "[merge]") {
+  auto first = make_builder<builder_t>();
+  auto first_root = build_shard(first, "first", 5);
+  auto second = make_builder<builder_t>();
+  // Start the second shard unaligned, so that the merge has to pad
+  second.add(std::string{"x"}, [](auto) {}, [](std::error_code) {});
+  auto second_root = build_shard(second, "second", 4);
+
+  auto merge = [&](auto const& image, root_t root, std::error_code expected) {
+    return nocopy::merge(
+      first, open_view<view_t>(image), root
+    , [&](root_t rebased) { REQUIRE(!expected); return rebased; }
+    , [&](std::error_code e) { REQUIRE(e == expected); return root_t{}; }
+    );
+  };
+
+  auto second_image = second.image();
+  std::vector<unsigned char> copy(second_image.begin(), second_image.end());
+
+  SECTION("the merged shard is rebased and the original is untouched") {
+    auto before = first.cursor();
+    auto rebased = merge(second.image(), second_root, {});
+    REQUIRE(static_cast<uint32_t>(rebased) >= before);
+    check_shard(first, first_root, "first", 5);
+    check_shard(first, rebased, "second", 4);
+    // The source is only read
+    REQUIRE(std::equal(copy.begin(), copy.end(), second.image().begin()));
+
+    SECTION("merged archives can be merged again") {
+      auto third = make_builder<builder_t>();
+      auto merged_root = nocopy::merge(
+        third, open_view<view_t>(first.image()), rebased
+      , [](root_t r) { return r; }
+      , [](std::error_code) -> root_t { throw std::runtime_error{"shouldn't happen"}; }
+      );
+      check_shard(third, merged_root, "second", 4);
+    }
+  }
+
+  SECTION("a bad source leaves the destination unchanged") {
+    auto before = first.cursor();
+    auto shapes = second.deref(second_root)[group::shapes];
+    auto& outline = second.deref(shapes)[3][shape::outline];
+    // One point at the cursor (offset, then count, little-endian)
+    auto end = second.cursor();
+    unsigned char past_end[8] = {
+      static_cast<unsigned char>(end), static_cast<unsigned char>(end >> 8)
+    , static_cast<unsigned char>(end >> 16), static_cast<unsigned char>(end >> 24)
+    , 1, 0, 0, 0
+    };
+    std::memcpy(reinterpret_cast<unsigned char*>(&outline), past_end, sizeof(past_end));
+    merge(second.image(), second_root, nocopy::error::bad_reference);
+    REQUIRE(first.cursor() == before);
+    check_shard(first, first_root, "first", 5);
+  }
+
+  SECTION("shared ranges cannot amplify the work") {
+    // Many groups holding the same shapes: the shapes are reached once per
+    // group, which would cost quadratic time in the size of the source
+    using groups_t = builder_t::range_reference<group_t>;
+    auto shapes = second.deref(second_root)[group::shapes];
+    auto groups = second.alloc_range<group_t>(1000, [](groups_t ref) { return ref; }, shouldnt_fail<groups_t>{});
+    for (auto& g : second.deref(groups)) g[group::shapes] = shapes;
+
+    auto before = first.cursor();
+    nocopy::merge(
+      first, open_view<view_t>(second.image()), groups
+    , [](groups_t) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::graph_too_large); }
+    );
+    REQUIRE(first.cursor() == before);
+  }
+
+  SECTION("references are followed to a bounded depth") {
+    auto before = first.cursor();
+    nocopy::merge<1>(
+      first, open_view<view_t>(second.image()), second_root
+    , [](root_t) { REQUIRE(false); }
+    , [](std::error_code e) { REQUIRE(e == nocopy::error::graph_too_deep); }
+    );
+    REQUIRE(first.cursor() == before);
+  }
+}
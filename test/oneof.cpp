@@ -172,3 +172,19 @@ SCENARIO("reassignment changes the visited type", "[oneof]") {
   );
   REQUIRE(a_was_visited);
 }
+
+struct pair_or_byte {
+  NOCOPY_FIELD(x, uint32_t);
+  NOCOPY_FIELD(y, uint32_t);
+  using xy_t = nocopy::structpack<x_t, y_t>;
+  NOCOPY_FIELD(pair, xy_t);
+  NOCOPY_FIELD(byte, uint8_t);
+  using type = nocopy::oneof8<pair_t, byte_t>;
+};
+
+TEST_CASE("payloads larger than their alignment fit", "[oneof]") {
+  using type = pair_or_byte::type;
+  static_assert(type::size() == 4 + sizeof(pair_or_byte::xy_t), "the whole payload must fit");
+  static_assert(sizeof(type) == type::size(), "");
+  REQUIRE(type::alignment() == 4);
+}
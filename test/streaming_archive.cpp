@@ -0,0 +1,71 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  struct entry {
+    NOCOPY_FIELD(id, uint32_t);
+    NOCOPY_FIELD(value, double);
+    using type = nocopy::structpack<id_t, value_t>;
+  };
+  using entry_t = entry::type;
+}
+
+TEST_CASE("streaming archives", "[streaming_archive]") {
+  using archive_t = nocopy::streaming_archive64<>;
+  using loaded_t = nocopy::growable_archive64<nocopy::fixed_capacity>;
+  std::stringstream stream;
+  stream << "prefix";
+  auto archive = archive_t::create(
+    nocopy::ostream_sink{stream}, 256
+  , [](archive_t a) { return a; }
+  , [](std::error_code) -> archive_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+
+  std::vector<archive_t::single_reference<entry_t>> entries;
+  std::vector<archive_t::range_reference<char const>> names;
+  for (uint32_t i = 0; i < 300; ++i) {
+    archive.alloc<entry_t>(
+      [&](auto ref) {
+        archive.deref(ref)[entry::id] = i;
+        archive.deref(ref)[entry::value] = i / 2.0;
+        entries.push_back(ref);
+      }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    archive.add(
+      "entry " + std::to_string(i)
+    , [&](auto ref) { names.push_back(ref); }
+    , [](std::error_code) { REQUIRE(false); }
+    );
+    if (i % 50 == 49) {
+      archive.flush([]() {}, [](std::error_code) { REQUIRE(false); });
+      REQUIRE(archive.cursor() - archive.flushed() < 8);
+    }
+  }
+  auto cursor = archive.cursor();
+  archive.finish([]() {}, [](std::error_code) { REQUIRE(false); });
+
+  // The stream holds the same image a growable archive would
+  auto written = stream.str();
+  REQUIRE(written.substr(0, 6) == "prefix");
+  REQUIRE(written.size() == 6 + loaded_t::header_size + cursor);
+  std::vector<uint64_t> buffer(written.size() / sizeof(uint64_t) + 1);
+  std::memcpy(buffer.data(), written.data() + 6, written.size() - 6);
+  auto loaded = loaded_t::load(
+    reinterpret_cast<unsigned char*>(buffer.data()), written.size() - 6, nocopy::fixed_capacity{}
+  , [](loaded_t a) { return a; }
+  , [](std::error_code) -> loaded_t { throw std::runtime_error{"shouldn't happen"}; }
+  );
+  REQUIRE(loaded.cursor() == cursor);
+  for (uint32_t i = 0; i < 300; ++i) {
+    // Both archives use the same reference types
+    REQUIRE(loaded.deref(entries[i])[entry::id] == i);
+    REQUIRE(loaded.deref(entries[i])[entry::value] == i / 2.0);
+    REQUIRE(loaded.get_string(names[i]) == "entry " + std::to_string(i));
+  }
+}
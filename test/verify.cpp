@@ -0,0 +1,148 @@
+#include <catch.hpp>
+
+#include <nocopy.hpp>
+
+#include "archive_fixtures.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+  using namespace fixtures;
+}
+
+TEST_CASE("verification", "[verify]") {
+  auto builder = make_builder<builder_t>();
+  auto name = add_string(builder, "square");
+  auto outline = alloc_range<point_t>(builder, 4, [](auto) {});
+  auto shapes = alloc_range<shape_t>(builder, 3, [&](auto range) {
+    for (auto& s : range) {
+      s[shape::name] = name;
+      s[shape::outline] = outline;
+      s[shape::size][shape::side] = 2.0f;
+    }
+  });
+  auto groups = alloc_range<group_t>(builder, 1, [&](auto range) { range[0][group::shapes] = shapes; });
+
+  auto check = [&](auto root, std::error_code expected, auto max_depth) {
+    auto view = open_view<view_t>(builder.image());
+    nocopy::verify<decltype(max_depth)::value>(
+      view, root
+    , [&]() { REQUIRE(!expected); }
+    , [&](std::error_code e) { REQUIRE(e == expected); }
+    );
+  };
+  using default_depth = std::integral_constant<std::size_t, 64>;
+  check(groups, {}, default_depth{});
+
+  SECTION("references past the cursor are rejected") {
+    auto other = make_builder<builder_t>();
+    auto large = alloc_range<point_t>(other, 1000, [](auto) {});
+    builder.deref(shapes)[1][shape::outline] = large;
+    check(groups, nocopy::error::bad_reference, default_depth{});
+  }
+
+  SECTION("misaligned references are rejected") {
+    auto& center = builder.deref(shapes)[0][shape::center];
+    unsigned char offset[4] = {1, 0, 0, 0}; // little-endian
+    std::memcpy(reinterpret_cast<unsigned char*>(&center), offset, sizeof(offset));
+    check(groups, nocopy::error::bad_reference, default_depth{});
+  }
+
+  SECTION("oneof tags out of range are rejected") {
+    auto& size = builder.deref(shapes)[2][shape::size];
+    reinterpret_cast<unsigned char&>(size) = 7;
+    check(groups, nocopy::error::bad_oneof_tag, default_depth{});
+  }
+
+  SECTION("references are followed to a bounded depth") {
+    check(groups, nocopy::error::graph_too_deep, std::integral_constant<std::size_t, 1>{});
+    check(groups, {}, std::integral_constant<std::size_t, 2>{});
+    check(shapes, {}, std::integral_constant<std::size_t, 1>{});
+  }
+}
+
+namespace {
+  struct leaf {
+    NOCOPY_FIELD(name, builder_t::range_reference<char const>);
+    using type = nocopy::structpack<name_t>;
+  };
+  using leaf_t = leaf::type;
+
+  struct branch {
+    NOCOPY_FIELD(leaves, builder_t::range_reference<leaf_t>);
+    using type = nocopy::structpack<leaves_t>;
+  };
+  using branch_t = branch::type;
+
+  struct counting_visitor {
+    template <typename Ref>
+    std::error_code on_reference(Ref const&) noexcept {
+      ++calls;
+      return {};
+    }
+
+    std::size_t calls = 0;
+  };
+}
+
+TEST_CASE("verification of strings", "[verify]") {
+  auto builder = make_builder<builder_t>();
+  auto name = add_string(builder, "leaf");
+  auto leaves = alloc_range<leaf_t>(builder, 2, [&](auto range) { range[0][leaf::name] = name; });
+
+  auto check = [&](std::error_code expected) {
+    auto view = open_view<view_t>(builder.image());
+    nocopy::verify(
+      view, leaves
+    , [&]() { REQUIRE(!expected); }
+    , [&](std::error_code e) { REQUIRE(e == expected); }
+    );
+  };
+
+  // The second leaf's name is empty, which is allowed
+  check({});
+
+  SECTION("unterminated strings are rejected") {
+    const_cast<char&>(builder.deref(name)[4]) = 'x';
+    check(nocopy::error::bad_reference);
+  }
+}
+
+TEST_CASE("verification work is bounded by the archive size", "[verify]") {
+  constexpr uint32_t count = 1000;
+  auto builder = make_builder<builder_t>();
+  auto name = add_string(builder, "leaf");
+
+  auto walk = [&](auto root) {
+    auto view = open_view<view_t>(builder.image());
+    counting_visitor visitor;
+    nocopy::detail::graph_walker<uint32_t, counting_visitor> walker{view.data(), view.cursor(), 64, visitor};
+    auto result = walker.walk_root(root);
+    // Each reference visited lies in a range charged to the budget
+    REQUIRE(visitor.calls <= view.cursor() / sizeof(builder_t::single_reference<char const>));
+    return result;
+  };
+
+  SECTION("separate ranges are walked in full") {
+    auto branches = alloc_range<branch_t>(builder, count, [](auto) {});
+    for (uint32_t i = 0; i < count; ++i) {
+      auto own = alloc_range<leaf_t>(builder, 1, [&](auto range) { range[0][leaf::name] = name; });
+      builder.deref(branches)[static_cast<std::ptrdiff_t>(i)][branch::leaves] = own;
+    }
+    REQUIRE(!walk(branches));
+  }
+
+  SECTION("a range shared by every element is not walked once per element") {
+    // count branches, each holding the same count leaves: count^2 leaves to
+    // visit in only O(count) bytes
+    auto shared = alloc_range<leaf_t>(builder, count, [&](auto range) {
+      for (auto& l : range) l[leaf::name] = name;
+    });
+    auto branches = alloc_range<branch_t>(builder, count, [&](auto range) {
+      for (auto& b : range) b[branch::leaves] = shared;
+    });
+    REQUIRE(walk(branches) == nocopy::error::graph_too_large);
+  }
+}